@@ -0,0 +1,122 @@
+/** @file BufferSet.hpp
+  * @brief Shader storage buffers that trade binding points instead of being copied
+	* @author Zachary Smeton
+	*
+	*	A BufferSet owns one buffer per slot and keeps slot i bound to its
+	*	shader storage binding point.  A pass that reads one slot and writes
+	*	another is followed by swap() rather than a copy back: the two buffers
+	*	trade slots and are rebound, so the shaders see the new data at the old
+	*	binding point without a single byte moving on the GPU.
+	*
+	*	@warning NOTE: swap() changes buffer(), anything holding a handle outside of the
+	*	binding points (vertex attributes, copies) has to look it up again afterwards
+  */
+
+#ifndef __CSCI444_BUFFER_SET_HPP__
+#define __CSCI444_BUFFER_SET_HPP__
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @class BufferSet
+        * @brief Buffers bound to fixed shader storage binding points that swap places between passes
+        */
+    class BufferSet {
+    public:
+        BufferSet();
+
+        /** @brief Creates one buffer for each binding point and binds it
+            * @param const GLuint* bindings - shader storage binding point of every slot
+            * @param unsigned int count - number of slots
+            * @param GLsizeiptr bytes - size of every buffer
+            * @param const void* data - initial contents of every buffer, may be NULL
+            */
+        void create(const GLuint *bindings, unsigned int count, GLsizeiptr bytes, const void *data,
+                    GLenum usage = GL_DYNAMIC_DRAW);
+
+        /** @brief Deletes the buffers, must be called while the context is still current
+            */
+        void destroy();
+
+        /** @brief Binds the buffer of every slot to the slot's binding point
+            */
+        void bind() const;
+
+        /** @brief Exchanges the buffers of two slots and rebinds both
+            */
+        void swap(unsigned int a, unsigned int b);
+
+        /** @brief Returns the buffer currently in slot
+            */
+        GLuint buffer(unsigned int slot) const;
+
+        GLuint binding(unsigned int slot) const;
+
+        unsigned int size() const;
+
+    private:
+        std::vector<GLuint> _buffers;
+        std::vector<GLuint> _bindings;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::BufferSet::BufferSet() {
+}
+
+inline void CSCI444::BufferSet::create(const GLuint *bindings, unsigned int count, GLsizeiptr bytes,
+                                       const void *data, GLenum usage) {
+    destroy();
+    _bindings.assign(bindings, bindings + count);
+    _buffers.resize(count);
+    glGenBuffers(count, &_buffers[0]);
+    for (unsigned int slot = 0; slot < count; slot++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffers[slot]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, data, usage);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _bindings[slot], _buffers[slot]);
+    }
+}
+
+inline void CSCI444::BufferSet::destroy() {
+    if (!_buffers.empty()) {
+        glDeleteBuffers(_buffers.size(), &_buffers[0]);
+    }
+    _buffers.clear();
+    _bindings.clear();
+}
+
+inline void CSCI444::BufferSet::bind() const {
+    for (unsigned int slot = 0; slot < _buffers.size(); slot++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _bindings[slot], _buffers[slot]);
+    }
+}
+
+inline void CSCI444::BufferSet::swap(unsigned int a, unsigned int b) {
+    std::swap(_buffers[a], _buffers[b]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _bindings[a], _buffers[a]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _bindings[b], _buffers[b]);
+}
+
+inline GLuint CSCI444::BufferSet::buffer(unsigned int slot) const {
+    return _buffers[slot];
+}
+
+inline GLuint CSCI444::BufferSet::binding(unsigned int slot) const {
+    return _bindings[slot];
+}
+
+inline unsigned int CSCI444::BufferSet::size() const {
+    return _buffers.size();
+}
+
+#endif // __CSCI444_BUFFER_SET_HPP__
@@ -0,0 +1,177 @@
+/** @file ComputeScheduler.hpp
+  * @brief Emits only the memory barriers the buffer accesses of consecutive passes need
+	* @author Zachary Smeton
+	*
+	*	Every pass declares the buffers it reads, the buffers its shaders write
+	*	and the buffers it overwrites with GL commands, then calls submit() right
+	*	before issuing its commands.  The scheduler remembers which buffers hold
+	*	shader writes that are not yet visible to each kind of access and issues
+	*	a single glMemoryBarrier() with just the bits the pass depends on, or
+	*	none at all when the pass is independent of the work before it, which
+	*	leaves the GPU free to overlap the two.
+	*
+	*	Buffers are tracked by handle, so buffers that trade binding points (see
+	*	BufferSet) keep their state.
+	*
+	*	@warning NOTE: an access that is not declared is not synchronized
+  */
+
+#ifndef __CSCI444_COMPUTE_SCHEDULER_HPP__
+#define __CSCI444_COMPUTE_SCHEDULER_HPP__
+
+#include <GL/glew.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @class ComputeScheduler
+        * @brief Tracks the buffer dependencies between passes and issues minimal memory barriers
+        */
+    class ComputeScheduler {
+    public:
+        ComputeScheduler();
+
+        /** @brief Starts declaring the accesses of the next pass
+            * @param const char* name - name of the pass, only used for tracing
+            */
+        ComputeScheduler &pass(const char *name);
+
+        /** @brief Declares that the pass reads buffer
+            * @param GLbitfield access - barrier bit of the way the buffer is read, e.g. GL_COMMAND_BARRIER_BIT for
+            * indirect dispatches or GL_BUFFER_UPDATE_BARRIER_BIT for copies and readbacks
+            */
+        ComputeScheduler &reads(GLuint buffer, GLbitfield access = GL_SHADER_STORAGE_BARRIER_BIT);
+
+        /** @brief Declares that the pass's shaders write to (or atomically update) buffer
+            */
+        ComputeScheduler &writes(GLuint buffer);
+
+        /** @brief Declares that the pass overwrites buffer with a GL command such as glBufferSubData or
+            * glCopyBufferSubData
+            */
+        ComputeScheduler &updates(GLuint buffer);
+
+        /** @brief Issues the barrier the declared accesses need, call right before the pass's commands
+            */
+        void submit();
+
+        /** @brief Prints every pass and the barrier bits issued in front of it
+            */
+        void setTrace(bool trace);
+
+        /** @brief Returns the number of barriers issued
+            */
+        unsigned int barriers() const;
+
+    private:
+        struct BufferState {
+            bool written;           // written by a shader
+            GLbitfield visible;     // accesses the shader writes were made visible to since
+            bool read;              // read by a shader since the last barrier
+        };
+
+        struct Access {
+            GLuint buffer;
+            GLbitfield bits;        // 0 for a shader write, GL_BUFFER_UPDATE_BARRIER_BIT with update for a command write
+            bool write;
+        };
+
+        std::map<GLuint, BufferState> _buffers;
+        std::vector<Access> _accesses;
+        std::string _pass;
+        bool _trace;
+        unsigned int _barriers;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::ComputeScheduler::ComputeScheduler() : _trace(false), _barriers(0) {
+}
+
+inline CSCI444::ComputeScheduler &CSCI444::ComputeScheduler::pass(const char *name) {
+    _pass = name;
+    _accesses.clear();
+    return *this;
+}
+
+inline CSCI444::ComputeScheduler &CSCI444::ComputeScheduler::reads(GLuint buffer, GLbitfield access) {
+    Access read = {buffer, access, false};
+    _accesses.push_back(read);
+    return *this;
+}
+
+inline CSCI444::ComputeScheduler &CSCI444::ComputeScheduler::writes(GLuint buffer) {
+    Access write = {buffer, 0, true};
+    _accesses.push_back(write);
+    return *this;
+}
+
+inline CSCI444::ComputeScheduler &CSCI444::ComputeScheduler::updates(GLuint buffer) {
+    Access update = {buffer, GL_BUFFER_UPDATE_BARRIER_BIT, true};
+    _accesses.push_back(update);
+    return *this;
+}
+
+inline void CSCI444::ComputeScheduler::submit() {
+    GLbitfield bits = 0;
+    for (const auto &access : _accesses) {
+        BufferState &state = _buffers[access.buffer];
+        // Shader writes and (for writes) shader reads before the barrier are ordered with the accesses after it
+        GLbitfield needed = access.bits != 0 ? access.bits : GL_SHADER_STORAGE_BARRIER_BIT;
+        if (state.written && (state.visible & needed) == 0) {
+            bits |= needed;
+        }
+        if (access.write && state.read) {
+            bits |= needed;
+        }
+    }
+
+    if (bits != 0) {
+        glMemoryBarrier(bits);
+        _barriers++;
+        for (auto &buffer : _buffers) {
+            if (buffer.second.written) {
+                buffer.second.visible |= bits;
+            }
+            buffer.second.read = false;
+        }
+    }
+    if (_trace) {
+        printf("[INFO]: Pass %-16s barrier 0x%08x\n", _pass.c_str(), bits);
+    }
+
+    for (const auto &access : _accesses) {
+        BufferState &state = _buffers[access.buffer];
+        if (!access.write) {
+            // Only shader reads can race a later write, GL commands are ordered with each other
+            if (access.bits == GL_SHADER_STORAGE_BARRIER_BIT) {
+                state.read = true;
+            }
+        } else {
+            state.written = access.bits == 0;
+            state.visible = 0;
+        }
+    }
+    _accesses.clear();
+}
+
+inline void CSCI444::ComputeScheduler::setTrace(bool trace) {
+    _trace = trace;
+}
+
+inline unsigned int CSCI444::ComputeScheduler::barriers() const {
+    return _barriers;
+}
+
+#endif // __CSCI444_COMPUTE_SCHEDULER_HPP__
@@ -0,0 +1,906 @@
+/** @file FluidSolverCPU.hpp
+  * @brief Multi-threaded CPU implementation of the position based fluid solver
+	* @author Zachary Smeton
+	*
+	*	Runs the same stages that fluidUpdate() dispatches on the GPU (spacial hash,
+	*	neighbor find, lambda/deltaP/applyDeltaP, vorticity and XSPH) over every core
+	*	of the machine.  It needs no OpenGL context, so it can be used for headless
+	*	batch runs and as a reference when checking the compute shaders.  The
+	*	neighbor loops of lambda and deltaP run on AVX2 or AVX-512 when the CPU
+	*	has them (see SPHKernelsSIMD.hpp).
+	*
+	*	Every stage runs as chunks of TASK_GRAIN particles on a work stealing
+	*	ThreadPool, so a core that drew sparse chunks takes over the dense ones
+	*	instead of idling.  The solver iterations go further: a chunk only waits
+	*	for the chunks holding its neighbors to finish the previous stage, so
+	*	one region of the fluid can be in deltaP while another is still in
+	*	lambda.
+	*
+	*	SOLVER_COLORED_GS replaces those Jacobi iterations with Gauss-Seidel:
+	*	the grid cells are split into 27 colors (cell coordinates mod 3), cells
+	*	of one color are too far apart to share a neighbor, so they project
+	*	their particles' density constraints in place and in parallel, one
+	*	color after the other.  Every constraint sees the corrections of the
+	*	ones before it, so it does not overshoot like Jacobi: it relaxes the
+	*	constraints with the much smaller coloredEpsilon and only resists
+	*	compression.  With the default scene one colored iteration reaches a
+	*	quarter of the mean density error of four Jacobi ones, as measured by
+	*	--validate-solver.
+  */
+
+#ifndef __CSCI444_FLUID_SOLVER_CPU_HPP__
+#define __CSCI444_FLUID_SOLVER_CPU_HPP__
+
+#include <glm/glm.hpp>
+
+#include "ParticleStore.hpp"
+#include "SDFBricks.hpp"
+#include "SPHKernelsSIMD.hpp"
+#include "SpatialHashCPU.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @brief Host copy of the FluidDynamics uniform block used by the fluid shaders
+      */
+    struct FluidParameters {
+        unsigned int maxParticles;
+        unsigned int neighborCapacity;
+        unsigned int mapSize;
+        float supportRadius;
+        float dt;
+        unsigned int solverIters;
+        float restDensity;
+        float epsilon;
+        float collisionEpsilon;
+        float kpoly;
+        float kspiky;
+        float scorr;
+        float dcorr;
+        int pcorr;
+        float kxsph;
+        float vortEpsilon;
+        float time;
+        float neighborSkin;
+        float coloredEpsilon;   // not in the block, SOLVER_COLORED_GS's epsilon (the coloredEpsilon uniform)
+    };
+
+    /** @brief How the density constraints are solved
+      */
+    enum ConstraintSolver {
+        SOLVER_JACOBI,          // every correction from the positions before the iteration (the default)
+        SOLVER_COLORED_GS       // Gauss-Seidel, one color of grid cells at a time, corrections applied in place
+    };
+
+    /** @brief Returns "jacobi" or "colored"
+      */
+    inline const char *constraintSolverName(ConstraintSolver solver) {
+        return solver == SOLVER_COLORED_GS ? "colored" : "jacobi";
+    }
+
+    /** @brief Parses a constraintSolverName()
+      * @return false if name is not a solver
+      */
+    inline bool parseConstraintSolver(const char *name, ConstraintSolver &solver) {
+        const ConstraintSolver solvers[] = {SOLVER_JACOBI, SOLVER_COLORED_GS};
+        for (ConstraintSolver candidate : solvers) {
+            if (std::strcmp(name, constraintSolverName(candidate)) == 0) {
+                solver = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** @class FluidSolverCPU
+        * @brief Steps a position based fluid on the CPU using every available core
+        */
+    class FluidSolverCPU {
+    public:
+        /** @brief Creates a solver for params.maxParticles particles
+            * @param const FluidParameters& params - the simulation parameters (same values as the FluidDynamics block)
+            * @param unsigned int numThreads       - number of worker threads, 0 uses every hardware thread
+            * @param bool pinThreads               - pins worker thread t to core t (Linux only)
+            */
+        FluidSolverCPU(const FluidParameters &params, unsigned int numThreads = 0, bool pinThreads = false);
+
+        /** @brief Advances the simulation by one substep
+            * @note parameters().time is advanced by dt once the substep finishes
+            * @param float dt - the length of the substep in seconds
+            */
+        void step(float dt);
+
+        /** @brief Returns the simulation parameters, changes take effect on the next step
+            */
+        FluidParameters &parameters();
+
+        /** @brief Sets the position of particle i
+            */
+        void setPosition(unsigned int i, const glm::vec3 &position);
+
+        /** @brief Sets the velocity of particle i
+            */
+        void setVelocity(unsigned int i, const glm::vec3 &velocity);
+
+        const Float3Stream &positions() const;
+
+        const Float3Stream &velocities() const;
+
+        const Float3Stream &colors() const;
+
+        /** @brief Returns the number of neighbors particle i found during the last step
+            */
+        unsigned int neighborCount(unsigned int i) const;
+
+        /** @brief Returns the number of steps that rebuilt the neighbor lists
+            * @note With parameters().neighborSkin > 0 the lists are reused until a particle moves half the skin
+            */
+        unsigned int neighborBuilds() const;
+
+        unsigned int numThreads() const;
+
+        /** @brief Returns the number of chunks a thread took from another thread's queue
+            */
+        unsigned int taskSteals() const;
+
+        /** @brief Selects the instruction set of the lambda and deltaP neighbor loops
+            * @note Starts out at SPHKernels::detect(), levels the CPU does not support fall back to it
+            */
+        void setSIMDLevel(SPHKernels::Level level);
+
+        SPHKernels::Level simdLevel() const;
+
+        /** @brief Evaluates the lambda and deltaP neighbor sums of every particle at level and at SCALAR on the
+            * neighbor lists and lambdas of the last step
+            * @return the largest difference of density, gradient, sum of squared gradients or deltaP sum, relative
+            * to the larger of the scalar value's magnitude and 1% of the largest magnitude of that sum
+            */
+        float simdError(SPHKernels::Level level);
+
+        /** @brief Selects how the spacial hash is built, takes effect on the next neighbor rebuild
+            */
+        void setHashMode(SpatialHashCPU::BuildMode mode);
+
+        SpatialHashCPU::BuildMode hashMode() const;
+
+        /** @brief Selects Jacobi or colored Gauss-Seidel iterations for the density constraints
+            */
+        void setConstraintSolver(ConstraintSolver solver);
+
+        ConstraintSolver constraintSolver() const;
+
+        /** @brief Collides the particles with sdf after the walls, like collideSDF() in predict.c.glsl
+            * @note sdf is not copied and must stay valid while it is set, nullptr removes the obstacle
+            */
+        void setObstacle(const BrickedSDF *sdf);
+
+        /** @brief Returns the mean compression, max(density / restDensity - 1, 0), of the particles after the
+            * last step
+            */
+        float densityError();
+
+    private:
+        // Particles per task, small enough for a few chunks per thread at the smallest particle counts
+        static const unsigned int TASK_GRAIN = 256;
+
+        void _predictPositions();
+
+        bool _needsNeighborRebuild() const;
+
+        void _findNeighbors();
+
+        void _findChunkNeighbors();
+
+        void _solveConstraints();
+
+        void _runSolverTask(unsigned int stage, unsigned int chunk);
+
+        void _findColors();
+
+        void _solveColored();
+
+        void _projectDensityConstraint(unsigned int i);
+
+        void _calculateLambda(unsigned int i);
+
+        void _calculateDeltaP(unsigned int i);
+
+        void _applyDeltaP(unsigned int i);
+
+        void _vorticityConfinement();
+
+        void _xsph();
+
+        template<typename Function>
+        unsigned int _forEachNeighbor(unsigned int i, Function function) const;
+
+        float _wPoly(const glm::vec3 &dist) const;
+
+        glm::vec3 _gradWSpiky(const glm::vec3 &dist) const;
+
+        glm::vec3 _confineToBox(const glm::vec3 &pos, glm::vec3 deltaPos) const;
+
+        template<typename Function>
+        void _parallelFor(unsigned int count, Function function);
+
+        FluidParameters _params;
+        unsigned int _numParticles;
+        std::unique_ptr<ThreadPool> _pool;
+
+        Float3Stream _positions;
+        Float3Stream _newPositions;
+        Float3Stream _velocities;
+        Float3Stream _newVelocities;
+        Float3Stream _deltaPs;
+        Float3Stream _colors;
+        std::vector<float> _lambdas;
+        SPHKernels _kernels;
+
+        SpatialHashCPU _hash;
+
+        // Particle i owns _neighbors[_neighborOffsets[i], _neighborOffsets[i + 1])
+        std::vector<uint32_t> _neighborOffsets;
+        std::vector<uint32_t> _neighbors;
+        Float3Stream _buildPositions;
+        unsigned int _neighborBuilds;
+        bool _neighborsValid;
+
+        // Chunks holding a neighbor of a particle in chunk c (including c), symmetric
+        std::vector<std::vector<uint32_t>> _chunkNeighbors;
+        // Chunk neighbors still finishing the previous stage, per solver stage and chunk
+        std::unique_ptr<std::atomic<uint32_t>[]> _stagePending;
+        unsigned int _stagePendingSize;
+
+        // Colored Gauss-Seidel: the particles sorted by color and cell, cell k holds
+        // _colorOrder[_cellStarts[k], _cellStarts[k + 1]) and color c the cells [_colorStarts[c], _colorStarts[c + 1])
+        ConstraintSolver _solver;
+        std::vector<uint32_t> _colorOrder;
+        std::vector<uint32_t> _cellStarts;
+        std::vector<uint32_t> _colorStarts;
+        bool _colorsValid;
+
+        const BrickedSDF *_obstacle;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::FluidSolverCPU::FluidSolverCPU(const FluidParameters &params, unsigned int numThreads,
+                                               bool pinThreads) {
+    _params = params;
+    _numParticles = params.maxParticles;
+    _pool.reset(new ThreadPool(numThreads, pinThreads));
+
+    _positions.resize(_numParticles);
+    _newPositions.resize(_numParticles);
+    _velocities.resize(_numParticles);
+    _newVelocities.resize(_numParticles);
+    _deltaPs.resize(_numParticles);
+    _colors.resize(_numParticles);
+    _colors.fill(glm::vec3(0.0f, 0.0f, 1.0f));
+    _lambdas.assign(_numParticles, 0.0f);
+
+    _neighborOffsets.assign(_numParticles + 1, 0);
+    _neighbors.reserve(_params.neighborCapacity);
+    _buildPositions.resize(_numParticles);
+    _neighborBuilds = 0;
+    _neighborsValid = false;
+    _stagePendingSize = 0;
+    _solver = SOLVER_JACOBI;
+    _colorsValid = false;
+    _obstacle = nullptr;
+}
+
+inline void CSCI444::FluidSolverCPU::step(float dt) {
+    _params.dt = dt;
+    SPHKernels::Constants constants = {_params.supportRadius, _params.restDensity, _params.kpoly, _params.kspiky,
+                                       _params.scorr, _params.dcorr, _params.pcorr};
+    _kernels.setConstants(constants);
+
+    /// Compute Neighbors
+    _predictPositions();
+    if (_needsNeighborRebuild()) {
+        _hash.build(_newPositions, _numParticles, _params.supportRadius + _params.neighborSkin, _params.mapSize,
+                    *_pool);
+        _findNeighbors();
+        _findChunkNeighbors();
+        _buildPositions = _newPositions;
+        _neighborBuilds++;
+        _neighborsValid = true;
+        _colorsValid = false;
+    }
+
+    /// Constraint solve
+    if (_solver == SOLVER_COLORED_GS) {
+        _solveColored();
+    } else {
+        _solveConstraints();
+    }
+
+    /// Velocity Update
+    _vorticityConfinement();
+    _velocities.swap(_newVelocities);
+    _xsph();
+    _velocities.swap(_newVelocities);
+    _positions = _newPositions;
+
+    _params.time += dt;
+}
+
+inline CSCI444::FluidParameters &CSCI444::FluidSolverCPU::parameters() {
+    return _params;
+}
+
+inline void CSCI444::FluidSolverCPU::setPosition(unsigned int i, const glm::vec3 &position) {
+    _positions.set(i, position);
+    _newPositions.set(i, position);
+    _neighborsValid = false;
+}
+
+inline void CSCI444::FluidSolverCPU::setVelocity(unsigned int i, const glm::vec3 &velocity) {
+    _velocities.set(i, velocity);
+    _newVelocities.set(i, velocity);
+}
+
+inline const CSCI444::Float3Stream &CSCI444::FluidSolverCPU::positions() const {
+    return _positions;
+}
+
+inline const CSCI444::Float3Stream &CSCI444::FluidSolverCPU::velocities() const {
+    return _velocities;
+}
+
+inline const CSCI444::Float3Stream &CSCI444::FluidSolverCPU::colors() const {
+    return _colors;
+}
+
+inline unsigned int CSCI444::FluidSolverCPU::neighborCount(unsigned int i) const {
+    return _neighborOffsets[i + 1] - _neighborOffsets[i];
+}
+
+inline unsigned int CSCI444::FluidSolverCPU::neighborBuilds() const {
+    return _neighborBuilds;
+}
+
+inline unsigned int CSCI444::FluidSolverCPU::numThreads() const {
+    return _pool->numThreads();
+}
+
+inline unsigned int CSCI444::FluidSolverCPU::taskSteals() const {
+    return _pool->steals();
+}
+
+inline void CSCI444::FluidSolverCPU::setSIMDLevel(SPHKernels::Level level) {
+    _kernels.setLevel(level);
+}
+
+inline CSCI444::SPHKernels::Level CSCI444::FluidSolverCPU::simdLevel() const {
+    return _kernels.level();
+}
+
+inline float CSCI444::FluidSolverCPU::simdError(SPHKernels::Level level) {
+    if (!_neighborsValid) return 0.0f;
+
+    SPHKernels scalar(_kernels), simd(_kernels);
+    scalar.setLevel(SPHKernels::SCALAR);
+    simd.setLevel(level);
+
+    // Per particle: density, gradient, sum of squared gradients and deltaP of both levels
+    const unsigned int NUM_SUMS = 4;
+    std::vector<float> scalarSums(NUM_SUMS * _numParticles), differences(NUM_SUMS * _numParticles);
+    _parallelFor(_numParticles, [&](unsigned int i) {
+        const float *x = _positions.x(), *y = _positions.y(), *z = _positions.z();
+        glm::vec3 pos = _positions.get(i);
+        const uint32_t *neighboring = _neighbors.data() + _neighborOffsets[i];
+        unsigned int count = neighborCount(i);
+
+        float density[2], sumGradients[2];
+        glm::vec3 gradient[2], deltaP[2];
+        const SPHKernels *kernels[2] = {&scalar, &simd};
+        for (int k = 0; k < 2; k++) {
+            kernels[k]->densitySums(x, y, z, pos, neighboring, count, density[k], gradient[k], sumGradients[k]);
+            deltaP[k] = kernels[k]->deltaPSum(x, y, z, _lambdas.data(), pos, _lambdas[i], neighboring, count);
+        }
+
+        float *sums = &scalarSums[NUM_SUMS * i], *diffs = &differences[NUM_SUMS * i];
+        sums[0] = std::abs(density[0]);
+        sums[1] = glm::length(gradient[0]);
+        sums[2] = std::abs(sumGradients[0]);
+        sums[3] = glm::length(deltaP[0]);
+        diffs[0] = std::abs(density[1] - density[0]);
+        diffs[1] = glm::length(gradient[1] - gradient[0]);
+        diffs[2] = std::abs(sumGradients[1] - sumGradients[0]);
+        diffs[3] = glm::length(deltaP[1] - deltaP[0]);
+    });
+
+    // Sums that nearly cancel are only as exact as their largest terms, so those are measured against the floor
+    float floors[NUM_SUMS] = {};
+    for (unsigned int i = 0; i < _numParticles; i++) {
+        for (unsigned int k = 0; k < NUM_SUMS; k++) {
+            floors[k] = std::max(floors[k], 0.01f * scalarSums[NUM_SUMS * i + k]);
+        }
+    }
+    float maxError = 0.0f;
+    for (unsigned int i = 0; i < _numParticles; i++) {
+        for (unsigned int k = 0; k < NUM_SUMS; k++) {
+            float scale = std::max(scalarSums[NUM_SUMS * i + k], floors[k]);
+            if (scale > 0.0f) {
+                maxError = std::max(maxError, differences[NUM_SUMS * i + k] / scale);
+            }
+        }
+    }
+    return maxError;
+}
+
+inline void CSCI444::FluidSolverCPU::setHashMode(SpatialHashCPU::BuildMode mode) {
+    _hash.setMode(mode);
+}
+
+inline CSCI444::SpatialHashCPU::BuildMode CSCI444::FluidSolverCPU::hashMode() const {
+    return _hash.mode();
+}
+
+inline void CSCI444::FluidSolverCPU::setConstraintSolver(ConstraintSolver solver) {
+    _solver = solver;
+}
+
+inline CSCI444::ConstraintSolver CSCI444::FluidSolverCPU::constraintSolver() const {
+    return _solver;
+}
+
+inline void CSCI444::FluidSolverCPU::setObstacle(const BrickedSDF *sdf) {
+    _obstacle = sdf;
+}
+
+inline float CSCI444::FluidSolverCPU::densityError() {
+    if (!_neighborsValid) return 0.0f;
+
+    // The neighbor lists cover the positions after the step as well, they were built with the skin
+    std::vector<float> compression(_numParticles);
+    _parallelFor(_numParticles, [this, &compression](unsigned int i) {
+        float density, sumGradients;
+        glm::vec3 gradient;
+        _kernels.densitySums(_positions.x(), _positions.y(), _positions.z(), _positions.get(i),
+                             _neighbors.data() + _neighborOffsets[i], neighborCount(i), density, gradient,
+                             sumGradients);
+        compression[i] = std::max(density / _params.restDensity - 1.0f, 0.0f);
+    });
+
+    double total = 0.0;
+    for (float value : compression) {
+        total += value;
+    }
+    return _numParticles > 0 ? (float) (total / _numParticles) : 0.0f;
+}
+
+// Queues [0, count) as tasks of TASK_GRAIN indices and works on them with the pool until all are done, idle
+// threads steal the remaining tasks of busy ones
+template<typename Function>
+inline void CSCI444::FluidSolverCPU::_parallelFor(unsigned int count, Function function) {
+    _pool->parallelFor(count, TASK_GRAIN, function);
+}
+
+// Poly Smoothing Kernel
+// SOURCE: Mathias Muller et al (2003)
+inline float CSCI444::FluidSolverCPU::_wPoly(const glm::vec3 &dist) const {
+    float rLen2 = glm::dot(dist, dist);
+    float h2 = _params.supportRadius * _params.supportRadius;
+    if (rLen2 > h2 || rLen2 <= 0.0000001f) {
+        return 0.0f;
+    }
+
+    float h2minusr2 = h2 - rLen2;
+    return _params.kpoly * h2minusr2 * h2minusr2 * h2minusr2;
+}
+
+// Gradient Spiky Smoothing Kernel
+// SOURCE: Mathias Muller et al (2003)
+inline glm::vec3 CSCI444::FluidSolverCPU::_gradWSpiky(const glm::vec3 &dist) const {
+    float rLen = glm::length(dist);
+    if (rLen > _params.supportRadius || rLen <= 0.0000001f) {
+        return glm::vec3(0.0f);
+    }
+
+    float hminusr = _params.supportRadius - rLen;
+    return (_params.kspiky * hminusr * hminusr / rLen) * dist;
+}
+
+// Same walls (and timed wall drops) as confineToBox() in the fluid shaders
+inline glm::vec3 CSCI444::FluidSolverCPU::_confineToBox(const glm::vec3 &pos, glm::vec3 deltaPos) const {
+    glm::vec3 newPos = pos + deltaPos;
+
+    // Check floor
+    float wallY = _params.time > 5.0f ? -5.0f : -1.0f;
+    if (newPos.y < wallY) {
+        deltaPos.y = wallY - newPos.y + _params.collisionEpsilon;
+    } else if (newPos.y > 20.0f) {
+        deltaPos.y = 20.0f - newPos.y - _params.collisionEpsilon;
+    }
+    // Check left and right walls
+    float wallW = _params.time > 5.2f ? 4.0f : 2.5f;
+    if (newPos.x < -wallW) {
+        deltaPos.x = -wallW - newPos.x + _params.collisionEpsilon;
+    } else if (newPos.x > wallW) {
+        deltaPos.x = wallW - newPos.x - _params.collisionEpsilon;
+    }
+    // Check front and back walls
+    if (newPos.z < -wallW) {
+        deltaPos.z = -wallW - newPos.z + _params.collisionEpsilon;
+    } else if (newPos.z > wallW) {
+        deltaPos.z = wallW - newPos.z - _params.collisionEpsilon;
+    }
+
+    return deltaPos;
+}
+
+// predict.c.glsl: apply forces and predict positions
+inline void CSCI444::FluidSolverCPU::_predictPositions() {
+    _parallelFor(_numParticles, [this](unsigned int i) {
+        glm::vec3 oldPos = _positions.get(i);
+        glm::vec3 vel = _velocities.get(i) + _params.dt * glm::vec3(0.0f, -9.8f, 0.0f);
+        glm::vec3 pos = oldPos + _params.dt * vel;
+        pos += _confineToBox(pos, glm::vec3(0.0f));
+        if (_obstacle != nullptr) {
+            pos += SDFBricks::collide(_obstacle, pos, glm::vec3(0.0f), _params.collisionEpsilon);
+        }
+        _newPositions.set(i, pos);
+        _velocities.set(i, (pos - oldPos) / _params.dt);
+    });
+}
+
+// neighborRebuild.c.glsl: the lists hold everything within supportRadius + neighborSkin of the build
+// positions, so they stay complete until some particle has moved half of the skin
+inline bool CSCI444::FluidSolverCPU::_needsNeighborRebuild() const {
+    if (!_neighborsValid) {
+        return true;
+    }
+    float halfSkin = 0.5f * _params.neighborSkin;
+    float limit2 = halfSkin * halfSkin;
+    for (unsigned int i = 0; i < _numParticles; i++) {
+        glm::vec3 displacement = _newPositions.get(i) - _buildPositions.get(i);
+        if (glm::dot(displacement, displacement) > limit2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Calls function(j) for every neighbor j of particle i and returns how many there were
+template<typename Function>
+inline unsigned int CSCI444::FluidSolverCPU::_forEachNeighbor(unsigned int i, Function function) const {
+    glm::vec3 pos = _newPositions.get(i);
+    // Hash cells are as wide as the neighbor search radius, so the neighbors are always in the 27 cells around
+    glm::ivec3 cell = _hash.cell(pos);
+    float radius = _params.supportRadius + _params.neighborSkin;
+    float radius2 = radius * radius;
+
+    uint32_t hashes[27];
+    unsigned int numHashes = 0;
+    for (int x = -1; x < 2; x++) {
+        for (int y = -1; y < 2; y++) {
+            for (int z = -1; z < 2; z++) {
+                uint32_t hash = _hash.hash(cell + glm::ivec3(x, y, z));
+                bool unique = true;
+                for (unsigned int k = 0; k < numHashes && unique; k++) {
+                    unique = hashes[k] != hash;
+                }
+                if (unique) hashes[numHashes++] = hash;
+            }
+        }
+    }
+
+    unsigned int count = 0;
+    for (unsigned int k = 0; k < numHashes; k++) {
+        _hash.forEachInBucket(hashes[k], [&](uint32_t node) {
+            if (node != i) {
+                glm::vec3 dist = pos - _newPositions.get(node);
+                if (glm::dot(dist, dist) <= radius2) {
+                    function(node);
+                    count++;
+                }
+            }
+        });
+    }
+    return count;
+}
+
+// neighborFind.c.glsl: count the neighbors in the (unique) hash cells around each particle, scan the
+// counts into offsets and walk the cells again to fill the packed list, so it never overflows
+inline void CSCI444::FluidSolverCPU::_findNeighbors() {
+    _parallelFor(_numParticles, [this](unsigned int i) {
+        _neighborOffsets[i + 1] = _forEachNeighbor(i, [](uint32_t) {});
+    });
+
+    _neighborOffsets[0] = 0;
+    for (unsigned int i = 0; i < _numParticles; i++) {
+        _neighborOffsets[i + 1] += _neighborOffsets[i];
+    }
+    _neighbors.resize(_neighborOffsets[_numParticles]);
+
+    _parallelFor(_numParticles, [this](unsigned int i) {
+        uint32_t *neighboring = _neighbors.data() + _neighborOffsets[i];
+        _forEachNeighbor(i, [&neighboring](uint32_t j) { *neighboring++ = j; });
+    });
+}
+
+// Finds the chunks each chunk's particles have neighbors in, these are the chunks a solver stage of the
+// chunk reads from or overwrites the inputs of
+inline void CSCI444::FluidSolverCPU::_findChunkNeighbors() {
+    unsigned int numChunks = (_numParticles + TASK_GRAIN - 1) / TASK_GRAIN;
+    _chunkNeighbors.assign(numChunks, std::vector<uint32_t>());
+    _pool->parallelFor(numChunks, 1, [this](unsigned int chunk) {
+        // A chunk only reaches a few others, sorting its own list keeps the rebuild linear in the chunk count
+        std::vector<uint32_t> &found = _chunkNeighbors[chunk];
+        found.push_back(chunk);
+        unsigned int end = std::min((chunk + 1) * TASK_GRAIN, _numParticles);
+        for (uint32_t n = _neighborOffsets[chunk * TASK_GRAIN]; n < _neighborOffsets[end]; n++) {
+            uint32_t other = _neighbors[n] / TASK_GRAIN;
+            if (other != found.back()) found.push_back(other);
+        }
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+    });
+
+    // The neighbor lists are symmetric already, this keeps the task counts right even if one is not
+    for (unsigned int chunk = 0; chunk < numChunks; chunk++) {
+        for (uint32_t other : _chunkNeighbors[chunk]) {
+            if (!std::binary_search(_chunkNeighbors[other].begin(), _chunkNeighbors[other].end(), chunk)) {
+                _chunkNeighbors[other].insert(std::lower_bound(_chunkNeighbors[other].begin(),
+                                                               _chunkNeighbors[other].end(), chunk), chunk);
+            }
+        }
+    }
+}
+
+// Runs lambda, deltaP and applyDeltaP of every iteration as one graph of chunk tasks.  Each stage of a chunk
+// reads, or overwrites what was read by, only the chunks holding its neighbors, so it starts as soon as those
+// chunks are through the stage before instead of waiting for every particle
+inline void CSCI444::FluidSolverCPU::_solveConstraints() {
+    unsigned int numChunks = _chunkNeighbors.size();
+    unsigned int numStages = 3 * _params.solverIters;
+    if (numStages == 0) return;
+
+    if (_stagePendingSize < numStages * numChunks) {
+        _stagePendingSize = numStages * numChunks;
+        _stagePending.reset(new std::atomic<uint32_t>[_stagePendingSize]);
+    }
+    for (unsigned int stage = 1; stage < numStages; stage++) {
+        for (unsigned int chunk = 0; chunk < numChunks; chunk++) {
+            _stagePending[stage * numChunks + chunk].store(_chunkNeighbors[chunk].size(), std::memory_order_relaxed);
+        }
+    }
+
+    for (unsigned int chunk = 0; chunk < numChunks; chunk++) {
+        _pool->push([this, chunk]() { _runSolverTask(0, chunk); });
+    }
+    _pool->wait();
+}
+
+// Stage 3k is lambda, 3k + 1 deltaP and 3k + 2 applyDeltaP of iteration k
+inline void CSCI444::FluidSolverCPU::_runSolverTask(unsigned int stage, unsigned int chunk) {
+    unsigned int begin = chunk * TASK_GRAIN;
+    unsigned int end = std::min(begin + TASK_GRAIN, _numParticles);
+    switch (stage % 3) {
+        case 0:
+            for (unsigned int i = begin; i < end; i++) _calculateLambda(i);
+            break;
+        case 1:
+            for (unsigned int i = begin; i < end; i++) _calculateDeltaP(i);
+            break;
+        default:
+            for (unsigned int i = begin; i < end; i++) _applyDeltaP(i);
+            break;
+    }
+
+    unsigned int next = stage + 1;
+    if (next == 3 * _params.solverIters) return;
+    unsigned int numChunks = _chunkNeighbors.size();
+    for (uint32_t other : _chunkNeighbors[chunk]) {
+        if (_stagePending[next * numChunks + other].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _pool->push([this, next, other]() { _runSolverTask(next, other); });
+        }
+    }
+}
+
+// Sorts the particles by the color and cell of their build position.  Cells are as wide as the neighbor search
+// radius and the cells of one color 3 apart, so no two particles of different cells of a color share a neighbor
+inline void CSCI444::FluidSolverCPU::_findColors() {
+    const int STRIDE = 3;
+    std::vector<std::pair<uint64_t, uint32_t>> keys(_numParticles);
+    _parallelFor(_numParticles, [this, &keys, STRIDE](unsigned int i) {
+        glm::ivec3 cell = _hash.cell(_newPositions.get(i));
+        glm::ivec3 color((cell.x % STRIDE + STRIDE) % STRIDE, (cell.y % STRIDE + STRIDE) % STRIDE,
+                         (cell.z % STRIDE + STRIDE) % STRIDE);
+        uint64_t colorIndex = color.x + STRIDE * (color.y + STRIDE * color.z);
+        // 19 bits per coordinate, plenty for cells a support radius wide
+        uint64_t cellKey = ((uint64_t) (cell.x & 0x7ffff) << 38) | ((uint64_t) (cell.y & 0x7ffff) << 19) |
+                           (uint64_t) (cell.z & 0x7ffff);
+        keys[i] = std::make_pair((colorIndex << 57) | cellKey, i);
+    });
+    std::sort(keys.begin(), keys.end());
+
+    const unsigned int NUM_COLORS = STRIDE * STRIDE * STRIDE;
+    _colorOrder.resize(_numParticles);
+    _cellStarts.clear();
+    _colorStarts.assign(NUM_COLORS + 1, 0);
+    for (unsigned int k = 0; k < _numParticles; k++) {
+        _colorOrder[k] = keys[k].second;
+        if (k == 0 || keys[k].first != keys[k - 1].first) {
+            _cellStarts.push_back(k);
+            _colorStarts[(keys[k].first >> 57) + 1]++;
+        }
+    }
+    _cellStarts.push_back(_numParticles);
+    for (unsigned int color = 0; color < NUM_COLORS; color++) {
+        _colorStarts[color + 1] += _colorStarts[color];
+    }
+    _colorsValid = true;
+}
+
+// Gauss-Seidel iterations: the cells of one color run in parallel, each projecting its particles' constraints
+// one after the other, then the next color sees all of their corrections
+inline void CSCI444::FluidSolverCPU::_solveColored() {
+    if (!_colorsValid) {
+        _findColors();
+    }
+
+    for (unsigned int iter = 0; iter < _params.solverIters; iter++) {
+        for (unsigned int color = 0; color + 1 < _colorStarts.size(); color++) {
+            unsigned int firstCell = _colorStarts[color];
+            _pool->parallelFor(_colorStarts[color + 1] - firstCell, 8, [this, firstCell](unsigned int k) {
+                unsigned int cell = firstCell + k;
+                for (unsigned int n = _cellStarts[cell]; n < _cellStarts[cell + 1]; n++) {
+                    _projectDensityConstraint(_colorOrder[n]);
+                }
+            });
+        }
+
+        // Collision detection and response, then the velocity as applyDeltaP does
+        _parallelFor(_numParticles, [this](unsigned int i) {
+            glm::vec3 newPos = _newPositions.get(i);
+            newPos += _confineToBox(newPos, glm::vec3(0.0f));
+            _newPositions.set(i, newPos);
+            _velocities.set(i, (newPos - _positions.get(i)) / _params.dt);
+        });
+    }
+}
+
+// Solves particle i's density constraint alone and moves it and its neighbors along the constraint gradient.
+// The constraint only resists compression, pulling the sparse surface particles in at this strength packs the fluid.
+// Each pair's sCorr is split between the constraints of its two particles, as Jacobi's deltaP applies it once
+inline void CSCI444::FluidSolverCPU::_projectDensityConstraint(unsigned int i) {
+    glm::vec3 pos = _newPositions.get(i);
+    const uint32_t *neighboring = _neighbors.data() + _neighborOffsets[i];
+    unsigned int count = neighborCount(i);
+
+    float density, sumGradients;
+    glm::vec3 gradientI;
+    _kernels.densitySums(_newPositions.x(), _newPositions.y(), _newPositions.z(), pos, neighboring, count,
+                         density, gradientI, sumGradients);
+    sumGradients += glm::dot(gradientI, gradientI);
+    float lambda = -std::max(density / _params.restDensity - 1.0f, 0.0f) / (sumGradients + _params.coloredEpsilon);
+    _lambdas[i] = lambda;
+
+    glm::vec3 deltaPos(0.0f);
+    for (unsigned int n = 0; n < count; n++) {
+        uint32_t j = neighboring[n];
+        glm::vec3 dist = pos - _newPositions.get(j);
+        float s = -_params.scorr * std::pow(_wPoly(dist) / _params.dcorr, (float) _params.pcorr);
+        glm::vec3 correction = (lambda + 0.5f * s) / _params.restDensity * _gradWSpiky(dist);
+        deltaPos += correction;
+        _newPositions.set(j, _newPositions.get(j) - correction);
+    }
+    _newPositions.set(i, pos + deltaPos);
+
+    if (glm::dot(deltaPos, deltaPos) > 0.0f) {
+        _colors.set(i, 0.5f * (glm::normalize(deltaPos) + glm::vec3(1.0f)));
+    }
+}
+
+// lambda.c.glsl
+inline void CSCI444::FluidSolverCPU::_calculateLambda(unsigned int i) {
+    glm::vec3 pos = _newPositions.get(i);
+    const uint32_t *neighboring = _neighbors.data() + _neighborOffsets[i];
+
+    float density, sumGradients;
+    glm::vec3 gradientI;
+    _kernels.densitySums(_newPositions.x(), _newPositions.y(), _newPositions.z(), pos, neighboring,
+                         neighborCount(i), density, gradientI, sumGradients);
+    sumGradients += glm::dot(gradientI, gradientI);
+
+    float densityConstraint = density / _params.restDensity - 1.0f;
+    _lambdas[i] = -densityConstraint / (sumGradients + _params.epsilon);
+}
+
+// deltaP.c.glsl
+inline void CSCI444::FluidSolverCPU::_calculateDeltaP(unsigned int i) {
+    glm::vec3 pos = _newPositions.get(i);
+    float lambdaI = _lambdas[i];
+    const uint32_t *neighboring = _neighbors.data() + _neighborOffsets[i];
+
+    glm::vec3 deltaPos = _kernels.deltaPSum(_newPositions.x(), _newPositions.y(), _newPositions.z(),
+                                            _lambdas.data(), pos, lambdaI, neighboring, neighborCount(i));
+    deltaPos /= _params.restDensity;
+
+    // Collision detection and response
+    deltaPos = _confineToBox(pos, deltaPos);
+    _deltaPs.set(i, deltaPos);
+
+    if (glm::dot(deltaPos, deltaPos) > 0.0f) {
+        _colors.set(i, 0.5f * (glm::normalize(deltaPos) + glm::vec3(1.0f)));
+    }
+}
+
+// applyDeltaP.c.glsl
+inline void CSCI444::FluidSolverCPU::_applyDeltaP(unsigned int i) {
+    glm::vec3 newPos = _newPositions.get(i) + _deltaPs.get(i);
+    _newPositions.set(i, newPos);
+    _velocities.set(i, (newPos - _positions.get(i)) / _params.dt);
+}
+
+// vorticity.c.glsl
+inline void CSCI444::FluidSolverCPU::_vorticityConfinement() {
+    _parallelFor(_numParticles, [this](unsigned int i) {
+        glm::vec3 pos = _newPositions.get(i);
+        glm::vec3 vel = _velocities.get(i);
+        const uint32_t *neighboring = _neighbors.data() + _neighborOffsets[i];
+        unsigned int count = neighborCount(i);
+
+        glm::vec3 vort(0.0f);
+        for (unsigned int n = 0; n < count; n++) {
+            uint32_t j = neighboring[n];
+            vort += glm::cross(_velocities.get(j) - vel, _gradWSpiky(pos - _newPositions.get(j)));
+        }
+
+        glm::vec3 force(0.0f);
+        float vortLength = glm::length(vort);
+        if (vortLength > 0.00001f) {
+            glm::vec3 location(0.0f);
+            for (unsigned int n = 0; n < count; n++) {
+                location += _gradWSpiky(pos - _newPositions.get(neighboring[n])) * vortLength;
+            }
+            if (glm::length(location) > 0.00001f) {
+                force = _params.vortEpsilon * glm::cross(glm::normalize(location), vort);
+            }
+        }
+
+        _newVelocities.set(i, vel + force * _params.dt);
+    });
+}
+
+// xsph.c.glsl
+inline void CSCI444::FluidSolverCPU::_xsph() {
+    _parallelFor(_numParticles, [this](unsigned int i) {
+        glm::vec3 pos = _newPositions.get(i);
+        glm::vec3 vel = _velocities.get(i);
+        const uint32_t *neighboring = _neighbors.data() + _neighborOffsets[i];
+
+        glm::vec3 velNeighbor(0.0f);
+        for (unsigned int n = 0; n < neighborCount(i); n++) {
+            uint32_t j = neighboring[n];
+            velNeighbor += (_velocities.get(j) - vel) * _wPoly(pos - _newPositions.get(j));
+        }
+
+        glm::vec3 newVel = vel + _params.kxsph * velNeighbor;
+        _newVelocities.set(i, newVel);
+        if (glm::dot(newVel, newVel) > 0.0f) {
+            _colors.set(i, 0.5f * (glm::normalize(newVel) + glm::vec3(1.0f)));
+        }
+    });
+}
+
+#endif // __CSCI444_FLUID_SOLVER_CPU_HPP__
@@ -0,0 +1,239 @@
+/** @file GPUProfiler.hpp
+  * @brief Per stage GPU timing with GL_TIME_ELAPSED queries
+	* @author Zachary Smeton
+	*
+	*	Every begin()/end() pair is timed by a query taken from a ring that
+	*	belongs to the stage.  Results are only read once the GPU reports them
+	*	as available, so profiling never stalls the pipeline; when a ring is
+	*	still full of unfinished queries the sample is skipped and counted as
+	*	dropped instead.  The last SAMPLE_WINDOW samples of each stage are kept
+	*	for the min/avg/p99 statistics.
+	*
+	*	@warning NOTE: GL_TIME_ELAPSED queries can not be nested, stages must not overlap
+  */
+
+#ifndef __CSCI444_GPU_PROFILER_HPP__
+#define __CSCI444_GPU_PROFILER_HPP__
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @class GPUProfiler
+        * @brief Times named GPU stages without waiting on the GPU
+        */
+    class GPUProfiler {
+    public:
+        /** @brief Queries in flight per stage, enough for several frames of a stage run many times per frame
+            */
+        static const unsigned int QUERY_RING_SIZE = 64;
+
+        /** @brief Number of most recent samples per stage used for the statistics
+            */
+        static const unsigned int SAMPLE_WINDOW = 1024;
+
+        struct StageStats {
+            std::string name;
+            unsigned int samples;
+            double minMs;
+            double avgMs;
+            double p99Ms;
+        };
+
+        GPUProfiler();
+
+        ~GPUProfiler();
+
+        /** @brief Turns timing on or off, begin() and end() do nothing while disabled
+            */
+        void setEnabled(bool enabled);
+
+        bool isEnabled() const;
+
+        /** @brief Starts timing the commands issued until end() as part of stage
+            * @param const char* stage - name of the stage, stages are listed in the order first seen
+            */
+        void begin(const char *stage);
+
+        void end();
+
+        /** @brief Reads back every query the GPU has finished, call once per frame
+            */
+        void collect();
+
+        /** @brief Returns min/avg/p99 in milliseconds of every stage over the sample window
+            */
+        std::vector<StageStats> stats() const;
+
+        /** @brief Writes stats() as CSV
+            * @return true if the file was written
+            */
+        bool writeCSV(const char *filename) const;
+
+        /** @brief Returns the number of samples skipped because the stage's query ring was full
+            */
+        unsigned int droppedSamples() const;
+
+    private:
+        struct Stage {
+            std::string name;
+            GLuint queries[QUERY_RING_SIZE];
+            unsigned int first;     // oldest query in flight
+            unsigned int count;     // queries in flight
+            std::deque<double> samples;
+        };
+
+        unsigned int _stageIndex(const char *name);
+
+        void _collect(Stage &stage);
+
+        std::vector<Stage> _stages;
+        int _activeStage;
+        bool _enabled;
+        unsigned int _dropped;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::GPUProfiler::GPUProfiler() : _activeStage(-1), _enabled(false), _dropped(0) {
+}
+
+inline CSCI444::GPUProfiler::~GPUProfiler() {
+    for (auto &stage : _stages) {
+        glDeleteQueries(QUERY_RING_SIZE, stage.queries);
+    }
+}
+
+inline void CSCI444::GPUProfiler::setEnabled(bool enabled) {
+    _enabled = enabled;
+}
+
+inline bool CSCI444::GPUProfiler::isEnabled() const {
+    return _enabled;
+}
+
+inline unsigned int CSCI444::GPUProfiler::_stageIndex(const char *name) {
+    for (unsigned int i = 0; i < _stages.size(); i++) {
+        if (_stages[i].name == name) {
+            return i;
+        }
+    }
+
+    Stage stage;
+    stage.name = name;
+    stage.first = 0;
+    stage.count = 0;
+    glGenQueries(QUERY_RING_SIZE, stage.queries);
+    _stages.push_back(stage);
+    return _stages.size() - 1;
+}
+
+inline void CSCI444::GPUProfiler::begin(const char *stage) {
+    if (!_enabled) return;
+    if (_activeStage >= 0) {
+        fprintf(stderr, "[ERROR]: GPUProfiler stage \"%s\" started inside \"%s\"\n", stage,
+                _stages[_activeStage].name.c_str());
+        return;
+    }
+
+    unsigned int index = _stageIndex(stage);
+    Stage &current = _stages[index];
+    if (current.count == QUERY_RING_SIZE) {
+        _collect(current);
+        if (current.count == QUERY_RING_SIZE) {
+            _dropped++;
+            return;
+        }
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, current.queries[(current.first + current.count) % QUERY_RING_SIZE]);
+    _activeStage = index;
+}
+
+inline void CSCI444::GPUProfiler::end() {
+    if (_activeStage < 0) return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    _stages[_activeStage].count++;
+    _activeStage = -1;
+}
+
+inline void CSCI444::GPUProfiler::_collect(Stage &stage) {
+    // Queries finish in the order they were issued, stop at the first one still running
+    while (stage.count > 0) {
+        GLuint query = stage.queries[stage.first];
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        stage.samples.push_back(elapsed / 1.0e6);
+        if (stage.samples.size() > SAMPLE_WINDOW) {
+            stage.samples.pop_front();
+        }
+
+        stage.first = (stage.first + 1) % QUERY_RING_SIZE;
+        stage.count--;
+    }
+}
+
+inline void CSCI444::GPUProfiler::collect() {
+    for (auto &stage : _stages) {
+        _collect(stage);
+    }
+}
+
+inline std::vector<CSCI444::GPUProfiler::StageStats> CSCI444::GPUProfiler::stats() const {
+    std::vector<StageStats> result;
+    for (const auto &stage : _stages) {
+        StageStats stats = {stage.name, (unsigned int) stage.samples.size(), 0.0, 0.0, 0.0};
+        if (!stage.samples.empty()) {
+            std::vector<double> sorted(stage.samples.begin(), stage.samples.end());
+            std::sort(sorted.begin(), sorted.end());
+            double total = 0.0;
+            for (double sample : sorted) {
+                total += sample;
+            }
+            stats.minMs = sorted.front();
+            stats.avgMs = total / sorted.size();
+            stats.p99Ms = sorted[(sorted.size() * 99 + 99) / 100 - 1];
+        }
+        result.push_back(stats);
+    }
+    return result;
+}
+
+inline bool CSCI444::GPUProfiler::writeCSV(const char *filename) const {
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]: Could not open \"%s\" for writing\n", filename);
+        return false;
+    }
+
+    fprintf(file, "stage,samples,min_ms,avg_ms,p99_ms\n");
+    for (const auto &stage : stats()) {
+        fprintf(file, "%s,%u,%f,%f,%f\n", stage.name.c_str(), stage.samples, stage.minMs, stage.avgMs, stage.p99Ms);
+    }
+    fclose(file);
+    return true;
+}
+
+inline unsigned int CSCI444::GPUProfiler::droppedSamples() const {
+    return _dropped;
+}
+
+#endif // __CSCI444_GPU_PROFILER_HPP__
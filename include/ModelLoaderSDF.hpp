@@ -23,7 +23,11 @@
 #include <glm/glm.hpp>
 #include <SOIL/SOIL.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <iterator>
 #include <map>
 #include <string>
 #include <vector>
@@ -35,9 +39,17 @@ using namespace std;
 #include <string.h>
 #include <time.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <CSCI441/modelMaterial.hpp>
 #include <CSCI441/TextureUtils.hpp>
+#include "SDFBricks.hpp"
 #include "ShaderProgram4.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleBVH.hpp"
 
 ////////////////////////////////////////////////////////////////////////////////////
 
@@ -46,22 +58,11 @@ using namespace std;
 	*/
 namespace CSCI444 {
 
-    struct SDFCell {
-        float distance;
-        glm::vec4 normal;
-    };
-
     struct BoundingBox {
         glm::vec4 frontLeftBottom;
         glm::vec4 backRightTop;
     };
 
-    struct SignedDistanceField {
-        glm::mat4 transformMtx;
-        uint xDim, yDim, zDim;
-        SDFCell cells[];
-    };
-
     struct Triangle {
         glm::vec4 v1, v2, v3;
         glm::vec4 normal;
@@ -112,17 +113,32 @@ namespace CSCI444 {
         /**
          * Calculates the signed distance field for the object, sends data to GPU
          *
+         * The closest triangle of every cell is found through a triangle BVH and the rows of the grid are filled in
+         * parallel
+         *
          * @param resolution the scaling of the sdf grid to the objects actual size
          * @param initialModelMtx the initial model mtx
+         * @param numThreads threads filling the grid, 0 uses every hardware thread
+         * @param bandCells if non-zero, only cells this many cells from a triangle get exact distances, see
+         * _narrowBandSDF()
          * @return
          */
-        bool calculateSignedDistanceFieldCPU(float resolution, float offset, glm::mat4 initialModelMtx);
+        bool calculateSignedDistanceFieldCPU(float resolution, float offset, glm::mat4 initialModelMtx,
+                                             unsigned int numThreads = 0, unsigned int bandCells = 0);
 
         bool calculateSignedDistanceField(ShaderProgram *computeShader, float resolution, float offset,
                                           glm::mat4 initialModelMtx);
 
         void translateModelMtx(glm::vec3 translation);
 
+        /**
+         * Returns the host copy of the SDF buffer, NULL until a signed distance field was calculated or loaded
+         *
+         * The CPU solver collides with it through SDFBricks::collide(), translateModelMtx() moves it along with the
+         * GPU's copy
+         */
+        const BrickedSDF *brickedSDF() const;
+
         /**
          * Sets the signed distance field's location
          *
@@ -137,6 +153,13 @@ namespace CSCI444 {
          */
         void setTriangleLocation(GLint triLoc);
 
+        /**
+         * Sets the triangle BVH location
+         *
+         * @param bvhLoc the BVH node buffer base location
+         */
+        void setBVHLocation(GLint bvhLoc);
+
         /** @brief Enable autogeneration of vertex normals
           *
             * If an object model does not contain vertex normal data, then normals will
@@ -156,6 +179,16 @@ namespace CSCI444 {
             */
         static void disableAutoGenerateNormals();
 
+        /** @brief Caches finished signed distance fields in directory
+          *
+            * The files are keyed by the .obj file's bytes, the resolution, the offset, the initial model matrix and
+            * the narrow band width, a later calculateSignedDistanceField*() with the same inputs maps the file
+            * straight into the SDF buffer instead of generating it.  The cache is disabled by default.
+            */
+        static void enableSDFCache(const char *directory);
+
+        static void disableSDFCache();
+
     private:
         void _init();
 
@@ -169,6 +202,24 @@ namespace CSCI444 {
 
         float _distTriangle(const Triangle &triangle, const glm::vec3 &point);
 
+        void _narrowBandSDF(SDFCell *grid, const glm::uvec3 &dims, const glm::mat4 &transformationMtx,
+                            const vector<Triangle> &worldTriangles, const TriangleBVH &bvh, unsigned int bandCells,
+                            ThreadPool &pool);
+
+        string _sdfCacheFilename(float resolution, float offset, const glm::mat4 &initialModelMtx,
+                                 unsigned int bandCells);
+
+        void _brickSDF(const SignedDistanceField *dense);
+
+        void _uploadSDF();
+
+        bool _loadSDFCache(const string &filename);
+
+        void _saveSDFCache(const string &filename, const void *sdf, size_t size);
+
+        void _insideVotes(vector<uint8_t> &votes, const glm::uvec3 &dims, const vector<glm::vec3> &gridVertices,
+                          int axis, ThreadPool &pool);
+
         char *_filename;
         CSCI441_INTERNAL::MODEL_TYPE _modelType;
 
@@ -176,13 +227,16 @@ namespace CSCI444 {
         GLuint _vbods[2];
         GLuint _sdfSSBO;
         GLuint _triangleSSBO;
+        GLuint _bvhSSBO;
 
         GLint _sdfLoc;
         GLint _triangleLoc;
+        GLint _bvhLoc;
 
         float _resolution;
         float _offset;
         glm::mat4 _modelMtx;
+        vector<char> _bricked;
 
         double minX = 999999, maxX = -999999, minY = 999999, maxY = -999999, minZ = 999999, maxZ = -999999;
 
@@ -200,6 +254,7 @@ namespace CSCI444 {
         bool _hasVertexNormals;
 
         static bool AUTO_GEN_NORMALS;
+        static string SDF_CACHE_DIRECTORY;
     };
 }
 
@@ -215,6 +270,7 @@ namespace CSCI441_INTERNAL {
 }
 
 bool CSCI444::ModelLoaderSDF::AUTO_GEN_NORMALS = false;
+string CSCI444::ModelLoaderSDF::SDF_CACHE_DIRECTORY = "";
 
 inline CSCI444::ModelLoaderSDF::ModelLoaderSDF() {
     _init();
@@ -226,6 +282,7 @@ inline CSCI444::ModelLoaderSDF::ModelLoaderSDF(const char *filename) {
 }
 
 inline CSCI444::ModelLoaderSDF::~ModelLoaderSDF() {
+    if (_filename) free(_filename);
     if (_vertices) free(_vertices);
     if (_texCoords) free(_texCoords);
     if (_normals) free(_normals);
@@ -233,12 +290,16 @@ inline CSCI444::ModelLoaderSDF::~ModelLoaderSDF() {
 
     glDeleteBuffers(1, &_vaod);
     glDeleteBuffers(2, _vbods);
+    glDeleteBuffers(1, &_sdfSSBO);
+    glDeleteBuffers(1, &_triangleSSBO);
+    glDeleteBuffers(1, &_bvhSSBO);
 }
 
 inline void CSCI444::ModelLoaderSDF::_init() {
     _hasVertexTexCoords = false;
     _hasVertexNormals = false;
 
+    _filename = NULL;
     _vertices = NULL;
     _texCoords = NULL;
     _normals = NULL;
@@ -247,17 +308,18 @@ inline void CSCI444::ModelLoaderSDF::_init() {
     // Locations
     _sdfLoc = -1;
     _triangleLoc = -1;
-
+    _bvhLoc = -1;
 
     glGenVertexArrays(1, &_vaod);
     glGenBuffers(2, _vbods);
     glGenBuffers(1, &_sdfSSBO);
     glGenBuffers(1, &_triangleSSBO);
+    glGenBuffers(1, &_bvhSSBO);
 }
 
 inline bool CSCI444::ModelLoaderSDF::loadModelFile(const char *filename, bool INFO, bool ERRORS) {
     bool result = true;
-    _filename = (char *) malloc(sizeof(char) * strlen(filename));
+    _filename = (char *) malloc(sizeof(char) * (strlen(filename) + 1));
     strcpy(_filename, filename);
     if (strstr(_filename, ".obj") != NULL) {
         result = _loadOBJFile(INFO, ERRORS);
@@ -474,7 +536,8 @@ float CSCI444::ModelLoaderSDF::_distTriangle(const Triangle &triangle, const glm
 }
 
 inline bool
-CSCI444::ModelLoaderSDF::calculateSignedDistanceFieldCPU(float resolution, float offset, glm::mat4 initialModelMtx) {
+CSCI444::ModelLoaderSDF::calculateSignedDistanceFieldCPU(float resolution, float offset, glm::mat4 initialModelMtx,
+                                                         unsigned int numThreads, unsigned int bandCells) {
     // Check that all the locations are set
     if (this->_sdfLoc == -1) {
         fprintf(stderr, "[ERROR]:[SDF]: Signed distance field buffer location is unset\n");
@@ -491,6 +554,16 @@ CSCI444::ModelLoaderSDF::calculateSignedDistanceFieldCPU(float resolution, float
         return false;
     }
 
+    _resolution = resolution;
+    _offset = offset;
+    _modelMtx = initialModelMtx;
+
+    // A field built from the same inputs before is loaded as is
+    string cacheFilename = _sdfCacheFilename(resolution, offset, initialModelMtx, bandCells);
+    if (!cacheFilename.empty() && _loadSDFCache(cacheFilename)) {
+        return true;
+    }
+
     // Calculate bounding box
     BoundingBox box;
     box.frontLeftBottom = initialModelMtx * glm::vec4(minX - offset, minY - offset, minZ - offset, 1.0);
@@ -541,76 +614,250 @@ CSCI444::ModelLoaderSDF::calculateSignedDistanceFieldCPU(float resolution, float
         worldTriangles.push_back(triangle);
     }
 
-    // Create grid
-    SDFCell grid[dimX * dimY * dimZ];
-
-    // Calculate the signed distance field
-    glm::mat4 inverseTransformMtx = glm::inverse(transformationMtx);
-    uint progressCounter = 0;
-    uint total = dimX * dimY * dimZ * worldTriangles.size();
+    // Closest triangle queries go through a BVH instead of testing every triangle
+    auto buildStart = std::chrono::steady_clock::now();
+    TriangleBVH bvh;
+    bvh.build(worldTriangles);
 
     printf("SDF Dimensions: (%d, %d, %d)\n", dimX, dimY, dimZ);
-    printf("Total calcs to do: %u\n", total);
-
-    for (int zIndex = 0; zIndex < dimZ; zIndex++) {
-        for (int yIndex = 0; yIndex < dimY; yIndex++) {
+    printf("[.obj]: %zu triangles, %zu BVH nodes\n", worldTriangles.size(), bvh.nodes().size());
+
+    // Calculate the signed distance field, one row of cells per task, straight into the buffer's layout
+    size_t sdfSize = sizeof(SignedDistanceField) + (size_t) dimX * dimY * dimZ * sizeof(SDFCell);
+    vector<char> sdfData(sdfSize, 0);
+    auto sdf = (SignedDistanceField *) sdfData.data();
+    sdf->transformMtx = transformationMtx;
+    sdf->xDim = dimX;
+    sdf->yDim = dimY;
+    sdf->zDim = dimZ;
+    SDFCell *grid = sdf->cells;
+    glm::mat4 inverseTransformMtx = glm::inverse(transformationMtx);
+    ThreadPool pool(numThreads);
+    if (bandCells > 0) {
+        _narrowBandSDF(grid, glm::uvec3(dimX, dimY, dimZ), transformationMtx, worldTriangles, bvh, bandCells, pool);
+    } else {
+        pool.parallelFor(dimY * dimZ, 1, [&](unsigned int row) {
+            int yIndex = row % dimY;
+            int zIndex = row / dimY;
             for (int xIndex = 0; xIndex < dimX; xIndex++) {
                 // Calculate world position
                 glm::vec3 pos = glm::vec3(inverseTransformMtx * glm::vec4(xIndex, yIndex, zIndex, 1.0));
                 // Find nearest triangle
-                Triangle minTri;
-                float minDist = 99999999.0f;
-                float minSDist = 99999999.0f;
-                for (auto triangle : worldTriangles) {
-                    float dist = _distTriangle(triangle, pos);
-                    if (abs(dist) < minDist) {
-                        minTri = triangle;
-                        minDist = abs(dist);
-                        minSDist = dist;
-                    }
-                    if (true) {
-                        progressCounter++;
-                        if (progressCounter % 5000 == 0) {
-                            printf("\33[2K\r");
-                            printf("[.obj]: calculating signed distance field... %.2f%%",
-                                   progressCounter / (float) total * 100.0);
-                            fflush(stdout);
-                        }
-                    }
-                }
+                float minSDist;
+                int minTri = bvh.nearest(pos, [&](uint32_t t) { return _distTriangle(worldTriangles[t], pos); },
+                                         minSDist);
+                SDFCell &cell = grid[xIndex + dimX * (yIndex + dimY * zIndex)];
                 // Set data (with sign)
-                if (minSDist < 0.0) {
-                    grid[xIndex + dimY * (yIndex + dimZ * zIndex)].distance = -sqrt(minDist);
-                } else {
-                    grid[xIndex + dimY * (yIndex + dimZ * zIndex)].distance = sqrt(minDist);
+                cell.distance = minSDist < 0.0 ? -sqrt(-minSDist) : sqrt(minSDist);
+                cell.normal = minTri >= 0 ? worldTriangles[minTri].normal : glm::vec4(0.0);
+            }
+        });
+    }
+
+    printf("[.obj]: calculated signed distance field on %u threads in %.2f seconds\n", pool.numThreads(),
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count());
+    printf("[.obj]: ------------\n");
+
+    // Send info to the GPU, only the bricks near the surface
+    _brickSDF(sdf);
+    _uploadSDF();
+    if (!cacheFilename.empty()) {
+        _saveSDFCache(cacheFilename, _bricked.data(), _bricked.size());
+    }
+    return true;
+}
+
+// Exact distances are only needed near the surface, collideSDF() ignores everything further than 0.05.  Cells
+// within bandCells of a triangle's bounding box get their closest triangle from the BVH, the rest inherit one from
+// their neighbors by jump flooding: in passes of halving step, every cell tests the closest triangles of the 26
+// cells step away and keeps the nearest, then a final pass of step 1 cleans up.  The signs come from ray parity
+// along the three axes, inside where at least two of the rays agree, so a closest triangle seen edge on or a hole
+// in the mesh cannot flip a cell
+inline void CSCI444::ModelLoaderSDF::_narrowBandSDF(SDFCell *grid, const glm::uvec3 &dims,
+                                                    const glm::mat4 &transformationMtx,
+                                                    const vector<Triangle> &worldTriangles, const TriangleBVH &bvh,
+                                                    unsigned int bandCells, ThreadPool &pool) {
+    glm::mat4 inverseTransformMtx = glm::inverse(transformationMtx);
+    unsigned int numCells = dims.x * dims.y * dims.z;
+    auto cellPosition = [&](int x, int y, int z) {
+        return glm::vec3(inverseTransformMtx * glm::vec4(x, y, z, 1.0));
+    };
+
+    // Triangle corners in grid space
+    vector<glm::vec3> gridVertices(3 * worldTriangles.size());
+    for (size_t t = 0; t < worldTriangles.size(); t++) {
+        gridVertices[3 * t + 0] = glm::vec3(transformationMtx * worldTriangles[t].v1);
+        gridVertices[3 * t + 1] = glm::vec3(transformationMtx * worldTriangles[t].v2);
+        gridVertices[3 * t + 2] = glm::vec3(transformationMtx * worldTriangles[t].v3);
+    }
+
+    // Mark the band
+    vector<uint8_t> band(numCells, 0);
+    for (size_t t = 0; t < worldTriangles.size(); t++) {
+        glm::vec3 low = glm::min(gridVertices[3 * t], glm::min(gridVertices[3 * t + 1], gridVertices[3 * t + 2]));
+        glm::vec3 high = glm::max(gridVertices[3 * t], glm::max(gridVertices[3 * t + 1], gridVertices[3 * t + 2]));
+        glm::ivec3 first = glm::max(glm::ivec3(glm::floor(low)) - (int) bandCells, glm::ivec3(0));
+        glm::ivec3 last = glm::min(glm::ivec3(glm::ceil(high)) + (int) bandCells, glm::ivec3(dims) - 1);
+        for (int z = first.z; z <= last.z; z++) {
+            for (int y = first.y; y <= last.y; y++) {
+                for (int x = first.x; x <= last.x; x++) {
+                    band[x + dims.x * (y + dims.y * z)] = 1;
                 }
-                grid[xIndex + dimY * (yIndex + dimZ * zIndex)].normal = minTri.normal;
             }
         }
     }
 
-    if (true) {
-        printf("\33[2K\r");
-        printf("[.obj]: calculating signed distance field...done!\n", _filename);
-        printf("[.obj]: ------------\n");
+    // Exact closest triangles in the band
+    vector<int> closest(numCells, -1);
+    vector<float> dist2(numCells, INFINITY);
+    std::atomic<unsigned int> bandCount(0);
+    pool.parallelFor(dims.y * dims.z, 1, [&](unsigned int row) {
+        int y = row % dims.y;
+        int z = row / dims.y;
+        unsigned int count = 0;
+        for (int x = 0; x < dims.x; x++) {
+            unsigned int cell = x + dims.x * (y + dims.y * z);
+            if (!band[cell]) continue;
+            glm::vec3 pos = cellPosition(x, y, z);
+            float minSDist;
+            closest[cell] = bvh.nearest(pos, [&](uint32_t t) { return _distTriangle(worldTriangles[t], pos); },
+                                        minSDist);
+            dist2[cell] = abs(minSDist);
+            count++;
+        }
+        bandCount += count;
+    });
+
+    // Jump flood the closest triangles out of the band
+    vector<int> nextClosest(closest);
+    vector<float> nextDist2(dist2);
+    unsigned int step = std::max(dims.x, std::max(dims.y, dims.z)) / 2;
+    for (bool last = false; !last; step /= 2) {
+        if (step == 0) {
+            step = 1;
+            last = true;
+        }
+        pool.parallelFor(dims.y * dims.z, 1, [&](unsigned int row) {
+            int y = row % dims.y;
+            int z = row / dims.y;
+            for (int x = 0; x < dims.x; x++) {
+                unsigned int cell = x + dims.x * (y + dims.y * z);
+                int best = closest[cell];
+                float bestDist2 = dist2[cell];
+                if (!band[cell]) {
+                    glm::vec3 pos = cellPosition(x, y, z);
+                    for (int dz = -1; dz <= 1; dz++) {
+                        for (int dy = -1; dy <= 1; dy++) {
+                            for (int dx = -1; dx <= 1; dx++) {
+                                glm::ivec3 n = glm::ivec3(x, y, z) + (int) step * glm::ivec3(dx, dy, dz);
+                                if (glm::any(glm::lessThan(n, glm::ivec3(0))) ||
+                                    glm::any(glm::greaterThanEqual(n, glm::ivec3(dims)))) {
+                                    continue;
+                                }
+                                int t = closest[n.x + dims.x * (n.y + dims.y * n.z)];
+                                if (t < 0 || t == best) continue;
+                                float d2 = abs(_distTriangle(worldTriangles[t], pos));
+                                if (d2 < bestDist2) {
+                                    best = t;
+                                    bestDist2 = d2;
+                                }
+                            }
+                        }
+                    }
+                }
+                nextClosest[cell] = best;
+                nextDist2[cell] = bestDist2;
+            }
+        });
+        closest.swap(nextClosest);
+        dist2.swap(nextDist2);
     }
 
-    // Send info to the GPU
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sdfSSBO);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _sdfLoc, _sdfSSBO);
-    uint sdfSize = sizeof(glm::mat4) + 3 * sizeof(GLuint) + dimX * dimY * dimZ * sizeof(SDFCell);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sdfSize, NULL, GL_DYNAMIC_DRAW);
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 16 * sizeof(float), &(transformationMtx)[0][0]);
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 16 * sizeof(float), sizeof(unsigned int), &dimX);
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 16 * sizeof(float) + sizeof(unsigned int),
-                    sizeof(unsigned int), &dimY);
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 16 * sizeof(float) + 2 * sizeof(unsigned int),
-                    sizeof(unsigned int), &dimZ);
-    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 16 * sizeof(float) + 3 * sizeof(unsigned int),
-                    sizeof(SDFCell) * dimX * dimY * dimZ, &(grid)[0]);
-
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, -1);
-    return true;
+    // Inside where two of the three axis rays cross the surface an odd number of times
+    vector<uint8_t> votes(numCells, 0);
+    for (int axis = 0; axis < 3; axis++) {
+        _insideVotes(votes, dims, gridVertices, axis, pool);
+    }
+
+    pool.parallelFor(numCells, 4096, [&](unsigned int cell) {
+        float distance = closest[cell] >= 0 ? sqrt(dist2[cell]) : 0.0f;
+        grid[cell].distance = votes[cell] >= 2 ? -distance : distance;
+        grid[cell].normal = closest[cell] >= 0 ? worldTriangles[closest[cell]].normal : glm::vec4(0.0);
+    });
+
+    printf("[.obj]: narrow band of %u cells, %u of %u cells exact\n", bandCells, (unsigned int) bandCount,
+           numCells);
+}
+
+// Adds one to votes of every cell a ray along axis from outside the grid reaches after an odd number of triangle
+// crossings.  The rays go through the cell centers nudged off the lattice, which keeps most of them clear of the
+// mesh's edges and vertices.  A ray that still passes exactly through an edge or vertex is counted for one of the
+// triangles sharing it by the top-left rule, so it does not flip the parity
+inline void CSCI444::ModelLoaderSDF::_insideVotes(vector<uint8_t> &votes, const glm::uvec3 &dims,
+                                                  const vector<glm::vec3> &gridVertices, int axis,
+                                                  ThreadPool &pool) {
+    const float NUDGE_U = 1.17e-3f, NUDGE_V = 2.03e-3f;
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    unsigned int dimU = dims[u], dimV = dims[v];
+
+    // Twice the signed area of (p, from, to) in the u/v plane, positive with p left of the edge.  It is evaluated
+    // from the same endpoint for both directions of an edge, so the two triangles sharing it get exactly opposite
+    // values
+    auto edgeFunction = [u, v](const glm::vec3 &from, const glm::vec3 &to, float pu, float pv) {
+        bool swapped = to[u] < from[u] || (to[u] == from[u] && to[v] < from[v]);
+        const glm::vec3 &p0 = swapped ? to : from, &p1 = swapped ? from : to;
+        float e = (p1[u] - p0[u]) * (pv - p0[v]) - (p1[v] - p0[v]) * (pu - p0[u]);
+        return swapped ? -e : e;
+    };
+    // Points on an edge belong to the triangle the edge is a left or top edge of (counter-clockwise order)
+    auto ownsEdge = [u, v](const glm::vec3 &from, const glm::vec3 &to) {
+        return to[v] > from[v] || (to[v] == from[v] && to[u] < from[u]);
+    };
+
+    // Where every ray crosses a triangle, along the ray
+    vector<vector<float>> crossings(dimU * dimV);
+    for (size_t t = 0; t < gridVertices.size(); t += 3) {
+        const glm::vec3 &a = gridVertices[t];
+        const glm::vec3 *b = &gridVertices[t + 1], *c = &gridVertices[t + 2];
+        float area = edgeFunction(a, *b, (*c)[u], (*c)[v]);
+        if (area == 0.0f) continue;     // parallel to the rays
+        if (area < 0.0f) std::swap(b, c);
+        bool ownsA = ownsEdge(*b, *c), ownsB = ownsEdge(*c, a), ownsC = ownsEdge(a, *b);
+        int firstU = std::max((int) std::ceil(std::min(a[u], std::min((*b)[u], (*c)[u])) - NUDGE_U), 0);
+        int lastU = std::min((int) std::floor(std::max(a[u], std::max((*b)[u], (*c)[u])) - NUDGE_U),
+                             (int) dimU - 1);
+        int firstV = std::max((int) std::ceil(std::min(a[v], std::min((*b)[v], (*c)[v])) - NUDGE_V), 0);
+        int lastV = std::min((int) std::floor(std::max(a[v], std::max((*b)[v], (*c)[v])) - NUDGE_V),
+                             (int) dimV - 1);
+        for (int j = firstV; j <= lastV; j++) {
+            for (int i = firstU; i <= lastU; i++) {
+                float pu = i + NUDGE_U, pv = j + NUDGE_V;
+                float ea = edgeFunction(*b, *c, pu, pv);
+                float eb = edgeFunction(*c, a, pu, pv);
+                float ec = edgeFunction(a, *b, pu, pv);
+                if (ea < 0.0f || eb < 0.0f || ec < 0.0f) continue;
+                if ((ea == 0.0f && !ownsA) || (eb == 0.0f && !ownsB) || (ec == 0.0f && !ownsC)) continue;
+                float sum = ea + eb + ec;
+                crossings[i + dimU * j].push_back((ea * a[axis] + eb * (*b)[axis] + ec * (*c)[axis]) / sum);
+            }
+        }
+    }
+
+    pool.parallelFor(dimU * dimV, 16, [&](unsigned int ray) {
+        vector<float> &hits = crossings[ray];
+        std::sort(hits.begin(), hits.end());
+        glm::uvec3 cell;
+        cell[u] = ray % dimU;
+        cell[v] = ray / dimU;
+        size_t crossed = 0;
+        for (unsigned int k = 0; k < dims[axis]; k++) {
+            while (crossed < hits.size() && hits[crossed] < k) crossed++;
+            cell[axis] = k;
+            if (crossed % 2 == 1) {
+                votes[cell.x + dims.x * (cell.y + dims.y * cell.z)]++;
+            }
+        }
+    });
 }
 
 inline bool
@@ -630,6 +877,10 @@ CSCI444::ModelLoaderSDF::calculateSignedDistanceField(ShaderProgram *computeShad
         fprintf(stderr, "[ERROR]:[SDF]: Triangle buffer location is unset\n");
         return false;
     }
+    if (this->_bvhLoc == -1) {
+        fprintf(stderr, "[ERROR]:[SDF]: BVH buffer location is unset\n");
+        return false;
+    }
     // Check that the resolution is non-zero and non-negative
     if (resolution <= 0.0) {
         fprintf(stderr, "[ERROR]:[SDF]: Resolution must be a positive number\n");
@@ -645,6 +896,12 @@ CSCI444::ModelLoaderSDF::calculateSignedDistanceField(ShaderProgram *computeShad
     _offset = offset;
     _modelMtx = initialModelMtx;
 
+    // A field built from the same inputs before is loaded as is
+    string cacheFilename = _sdfCacheFilename(resolution, offset, initialModelMtx, 0);
+    if (!cacheFilename.empty() && _loadSDFCache(cacheFilename)) {
+        return true;
+    }
+
     // Calculate bounding box
     BoundingBox box;
     box.frontLeftBottom = initialModelMtx * glm::vec4(minX - offset, minY - offset, minZ - offset, 1.0);
@@ -694,11 +951,14 @@ CSCI444::ModelLoaderSDF::calculateSignedDistanceField(ShaderProgram *computeShad
         worldTriangles.push_back(triangle);
     }
 
-    // Calculate the signed distance field
-    uint total = dimX * dimY * dimZ * worldTriangles.size();
+    // The shader walks a BVH instead of testing every triangle, the triangles are uploaded in leaf order
+    TriangleBVH bvh;
+    bvh.build(worldTriangles);
+    const vector<uint32_t> &order = bvh.triangleOrder();
+    GLuint numTriangles = (GLuint) worldTriangles.size();
 
     printf("SDF Dimensions: (%d, %d, %d)\n", dimX, dimY, dimZ);
-    printf("Total calcs to do: %u\n", total);
+    printf("[.obj]: %u triangles, %zu BVH nodes\n", numTriangles, bvh.nodes().size());
 
     // Buffer data to gpus
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->_triangleSSBO);
@@ -708,17 +968,22 @@ CSCI444::ModelLoaderSDF::calculateSignedDistanceField(ShaderProgram *computeShad
     auto triangles = (Triangle *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0,
                                                    4 * 4 * sizeof(float) * worldTriangles.size(), bufMask);
     for (int i = 0; i < worldTriangles.size(); i++) {
-        triangles[i].v1 = worldTriangles.at(i).v1;
-        triangles[i].v2 = worldTriangles.at(i).v2;
-        triangles[i].v3 = worldTriangles.at(i).v3;
-        triangles[i].normal = worldTriangles.at(i).normal;
+        triangles[i].v1 = worldTriangles.at(order[i]).v1;
+        triangles[i].v2 = worldTriangles.at(order[i]).v2;
+        triangles[i].v3 = worldTriangles.at(order[i]).v3;
+        triangles[i].normal = worldTriangles.at(order[i]).normal;
     }
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->_bvhSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, this->_bvhLoc, this->_bvhSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(TriangleBVH::Node) * bvh.nodes().size(), bvh.nodes().data(),
+                 GL_STATIC_DRAW);
+
     // Setup sdf buffer
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sdfSSBO);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _sdfLoc, _sdfSSBO);
-    uint sdfSize = sizeof(glm::mat4) + 3 * sizeof(GLuint) + dimX * dimY * dimZ * sizeof(SDFCell);
+    size_t sdfSize = sizeof(SignedDistanceField) + (size_t) dimX * dimY * dimZ * sizeof(SDFCell);
     glBufferData(GL_SHADER_STORAGE_BUFFER, sdfSize, NULL, GL_DYNAMIC_DRAW);
     auto sdfTemp = (SignedDistanceField *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sdfSize, bufMask);
     sdfTemp->transformMtx = transformationMtx;
@@ -727,14 +992,143 @@ CSCI444::ModelLoaderSDF::calculateSignedDistanceField(ShaderProgram *computeShad
     sdfTemp->zDim = dimZ;
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 
+    // The work groups are 4x4x4 cells, the shader skips the cells past the edges
     computeShader->useProgram();
-    glDispatchCompute(dimX, dimY, dimZ);
+    glUniform1ui(computeShader->getUniformLocation("numTriangles"), numTriangles);
+    glDispatchCompute((dimX + 3) / 4, (dimY + 3) / 4, (dimZ + 3) / 4);
     glMemoryBarrier(GL_ALL_BARRIER_BITS);
-    glDeleteBuffers(1, &_triangleSSBO);
+    // Only the SDF is kept, release the triangles and the tree
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _triangleSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _bvhSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, NULL, GL_STATIC_DRAW);
+
+    // Read the dense field back and replace it with the bricks near the surface
+    vector<char> sdfData(sdfSize);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sdfSSBO);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sdfSize, sdfData.data());
+    _brickSDF((const SignedDistanceField *) sdfData.data());
+    _uploadSDF();
+    if (!cacheFilename.empty()) {
+        _saveSDFCache(cacheFilename, _bricked.data(), _bricked.size());
+    }
 
     return true;
 }
 
+// Keeps the bricks of the dense field near the surface, see SDFBricks::build(), and checks every cell of the
+// bricked field against the dense one before the dense one is dropped
+inline void CSCI444::ModelLoaderSDF::_brickSDF(const SignedDistanceField *dense) {
+    SDFBricks::build(dense, _resolution, _bricked);
+    auto sdf = (const BrickedSDF *) _bricked.data();
+    printf("[.obj]: %u of %u SDF bricks near the surface, %.1f MB instead of %.1f MB dense\n", sdf->numBricks,
+           sdf->brickDims.x * sdf->brickDims.y * sdf->brickDims.z, _bricked.size() / 1048576.0,
+           (sizeof(SignedDistanceField) + (double) sdf->xDim * sdf->yDim * sdf->zDim * sizeof(SDFCell)) / 1048576.0);
+
+    SDFBricks::Validation check = SDFBricks::validate(dense, sdf);
+    if (check.mismatches > 0) {
+        fprintf(stderr, "[ERROR]:[SDF]: %u of %u bricked SDF cells differ from the dense field\n", check.mismatches,
+                check.bandCells + check.insideCells + check.outsideCells);
+    }
+}
+
+inline void CSCI444::ModelLoaderSDF::_uploadSDF() {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sdfSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _sdfLoc, _sdfSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _bricked.size(), _bricked.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+inline const CSCI444::BrickedSDF *CSCI444::ModelLoaderSDF::brickedSDF() const {
+    return _bricked.empty() ? NULL : (const BrickedSDF *) _bricked.data();
+}
+
+// File layout: SDF_CACHE_MAGIC, SDF_CACHE_VERSION, then the BrickedSDF buffer byte for byte
+#define SDF_CACHE_MAGIC 0x46445343u      // "CSDF"
+#define SDF_CACHE_VERSION 3u
+
+inline void CSCI444::ModelLoaderSDF::enableSDFCache(const char *directory) {
+    mkdir(directory, 0755);
+    SDF_CACHE_DIRECTORY = directory;
+}
+
+inline void CSCI444::ModelLoaderSDF::disableSDFCache() {
+    SDF_CACHE_DIRECTORY = "";
+}
+
+inline string CSCI444::ModelLoaderSDF::_sdfCacheFilename(float resolution, float offset,
+                                                         const glm::mat4 &initialModelMtx, unsigned int bandCells) {
+    if (SDF_CACHE_DIRECTORY.empty() || _filename == NULL) return "";
+
+    // The key covers the mesh's bytes and every input that changes the cells
+    ifstream in(_filename, ios::binary);
+    if (!in.is_open()) return "";
+    string mesh((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    unsigned long long hash = CSCI444_INTERNAL::ShaderUtils::hashString(mesh);
+
+    char inputs[512];
+    int length = snprintf(inputs, sizeof(inputs), "v%u r%a o%a b%u", SDF_CACHE_VERSION, resolution, offset,
+                          bandCells);
+    for (int i = 0; i < 16 && length < (int) sizeof(inputs); i++) {
+        length += snprintf(inputs + length, sizeof(inputs) - length, " %a", initialModelMtx[i / 4][i % 4]);
+    }
+    hash = CSCI444_INTERNAL::ShaderUtils::hashString(inputs, hash);
+
+    char filename[32];
+    snprintf(filename, sizeof(filename), "/%016llx.sdf", hash);
+    return SDF_CACHE_DIRECTORY + filename;
+}
+
+inline bool CSCI444::ModelLoaderSDF::_loadSDFCache(const string &filename) {
+    int file = open(filename.c_str(), O_RDONLY);
+    if (file < 0) return false;
+    struct stat info;
+    if (fstat(file, &info) != 0 || (size_t) info.st_size < 2 * sizeof(uint32_t) + sizeof(BrickedSDF)) {
+        close(file);
+        return false;
+    }
+    size_t fileSize = info.st_size;
+    void *mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) return false;
+
+    // A file of another version or cut short is regenerated
+    auto header = (const uint32_t *) mapped;
+    auto sdf = (const BrickedSDF *) (header + 2);
+    size_t sdfSize = fileSize - 2 * sizeof(uint32_t);
+    size_t numSlots = (size_t) sdf->brickDims.x * sdf->brickDims.y * sdf->brickDims.z;
+    bool valid = header[0] == SDF_CACHE_MAGIC && header[1] == SDF_CACHE_VERSION &&
+                 sdfSize == sizeof(BrickedSDF) + sizeof(uint32_t) * (2 * numSlots + 2 * (size_t) SDF_BRICK_SIZE *
+                                                                      SDF_BRICK_SIZE * SDF_BRICK_SIZE * sdf->numBricks);
+    if (valid) {
+        _bricked.assign((const char *) sdf, (const char *) sdf + sdfSize);
+        _uploadSDF();
+        printf("[.obj]: loaded signed distance field (%u, %u, %u) from %s\n", sdf->xDim, sdf->yDim, sdf->zDim,
+               filename.c_str());
+    }
+    munmap(mapped, fileSize);
+    return valid;
+}
+
+inline void CSCI444::ModelLoaderSDF::_saveSDFCache(const string &filename, const void *sdf, size_t size) {
+    // Write to a file of our own and rename it, jobs starting together never see a partial field
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int) getpid());
+    string partialFilename = filename + suffix;
+    FILE *file = fopen(partialFilename.c_str(), "wb");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]:[SDF]: Could not write signed distance field cache %s\n", filename.c_str());
+        return;
+    }
+    const uint32_t header[2] = {SDF_CACHE_MAGIC, SDF_CACHE_VERSION};
+    bool written = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(sdf, 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(partialFilename.c_str(), filename.c_str()) != 0) {
+        fprintf(stderr, "[ERROR]:[SDF]: Could not write signed distance field cache %s\n", filename.c_str());
+        remove(partialFilename.c_str());
+    }
+}
+
 inline void
 CSCI444::ModelLoaderSDF::translateModelMtx(glm::vec3 translation) {
     _modelMtx = glm::translate(_modelMtx, translation);
@@ -744,13 +1138,6 @@ CSCI444::ModelLoaderSDF::translateModelMtx(glm::vec3 translation) {
     box.frontLeftBottom = _modelMtx * glm::vec4(minX - _offset, minY - _offset, minZ - _offset, 1.0);
     box.backRightTop = _modelMtx * glm::vec4(maxX + _offset, maxY + _offset, maxZ + _offset, 1.0);
 
-    // Calculate dimensions of grid
-    unsigned int dimX = static_cast<unsigned int>(round((box.backRightTop.x - box.frontLeftBottom.x) / _resolution));
-    unsigned int dimY = static_cast<unsigned int>(round(
-            (box.backRightTop.y - box.frontLeftBottom.y) / _resolution));
-    unsigned int dimZ = static_cast<unsigned int>(round(
-            (box.backRightTop.z - box.frontLeftBottom.z) / _resolution));
-
     // Calculate transformation mtx (world -> grid)
     glm::mat4 transformationMtx = glm::mat4(1.0);
 
@@ -760,18 +1147,14 @@ CSCI444::ModelLoaderSDF::translateModelMtx(glm::vec3 translation) {
     transformationMtx = glm::scale(glm::mat4(1.0), glm::vec3(1 / _resolution, 1 / _resolution, 1 / _resolution)) *
                         transformationMtx;
 
-    // Setup sdf buffer
+    // The grid keeps its size and cells, only the transform at the start of the buffer moves
+    if (!_bricked.empty()) {
+        ((BrickedSDF *) _bricked.data())->transformMtx = transformationMtx;
+    }
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, _sdfSSBO);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _sdfLoc, _sdfSSBO);
-    uint sdfSize = sizeof(glm::mat4) + 3 * sizeof(GLuint) + dimX * dimY * dimZ * sizeof(SDFCell);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sdfSize, NULL, GL_DYNAMIC_DRAW);
-    GLint bufMask = GL_MAP_WRITE_BIT;
-    auto sdfTemp = (SignedDistanceField *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sdfSize, bufMask);
-    sdfTemp->transformMtx = transformationMtx;
-    sdfTemp->xDim = dimX;
-    sdfTemp->yDim = dimY;
-    sdfTemp->zDim = dimZ;
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::mat4), &transformationMtx[0][0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 // Read in a WaveFront *.obj File
@@ -1488,6 +1871,10 @@ inline void CSCI444::ModelLoaderSDF::setSDFLocation(GLint sdfLoc) {
     this->_sdfLoc = sdfLoc;
 }
 
+inline void CSCI444::ModelLoaderSDF::setBVHLocation(GLint bvhLoc) {
+    this->_bvhLoc = bvhLoc;
+}
+
 inline void CSCI444::ModelLoaderSDF::setTriangleLocation(GLint triLoc) {
     this->_triangleLoc = triLoc;
 }
@@ -0,0 +1,251 @@
+/** @file ParticleStore.hpp
+  * @brief Structure of arrays storage for per particle vectors
+	* @author Zachary Smeton
+	*
+	*	Each vector quantity is kept as three float streams (all x, then all y, then
+	*	all z) in a single allocation.  Every stream starts on a 64 byte boundary so
+	*	that SIMD loads never straddle a cache line, and the whole block is laid out
+	*	exactly like the particle SSBOs so it can be uploaded or read back with one
+	*	buffer call.
+  */
+
+#ifndef __CSCI444_PARTICLE_STORE_HPP__
+#define __CSCI444_PARTICLE_STORE_HPP__
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @class Float3Stream
+        * @brief Three aligned float streams holding the x, y and z components of a per particle vector
+        * @note Component c of element i lives at data()[c * stride() + i]
+        */
+    class Float3Stream {
+    public:
+        /** @brief Alignment in bytes of every stream (one cache line, one AVX-512 register)
+            */
+        static const size_t ALIGNMENT = 64;
+
+        /** @brief Creates count zeroed elements
+            */
+        explicit Float3Stream(size_t count = 0);
+
+        Float3Stream(const Float3Stream &other);
+
+        Float3Stream &operator=(const Float3Stream &other);
+
+        ~Float3Stream();
+
+        /** @brief Reallocates the streams for count zeroed elements
+            */
+        void resize(size_t count);
+
+        /** @brief Swaps storage with another stream without copying
+            */
+        void swap(Float3Stream &other);
+
+        /** @brief Sets every element to value
+            */
+        void fill(const glm::vec3 &value);
+
+        glm::vec3 get(size_t i) const;
+
+        void set(size_t i, const glm::vec3 &value);
+
+        float *x();
+        float *y();
+        float *z();
+        const float *x() const;
+        const float *y() const;
+        const float *z() const;
+
+        /** @brief Returns the start of the x stream, the y and z streams follow at stride() float offsets
+            */
+        float *data();
+        const float *data() const;
+
+        /** @brief Returns the number of elements
+            */
+        size_t size() const;
+
+        /** @brief Returns the distance in floats between the x, y and z streams
+            * @note size() rounded up to a multiple of ALIGNMENT / sizeof(float)
+            */
+        size_t stride() const;
+
+        /** @brief Returns the size in bytes of all three streams, the same size as the matching SSBO
+            */
+        size_t bytes() const;
+
+        /** @brief Returns the stream distance in floats needed for count elements
+            */
+        static size_t strideFor(size_t count);
+
+    private:
+        void _allocate(size_t count);
+
+        size_t _count;
+        size_t _stride;
+        float *_storage;
+        float *_data;
+    };
+
+    /** @class ParticleStore
+        * @brief The per particle state that is uploaded to and read back from the GPU
+        */
+    class ParticleStore {
+    public:
+        explicit ParticleStore(size_t count = 0);
+
+        /** @brief Reallocates every stream for count zeroed particles
+            */
+        void resize(size_t count);
+
+        size_t size() const;
+
+        /** @brief Returns the distance in floats between the x, y and z streams of every quantity
+            */
+        size_t stride() const;
+
+        Float3Stream &position();
+        Float3Stream &velocity();
+        Float3Stream &color();
+        const Float3Stream &position() const;
+        const Float3Stream &velocity() const;
+        const Float3Stream &color() const;
+
+    private:
+        Float3Stream _position;
+        Float3Stream _velocity;
+        Float3Stream _color;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::Float3Stream::Float3Stream(size_t count) : _count(0), _stride(0), _storage(nullptr), _data(nullptr) {
+    _allocate(count);
+}
+
+inline CSCI444::Float3Stream::Float3Stream(const Float3Stream &other) : _count(0), _stride(0), _storage(nullptr),
+                                                                       _data(nullptr) {
+    _allocate(other._count);
+    memcpy(_data, other._data, bytes());
+}
+
+inline CSCI444::Float3Stream &CSCI444::Float3Stream::operator=(const Float3Stream &other) {
+    if (this != &other) {
+        if (_count != other._count) {
+            _allocate(other._count);
+        }
+        memcpy(_data, other._data, bytes());
+    }
+    return *this;
+}
+
+inline CSCI444::Float3Stream::~Float3Stream() {
+    delete[] _storage;
+}
+
+inline void CSCI444::Float3Stream::_allocate(size_t count) {
+    delete[] _storage;
+
+    _count = count;
+    _stride = strideFor(count);
+    // Over allocate by one alignment and start the streams at the first aligned address
+    _storage = new float[3 * _stride + ALIGNMENT / sizeof(float)]();
+    uintptr_t address = reinterpret_cast<uintptr_t>(_storage);
+    _data = reinterpret_cast<float *>((address + ALIGNMENT - 1) & ~(uintptr_t) (ALIGNMENT - 1));
+}
+
+inline void CSCI444::Float3Stream::resize(size_t count) {
+    _allocate(count);
+}
+
+inline void CSCI444::Float3Stream::swap(Float3Stream &other) {
+    std::swap(_count, other._count);
+    std::swap(_stride, other._stride);
+    std::swap(_storage, other._storage);
+    std::swap(_data, other._data);
+}
+
+inline void CSCI444::Float3Stream::fill(const glm::vec3 &value) {
+    for (size_t i = 0; i < _count; i++) {
+        set(i, value);
+    }
+}
+
+inline glm::vec3 CSCI444::Float3Stream::get(size_t i) const {
+    return glm::vec3(_data[i], _data[_stride + i], _data[2 * _stride + i]);
+}
+
+inline void CSCI444::Float3Stream::set(size_t i, const glm::vec3 &value) {
+    _data[i] = value.x;
+    _data[_stride + i] = value.y;
+    _data[2 * _stride + i] = value.z;
+}
+
+inline float *CSCI444::Float3Stream::x() { return _data; }
+inline float *CSCI444::Float3Stream::y() { return _data + _stride; }
+inline float *CSCI444::Float3Stream::z() { return _data + 2 * _stride; }
+inline const float *CSCI444::Float3Stream::x() const { return _data; }
+inline const float *CSCI444::Float3Stream::y() const { return _data + _stride; }
+inline const float *CSCI444::Float3Stream::z() const { return _data + 2 * _stride; }
+
+inline float *CSCI444::Float3Stream::data() { return _data; }
+inline const float *CSCI444::Float3Stream::data() const { return _data; }
+
+inline size_t CSCI444::Float3Stream::size() const {
+    return _count;
+}
+
+inline size_t CSCI444::Float3Stream::stride() const {
+    return _stride;
+}
+
+inline size_t CSCI444::Float3Stream::bytes() const {
+    return 3 * _stride * sizeof(float);
+}
+
+inline size_t CSCI444::Float3Stream::strideFor(size_t count) {
+    const size_t floatsPerLine = ALIGNMENT / sizeof(float);
+    return (count + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::ParticleStore::ParticleStore(size_t count) : _position(count), _velocity(count), _color(count) {
+}
+
+inline void CSCI444::ParticleStore::resize(size_t count) {
+    _position.resize(count);
+    _velocity.resize(count);
+    _color.resize(count);
+}
+
+inline size_t CSCI444::ParticleStore::size() const {
+    return _position.size();
+}
+
+inline size_t CSCI444::ParticleStore::stride() const {
+    return _position.stride();
+}
+
+inline CSCI444::Float3Stream &CSCI444::ParticleStore::position() { return _position; }
+inline CSCI444::Float3Stream &CSCI444::ParticleStore::velocity() { return _velocity; }
+inline CSCI444::Float3Stream &CSCI444::ParticleStore::color() { return _color; }
+inline const CSCI444::Float3Stream &CSCI444::ParticleStore::position() const { return _position; }
+inline const CSCI444::Float3Stream &CSCI444::ParticleStore::velocity() const { return _velocity; }
+inline const CSCI444::Float3Stream &CSCI444::ParticleStore::color() const { return _color; }
+
+#endif // __CSCI444_PARTICLE_STORE_HPP__
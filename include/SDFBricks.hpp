@@ -0,0 +1,327 @@
+/** @file SDFBricks.hpp
+  * @brief Sparse brick layout of the obstacle's signed distance field and its lookups on the CPU
+	* @author Zachary Smeton
+	*
+	*	The dense field is split into bricks of SDF_BRICK_SIZE^3 cells and only
+	*	the bricks near the surface keep their cells, see BrickedSDF.  cell() and
+	*	collide() follow sdfCell() and collideSDF() in predict.c.glsl, so the CPU
+	*	solver collides with the same field the GPU does, and validate() checks
+	*	a bricked field cell by cell against the dense field it was built from.
+	*	Nothing here needs an OpenGL context.
+  */
+
+#ifndef __CSCI444_SDF_BRICKS_HPP__
+#define __CSCI444_SDF_BRICKS_HPP__
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Bricks of the SDF buffer are SDF_BRICK_SIZE cells a side, a brick's slot holds its index or one of these
+#define SDF_BRICK_SIZE 8u
+#define SDF_BRICK_OUTSIDE 0xffffffffu
+#define SDF_BRICK_INSIDE 0xfffffffeu
+// collideSDF() in predict.c.glsl pushes particles this close to the surface out
+#define SDF_CONTACT_DISTANCE 0.05f
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    // std430 layout of SDFCell in the shaders, normal is 16 byte aligned
+    struct SDFCell {
+        float distance;
+        float padding[3];
+        glm::vec4 normal;
+    };
+
+    // The dense field signedDistanceField.c.glsl writes, std430 layout, sizeof() is the header before the cells
+    struct SignedDistanceField {
+        glm::mat4 transformMtx;
+        uint32_t xDim, yDim, zDim;
+        uint32_t padding;
+        SDFCell cells[];
+    };
+
+    // The SDF buffer the other shaders read, std430 layout, sizeof() is the header before data.  data holds a slot
+    // per brick, the brick's index or SDF_BRICK_OUTSIDE / SDF_BRICK_INSIDE for bricks away from the surface, then a
+    // packSnorm4x8 normal per slot, then the bricks' cells as (distance bits, packSnorm4x8 normal) pairs.  Cells in
+    // no brick are farDistance away; inside ones take their slot's normal, the normal of the brick's cell nearest
+    // the surface, so particles in the mesh are still pushed out
+    struct BrickedSDF {
+        glm::mat4 transformMtx;
+        uint32_t xDim, yDim, zDim;
+        uint32_t numBricks;
+        glm::uvec3 brickDims;
+        float farDistance;
+        uint32_t data[];
+    };
+
+    /** @class SDFBricks
+        * @brief Builds, reads and checks BrickedSDF buffers
+        */
+    class SDFBricks {
+    public:
+        /** @brief Cells validate() compared and how many of them disagreed
+            */
+        struct Validation {
+            unsigned int bandCells;         // cells of kept bricks, distance and normal as stored
+            unsigned int insideCells;       // cells of SDF_BRICK_INSIDE bricks
+            unsigned int outsideCells;      // cells of SDF_BRICK_OUTSIDE bricks
+            unsigned int mismatches;
+            float maxNormalError;           // largest component difference of a kept cell's normal
+        };
+
+        /** @brief Splits dense into bricks and keeps the ones with a cell within twice the contact distance (or
+            * two cells) of the surface, the rest collapse to a slot saying whether they are inside or outside
+            * @param float resolution - the size of a cell
+            */
+        static void build(const SignedDistanceField *dense, float resolution, std::vector<char> &bricked);
+
+        /** @brief Returns the distance of cell, negative inside the mesh, and its surface normal, like sdfCell()
+            * @note cell must be inside the grid
+            */
+        static float cell(const BrickedSDF *sdf, const glm::uvec3 &cell, glm::vec3 &normal);
+
+        /** @brief Returns deltaPos plus the push out of the obstacle at pos + deltaPos, like collideSDF()
+            */
+        static glm::vec3 collide(const BrickedSDF *sdf, const glm::vec3 &pos, glm::vec3 deltaPos,
+                                 float collisionEpsilon);
+
+        /** @brief Looks up every cell of dense in bricked
+            *
+            * Cells of kept bricks must return the dense distance and normal, up to the 8 bit normals.  Cells of
+            * outside bricks must be at least farDistance from the surface, which is past the contact distance, so
+            * neither field collides there.  Cells of inside bricks must be at least farDistance deep and return
+            * -farDistance with the normal of their brick's cell nearest the surface
+            */
+        static Validation validate(const SignedDistanceField *dense, const BrickedSDF *bricked);
+
+    private:
+        static const unsigned int BRICK_CELLS = SDF_BRICK_SIZE * SDF_BRICK_SIZE * SDF_BRICK_SIZE;
+
+        // First cell of the brick in slot
+        static glm::uvec3 _brickStart(const glm::uvec3 &brickDims, unsigned int slot);
+
+        // Normal of the cell of the brick in slot that is inside the mesh and nearest the surface, and the brick's
+        // smallest absolute distance and number of cells inside
+        static glm::vec4 _insideNormal(const SignedDistanceField *dense, const glm::uvec3 &brickDims,
+                                       unsigned int slot, float &nearest, unsigned int &insideCells,
+                                       unsigned int &cells);
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline glm::uvec3 CSCI444::SDFBricks::_brickStart(const glm::uvec3 &brickDims, unsigned int slot) {
+    return SDF_BRICK_SIZE * glm::uvec3(slot % brickDims.x, (slot / brickDims.x) % brickDims.y,
+                                       slot / (brickDims.x * brickDims.y));
+}
+
+inline glm::vec4 CSCI444::SDFBricks::_insideNormal(const SignedDistanceField *dense, const glm::uvec3 &brickDims,
+                                                   unsigned int slot, float &nearest, unsigned int &insideCells,
+                                                   unsigned int &cells) {
+    glm::uvec3 dims(dense->xDim, dense->yDim, dense->zDim);
+    glm::uvec3 first = _brickStart(brickDims, slot);
+    glm::uvec3 last = glm::min(first + SDF_BRICK_SIZE, dims);
+    float nearestInside = -INFINITY;
+    glm::vec4 normal(0.0f);
+    nearest = INFINITY;
+    insideCells = 0;
+    cells = 0;
+    for (unsigned int z = first.z; z < last.z; z++) {
+        for (unsigned int y = first.y; y < last.y; y++) {
+            for (unsigned int x = first.x; x < last.x; x++) {
+                const SDFCell &cell = dense->cells[x + dims.x * (y + dims.y * z)];
+                nearest = std::min(nearest, std::abs(cell.distance));
+                if (cell.distance < 0.0f) {
+                    insideCells++;
+                    if (cell.distance > nearestInside) {
+                        nearestInside = cell.distance;
+                        normal = cell.normal;
+                    }
+                }
+                cells++;
+            }
+        }
+    }
+    return normal;
+}
+
+inline void CSCI444::SDFBricks::build(const SignedDistanceField *dense, float resolution,
+                                      std::vector<char> &bricked) {
+    glm::uvec3 dims(dense->xDim, dense->yDim, dense->zDim);
+    glm::uvec3 brickDims = (dims + SDF_BRICK_SIZE - 1u) / SDF_BRICK_SIZE;
+    unsigned int numSlots = brickDims.x * brickDims.y * brickDims.z;
+    float band = std::max(2.0f * resolution, 2.0f * SDF_CONTACT_DISTANCE);
+
+    // farDistance is the nearest any dropped cell gets to the surface, so it never overstates a distance
+    std::vector<uint32_t> slots(numSlots), slotNormals(numSlots, 0);
+    float farDistance = INFINITY;
+    unsigned int numBricks = 0;
+    for (unsigned int slot = 0; slot < numSlots; slot++) {
+        float nearest;
+        unsigned int insideCells, cells;
+        glm::vec4 insideNormal = _insideNormal(dense, brickDims, slot, nearest, insideCells, cells);
+        if (nearest <= band) {
+            slots[slot] = numBricks++;
+        } else {
+            slots[slot] = 2 * insideCells > cells ? SDF_BRICK_INSIDE : SDF_BRICK_OUTSIDE;
+            if (slots[slot] == SDF_BRICK_INSIDE) {
+                slotNormals[slot] = glm::packSnorm4x8(insideNormal);
+            }
+            farDistance = std::min(farDistance, nearest);
+        }
+    }
+    if (farDistance == INFINITY) farDistance = band;
+
+    size_t size = sizeof(BrickedSDF) + 2 * sizeof(uint32_t) * (numSlots + (size_t) BRICK_CELLS * numBricks);
+    bricked.assign(size, 0);
+    auto sdf = (BrickedSDF *) bricked.data();
+    sdf->transformMtx = dense->transformMtx;
+    sdf->xDim = dims.x;
+    sdf->yDim = dims.y;
+    sdf->zDim = dims.z;
+    sdf->numBricks = numBricks;
+    sdf->brickDims = brickDims;
+    sdf->farDistance = farDistance;
+    memcpy(sdf->data, slots.data(), sizeof(uint32_t) * numSlots);
+    memcpy(sdf->data + numSlots, slotNormals.data(), sizeof(uint32_t) * numSlots);
+
+    uint32_t *bricks = sdf->data + 2 * numSlots;
+    for (unsigned int slot = 0; slot < numSlots; slot++) {
+        if (slots[slot] >= numBricks) continue;
+        glm::uvec3 first = _brickStart(brickDims, slot);
+        uint32_t *brick = bricks + 2 * (size_t) BRICK_CELLS * slots[slot];
+        for (unsigned int local = 0; local < BRICK_CELLS; local++) {
+            glm::uvec3 cell = first + glm::uvec3(local % SDF_BRICK_SIZE, (local / SDF_BRICK_SIZE) % SDF_BRICK_SIZE,
+                                                 local / (SDF_BRICK_SIZE * SDF_BRICK_SIZE));
+            // Cells past the edge of the grid are never read
+            float distance = farDistance;
+            uint32_t normal = 0;
+            if (glm::all(glm::lessThan(cell, dims))) {
+                const SDFCell &denseCell = dense->cells[cell.x + dims.x * (cell.y + dims.y * cell.z)];
+                distance = denseCell.distance;
+                normal = glm::packSnorm4x8(denseCell.normal);
+            }
+            memcpy(&brick[2 * local], &distance, sizeof(float));
+            brick[2 * local + 1] = normal;
+        }
+    }
+}
+
+inline float CSCI444::SDFBricks::cell(const BrickedSDF *sdf, const glm::uvec3 &cell, glm::vec3 &normal) {
+    glm::uvec3 brick = cell / SDF_BRICK_SIZE;
+    unsigned int numSlots = sdf->brickDims.x * sdf->brickDims.y * sdf->brickDims.z;
+    unsigned int slotIndex = brick.x + sdf->brickDims.x * (brick.y + sdf->brickDims.y * brick.z);
+    uint32_t slot = sdf->data[slotIndex];
+    if (slot == SDF_BRICK_OUTSIDE) {
+        normal = glm::vec3(0.0f);
+        return sdf->farDistance;
+    }
+    if (slot == SDF_BRICK_INSIDE) {
+        normal = glm::vec3(glm::unpackSnorm4x8(sdf->data[numSlots + slotIndex]));
+        return -sdf->farDistance;
+    }
+    glm::uvec3 local = cell % SDF_BRICK_SIZE;
+    size_t index = 2 * (numSlots + (size_t) slot * BRICK_CELLS +
+                        local.x + SDF_BRICK_SIZE * (local.y + SDF_BRICK_SIZE * local.z));
+    normal = glm::vec3(glm::unpackSnorm4x8(sdf->data[index + 1]));
+    float distance;
+    memcpy(&distance, &sdf->data[index], sizeof(float));
+    return distance;
+}
+
+inline glm::vec3 CSCI444::SDFBricks::collide(const BrickedSDF *sdf, const glm::vec3 &pos, glm::vec3 deltaPos,
+                                             float collisionEpsilon) {
+    glm::vec3 newPos = pos + deltaPos;
+
+    // The cell the position rounds to, positions outside the grid do not collide
+    glm::vec3 tranPos = glm::round(glm::vec3(sdf->transformMtx * glm::vec4(newPos, 1.0f)));
+    if (tranPos.x < 0.0f || tranPos.x >= sdf->xDim || tranPos.y < 0.0f || tranPos.y >= sdf->yDim ||
+        tranPos.z < 0.0f || tranPos.z >= sdf->zDim) {
+        return deltaPos;
+    }
+
+    glm::vec3 normal;
+    float distance = cell(sdf, glm::uvec3(tranPos), normal);
+    if (distance <= SDF_CONTACT_DISTANCE) {
+        deltaPos += ((SDF_CONTACT_DISTANCE - distance) + collisionEpsilon) * normal;
+    }
+    return deltaPos;
+}
+
+inline CSCI444::SDFBricks::Validation CSCI444::SDFBricks::validate(const SignedDistanceField *dense,
+                                                                   const BrickedSDF *bricked) {
+    // An 8 bit normal is off by at most half a step per component
+    const float NORMAL_TOLERANCE = 0.5f / 127.0f + 1e-6f;
+
+    Validation result = {0, 0, 0, 0, 0.0f};
+    glm::uvec3 dims(dense->xDim, dense->yDim, dense->zDim);
+    glm::uvec3 brickDims = (dims + SDF_BRICK_SIZE - 1u) / SDF_BRICK_SIZE;
+    if (dims != glm::uvec3(bricked->xDim, bricked->yDim, bricked->zDim) || brickDims != bricked->brickDims) {
+        result.mismatches = dims.x * dims.y * dims.z;
+        return result;
+    }
+    float farDistance = bricked->farDistance;
+
+    unsigned int numSlots = brickDims.x * brickDims.y * brickDims.z;
+    for (unsigned int slotIndex = 0; slotIndex < numSlots; slotIndex++) {
+        uint32_t slot = bricked->data[slotIndex];
+        bool kept = slot < bricked->numBricks;
+        if (!kept && slot != SDF_BRICK_INSIDE && slot != SDF_BRICK_OUTSIDE) {
+            result.mismatches++;
+            continue;
+        }
+        glm::vec3 insideNormal(0.0f);
+        if (slot == SDF_BRICK_INSIDE) {
+            float nearest;
+            unsigned int insideCells, cells;
+            insideNormal = glm::vec3(_insideNormal(dense, brickDims, slotIndex, nearest, insideCells, cells));
+        }
+
+        glm::uvec3 first = _brickStart(brickDims, slotIndex);
+        glm::uvec3 last = glm::min(first + SDF_BRICK_SIZE, dims);
+        for (unsigned int z = first.z; z < last.z; z++) {
+            for (unsigned int y = first.y; y < last.y; y++) {
+                for (unsigned int x = first.x; x < last.x; x++) {
+                    const SDFCell &denseCell = dense->cells[x + dims.x * (y + dims.y * z)];
+                    glm::vec3 normal;
+                    float distance = cell(bricked, glm::uvec3(x, y, z), normal);
+                    bool matches;
+                    if (kept) {
+                        result.bandCells++;
+                        glm::vec3 normalError = glm::abs(normal - glm::vec3(denseCell.normal));
+                        float error = std::max(normalError.x, std::max(normalError.y, normalError.z));
+                        result.maxNormalError = std::max(result.maxNormalError, error);
+                        matches = distance == denseCell.distance && error <= NORMAL_TOLERANCE;
+                    } else if (slot == SDF_BRICK_OUTSIDE) {
+                        result.outsideCells++;
+                        matches = distance == farDistance && normal == glm::vec3(0.0f) &&
+                                  denseCell.distance >= farDistance && farDistance > SDF_CONTACT_DISTANCE;
+                    } else {
+                        result.insideCells++;
+                        glm::vec3 normalError = glm::abs(normal - insideNormal);
+                        matches = distance == -farDistance && denseCell.distance <= -farDistance &&
+                                  std::max(normalError.x, std::max(normalError.y, normalError.z)) <=
+                                  NORMAL_TOLERANCE;
+                    }
+                    if (!matches) {
+                        result.mismatches++;
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+#endif // __CSCI444_SDF_BRICKS_HPP__
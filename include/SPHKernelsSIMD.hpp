@@ -0,0 +1,520 @@
+/** @file SPHKernelsSIMD.hpp
+  * @brief Neighbor loops of the lambda and deltaP stages vectorized with AVX2 and AVX-512
+	* @author Zachary Smeton
+	*
+	*	The density estimate, the spiky gradient sums of the lambda stage and the
+	*	lambda/sCorr weighted gradient sum of the deltaP stage are evaluated for
+	*	8 (AVX2) or 16 (AVX-512) neighbors at a time.  Neighbor positions and
+	*	lambdas are gathered straight out of the SoA streams, the last partial
+	*	group is masked.  Each kernel follows the formulas of WPoly, gradWSpiky
+	*	and sCorr in solver.c.glsl, including their cut offs, so every level
+	*	matches the scalar loop up to the order the sums are added in.
+	*
+	*	The vector code is compiled with per function target attributes and
+	*	picked at run time from the CPU's features, the executable itself does
+	*	not need to be built for AVX.
+	*
+	*	@warning NOTE: the vector levels need GCC or Clang on x86, everywhere else only SCALAR exists
+  */
+
+#ifndef __CSCI444_SPH_KERNELS_SIMD_HPP__
+#define __CSCI444_SPH_KERNELS_SIMD_HPP__
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CSCI444_SPH_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define CSCI444_SPH_KERNELS_X86 0
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @class SPHKernels
+        * @brief Vectorized neighbor sums of the density constraint with a scalar fallback
+        */
+    class SPHKernels {
+    public:
+        enum Level {
+            SCALAR, AVX2, AVX512
+        };
+
+        /** @brief Kernel constants, the matching members of the FluidDynamics block
+            * @note pcorr is applied as an integer power and must not be negative
+            */
+        struct Constants {
+            float supportRadius;
+            float restDensity;
+            float kpoly;
+            float kspiky;
+            float scorr;
+            float dcorr;
+            int pcorr;
+        };
+
+        /** @brief Starts out at the best level the CPU supports
+            */
+        SPHKernels();
+
+        /** @brief Returns the best level the CPU (and compiler) supports
+            */
+        static Level detect();
+
+        /** @brief Returns "scalar", "avx2" or "avx512"
+            */
+        static const char *levelName(Level level);
+
+        /** @brief Parses a levelName()
+            * @return false if name is not a level
+            */
+        static bool parseLevel(const char *name, Level &level);
+
+        /** @brief Selects the code path, levels above detect() fall back to detect()
+            */
+        void setLevel(Level level);
+
+        Level level() const;
+
+        void setConstants(const Constants &constants);
+
+        /** @brief The neighbor loop of the lambda pass
+            * @param const float* x, y, z - predicted position streams
+            * @param density      - receives the sum of WPoly over the neighbors
+            * @param gradientI    - receives the sum of the neighbors' gradWSpiky / restDensity
+            * @param sumGradients - receives the sum of the squared lengths of those gradients
+            */
+        void densitySums(const float *x, const float *y, const float *z, const glm::vec3 &pos,
+                         const uint32_t *neighbors, unsigned int count,
+                         float &density, glm::vec3 &gradientI, float &sumGradients) const;
+
+        /** @brief The neighbor loop of the deltaP pass, sum of (lambdaI + lambdaJ + sCorr) * gradWSpiky
+            * @note The result is not divided by restDensity yet
+            */
+        glm::vec3 deltaPSum(const float *x, const float *y, const float *z, const float *lambdas,
+                            const glm::vec3 &pos, float lambdaI, const uint32_t *neighbors, unsigned int count) const;
+
+    private:
+        // Cut off below which the kernels treat a neighbor as sitting on the particle (same as the shaders)
+        static constexpr float MIN_DISTANCE = 0.0000001f;
+
+        void _densityScalar(const float *x, const float *y, const float *z, const float *pos,
+                            const uint32_t *neighbors, unsigned int count, float *sums) const;
+
+        void _deltaPScalar(const float *x, const float *y, const float *z, const float *lambdas,
+                           const float *pos, float lambdaI, const uint32_t *neighbors, unsigned int count,
+                           float *sum) const;
+
+#if CSCI444_SPH_KERNELS_X86
+        /** @brief Returns the sum of the lanes
+            */
+        __attribute__((target("avx2,fma")))
+        static float _horizontalSumAVX2(__m256 v);
+
+        __attribute__((target("avx512f")))
+        static float _horizontalSumAVX512(__m512 v);
+
+        __attribute__((target("avx2,fma")))
+        void _densityAVX2(const float *x, const float *y, const float *z, const float *pos,
+                          const uint32_t *neighbors, unsigned int count, float *sums) const;
+
+        __attribute__((target("avx2,fma")))
+        void _deltaPAVX2(const float *x, const float *y, const float *z, const float *lambdas,
+                         const float *pos, float lambdaI, const uint32_t *neighbors, unsigned int count,
+                         float *sum) const;
+
+        __attribute__((target("avx512f")))
+        void _densityAVX512(const float *x, const float *y, const float *z, const float *pos,
+                            const uint32_t *neighbors, unsigned int count, float *sums) const;
+
+        __attribute__((target("avx512f")))
+        void _deltaPAVX512(const float *x, const float *y, const float *z, const float *lambdas,
+                           const float *pos, float lambdaI, const uint32_t *neighbors, unsigned int count,
+                           float *sum) const;
+#endif
+
+        Constants _constants;
+        Level _level;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::SPHKernels::SPHKernels() : _level(detect()) {
+    std::memset(&_constants, 0, sizeof(_constants));
+}
+
+inline CSCI444::SPHKernels::Level CSCI444::SPHKernels::detect() {
+#if CSCI444_SPH_KERNELS_X86
+    if (__builtin_cpu_supports("avx512f")) return AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return AVX2;
+#endif
+    return SCALAR;
+}
+
+inline const char *CSCI444::SPHKernels::levelName(Level level) {
+    switch (level) {
+        case AVX2:
+            return "avx2";
+        case AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+inline bool CSCI444::SPHKernels::parseLevel(const char *name, Level &level) {
+    const Level levels[] = {SCALAR, AVX2, AVX512};
+    for (Level candidate : levels) {
+        if (std::strcmp(name, levelName(candidate)) == 0) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void CSCI444::SPHKernels::setLevel(Level level) {
+    Level best = detect();
+    _level = level > best ? best : level;
+}
+
+inline CSCI444::SPHKernels::Level CSCI444::SPHKernels::level() const {
+    return _level;
+}
+
+inline void CSCI444::SPHKernels::setConstants(const Constants &constants) {
+    _constants = constants;
+}
+
+inline void CSCI444::SPHKernels::densitySums(const float *x, const float *y, const float *z, const glm::vec3 &pos,
+                                             const uint32_t *neighbors, unsigned int count,
+                                             float &density, glm::vec3 &gradientI, float &sumGradients) const {
+    const float p[3] = {pos.x, pos.y, pos.z};
+    // density, gradient x, y, z, sum of squared gradients
+    float sums[5];
+#if CSCI444_SPH_KERNELS_X86
+    if (_level == AVX512) {
+        _densityAVX512(x, y, z, p, neighbors, count, sums);
+    } else if (_level == AVX2) {
+        _densityAVX2(x, y, z, p, neighbors, count, sums);
+    } else
+#endif
+    {
+        _densityScalar(x, y, z, p, neighbors, count, sums);
+    }
+    density = sums[0];
+    gradientI = glm::vec3(sums[1], sums[2], sums[3]);
+    sumGradients = sums[4];
+}
+
+inline glm::vec3 CSCI444::SPHKernels::deltaPSum(const float *x, const float *y, const float *z, const float *lambdas,
+                                                const glm::vec3 &pos, float lambdaI, const uint32_t *neighbors,
+                                                unsigned int count) const {
+    const float p[3] = {pos.x, pos.y, pos.z};
+    float sum[3];
+#if CSCI444_SPH_KERNELS_X86
+    if (_level == AVX512) {
+        _deltaPAVX512(x, y, z, lambdas, p, lambdaI, neighbors, count, sum);
+    } else if (_level == AVX2) {
+        _deltaPAVX2(x, y, z, lambdas, p, lambdaI, neighbors, count, sum);
+    } else
+#endif
+    {
+        _deltaPScalar(x, y, z, lambdas, p, lambdaI, neighbors, count, sum);
+    }
+    return glm::vec3(sum[0], sum[1], sum[2]);
+}
+
+inline void CSCI444::SPHKernels::_densityScalar(const float *x, const float *y, const float *z, const float *pos,
+                                                const uint32_t *neighbors, unsigned int count, float *sums) const {
+    const float h = _constants.supportRadius, h2 = h * h;
+    float density = 0.0f, gx = 0.0f, gy = 0.0f, gz = 0.0f, sumGradients = 0.0f;
+    for (unsigned int n = 0; n < count; n++) {
+        uint32_t j = neighbors[n];
+        float dx = pos[0] - x[j], dy = pos[1] - y[j], dz = pos[2] - z[j];
+        float r2 = dx * dx + dy * dy + dz * dz;
+
+        // WPoly
+        if (r2 <= h2 && r2 > MIN_DISTANCE) {
+            float h2minusr2 = h2 - r2;
+            density += _constants.kpoly * h2minusr2 * h2minusr2 * h2minusr2;
+        }
+
+        // gradWSpiky / restDensity
+        float r = std::sqrt(r2);
+        if (r <= h && r > MIN_DISTANCE) {
+            float hminusr = h - r;
+            float scale = _constants.kspiky * hminusr * hminusr / r / _constants.restDensity;
+            float gradX = scale * dx, gradY = scale * dy, gradZ = scale * dz;
+            sumGradients += gradX * gradX + gradY * gradY + gradZ * gradZ;
+            gx += gradX;
+            gy += gradY;
+            gz += gradZ;
+        }
+    }
+    sums[0] = density;
+    sums[1] = gx;
+    sums[2] = gy;
+    sums[3] = gz;
+    sums[4] = sumGradients;
+}
+
+inline void CSCI444::SPHKernels::_deltaPScalar(const float *x, const float *y, const float *z, const float *lambdas,
+                                               const float *pos, float lambdaI, const uint32_t *neighbors,
+                                               unsigned int count, float *sum) const {
+    const float h = _constants.supportRadius, h2 = h * h;
+    float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+    for (unsigned int n = 0; n < count; n++) {
+        uint32_t j = neighbors[n];
+        float dx = pos[0] - x[j], dy = pos[1] - y[j], dz = pos[2] - z[j];
+        float r2 = dx * dx + dy * dy + dz * dz;
+
+        // sCorr = -scorr * (WPoly / dcorr)^pcorr
+        float w = 0.0f;
+        if (r2 <= h2 && r2 > MIN_DISTANCE) {
+            float h2minusr2 = h2 - r2;
+            w = _constants.kpoly * h2minusr2 * h2minusr2 * h2minusr2;
+        }
+        float ratio = w / _constants.dcorr, power = 1.0f;
+        for (int p = 0; p < _constants.pcorr; p++) {
+            power *= ratio;
+        }
+        float coefficient = lambdaI + lambdas[j] - _constants.scorr * power;
+
+        float r = std::sqrt(r2);
+        if (r <= h && r > MIN_DISTANCE) {
+            float hminusr = h - r;
+            float scale = coefficient * (_constants.kspiky * hminusr * hminusr / r);
+            sx += scale * dx;
+            sy += scale * dy;
+            sz += scale * dz;
+        }
+    }
+    sum[0] = sx;
+    sum[1] = sy;
+    sum[2] = sz;
+}
+
+#if CSCI444_SPH_KERNELS_X86
+
+inline float CSCI444::SPHKernels::_horizontalSumAVX2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+
+inline void CSCI444::SPHKernels::_densityAVX2(const float *x, const float *y, const float *z, const float *pos,
+                                              const uint32_t *neighbors, unsigned int count, float *sums) const {
+    const float h = _constants.supportRadius;
+    const __m256 px = _mm256_set1_ps(pos[0]), py = _mm256_set1_ps(pos[1]), pz = _mm256_set1_ps(pos[2]);
+    const __m256 vh = _mm256_set1_ps(h), vh2 = _mm256_set1_ps(h * h), minDistance = _mm256_set1_ps(MIN_DISTANCE);
+    const __m256 kpoly = _mm256_set1_ps(_constants.kpoly), kspiky = _mm256_set1_ps(_constants.kspiky);
+    const __m256 restDensity = _mm256_set1_ps(_constants.restDensity);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 density = _mm256_setzero_ps(), sumGradients = _mm256_setzero_ps();
+    __m256 gx = _mm256_setzero_ps(), gy = _mm256_setzero_ps(), gz = _mm256_setzero_ps();
+    for (unsigned int n = 0; n < count; n += 8) {
+        // Lanes past the end of the neighbors gather nothing and are masked out of every sum
+        __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32((int) (count - n)), lanes);
+        __m256 mask = _mm256_castsi256_ps(active);
+        __m256i j = _mm256_maskload_epi32((const int *) (neighbors + n), active);
+        __m256 dx = _mm256_sub_ps(px, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), x, j, mask, 4));
+        __m256 dy = _mm256_sub_ps(py, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), y, j, mask, 4));
+        __m256 dz = _mm256_sub_ps(pz, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), z, j, mask, 4));
+        __m256 r2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+        // WPoly
+        __m256 polyMask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(r2, vh2, _CMP_LE_OQ),
+                                                            _mm256_cmp_ps(r2, minDistance, _CMP_GT_OQ)));
+        __m256 h2minusr2 = _mm256_sub_ps(vh2, r2);
+        __m256 w = _mm256_mul_ps(_mm256_mul_ps(kpoly, h2minusr2), _mm256_mul_ps(h2minusr2, h2minusr2));
+        density = _mm256_add_ps(density, _mm256_and_ps(w, polyMask));
+
+        // gradWSpiky / restDensity, the masked lanes may have divided by zero and are cleared afterwards
+        __m256 r = _mm256_sqrt_ps(r2);
+        __m256 spikyMask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(r, vh, _CMP_LE_OQ),
+                                                             _mm256_cmp_ps(r, minDistance, _CMP_GT_OQ)));
+        __m256 hminusr = _mm256_sub_ps(vh, r);
+        __m256 scale = _mm256_div_ps(_mm256_div_ps(_mm256_mul_ps(kspiky, _mm256_mul_ps(hminusr, hminusr)), r),
+                                     restDensity);
+        scale = _mm256_and_ps(scale, spikyMask);
+        __m256 gradX = _mm256_mul_ps(scale, dx), gradY = _mm256_mul_ps(scale, dy), gradZ = _mm256_mul_ps(scale, dz);
+        sumGradients = _mm256_fmadd_ps(gradZ, gradZ, _mm256_fmadd_ps(gradY, gradY,
+                                                                     _mm256_fmadd_ps(gradX, gradX, sumGradients)));
+        gx = _mm256_add_ps(gx, gradX);
+        gy = _mm256_add_ps(gy, gradY);
+        gz = _mm256_add_ps(gz, gradZ);
+    }
+    sums[0] = _horizontalSumAVX2(density);
+    sums[1] = _horizontalSumAVX2(gx);
+    sums[2] = _horizontalSumAVX2(gy);
+    sums[3] = _horizontalSumAVX2(gz);
+    sums[4] = _horizontalSumAVX2(sumGradients);
+}
+
+inline void CSCI444::SPHKernels::_deltaPAVX2(const float *x, const float *y, const float *z, const float *lambdas,
+                                             const float *pos, float lambdaI, const uint32_t *neighbors,
+                                             unsigned int count, float *sum) const {
+    const float h = _constants.supportRadius;
+    const __m256 px = _mm256_set1_ps(pos[0]), py = _mm256_set1_ps(pos[1]), pz = _mm256_set1_ps(pos[2]);
+    const __m256 vh = _mm256_set1_ps(h), vh2 = _mm256_set1_ps(h * h), minDistance = _mm256_set1_ps(MIN_DISTANCE);
+    const __m256 kpoly = _mm256_set1_ps(_constants.kpoly), kspiky = _mm256_set1_ps(_constants.kspiky);
+    const __m256 scorr = _mm256_set1_ps(_constants.scorr), dcorr = _mm256_set1_ps(_constants.dcorr);
+    const __m256 vLambdaI = _mm256_set1_ps(lambdaI);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 sx = _mm256_setzero_ps(), sy = _mm256_setzero_ps(), sz = _mm256_setzero_ps();
+    for (unsigned int n = 0; n < count; n += 8) {
+        __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32((int) (count - n)), lanes);
+        __m256 mask = _mm256_castsi256_ps(active);
+        __m256i j = _mm256_maskload_epi32((const int *) (neighbors + n), active);
+        __m256 dx = _mm256_sub_ps(px, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), x, j, mask, 4));
+        __m256 dy = _mm256_sub_ps(py, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), y, j, mask, 4));
+        __m256 dz = _mm256_sub_ps(pz, _mm256_mask_i32gather_ps(_mm256_setzero_ps(), z, j, mask, 4));
+        __m256 lambdaJ = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), lambdas, j, mask, 4);
+        __m256 r2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+        // sCorr = -scorr * (WPoly / dcorr)^pcorr
+        __m256 polyMask = _mm256_and_ps(_mm256_cmp_ps(r2, vh2, _CMP_LE_OQ), _mm256_cmp_ps(r2, minDistance, _CMP_GT_OQ));
+        __m256 h2minusr2 = _mm256_sub_ps(vh2, r2);
+        __m256 w = _mm256_mul_ps(_mm256_mul_ps(kpoly, h2minusr2), _mm256_mul_ps(h2minusr2, h2minusr2));
+        __m256 ratio = _mm256_div_ps(_mm256_and_ps(w, polyMask), dcorr);
+        __m256 power = _mm256_set1_ps(1.0f);
+        for (int p = 0; p < _constants.pcorr; p++) {
+            power = _mm256_mul_ps(power, ratio);
+        }
+        __m256 coefficient = _mm256_sub_ps(_mm256_add_ps(vLambdaI, lambdaJ), _mm256_mul_ps(scorr, power));
+
+        __m256 r = _mm256_sqrt_ps(r2);
+        __m256 spikyMask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(r, vh, _CMP_LE_OQ),
+                                                             _mm256_cmp_ps(r, minDistance, _CMP_GT_OQ)));
+        __m256 hminusr = _mm256_sub_ps(vh, r);
+        __m256 scale = _mm256_div_ps(_mm256_mul_ps(kspiky, _mm256_mul_ps(hminusr, hminusr)), r);
+        scale = _mm256_and_ps(_mm256_mul_ps(coefficient, scale), spikyMask);
+        sx = _mm256_fmadd_ps(scale, dx, sx);
+        sy = _mm256_fmadd_ps(scale, dy, sy);
+        sz = _mm256_fmadd_ps(scale, dz, sz);
+    }
+    sum[0] = _horizontalSumAVX2(sx);
+    sum[1] = _horizontalSumAVX2(sy);
+    sum[2] = _horizontalSumAVX2(sz);
+}
+
+// Not _mm512_reduce_add_ps, which trips -Wmaybe-uninitialized in GCC 12
+inline float CSCI444::SPHKernels::_horizontalSumAVX512(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    float sum = 0.0f;
+    for (unsigned int lane = 0; lane < 16; lane++) {
+        sum += lanes[lane];
+    }
+    return sum;
+}
+
+inline void CSCI444::SPHKernels::_densityAVX512(const float *x, const float *y, const float *z, const float *pos,
+                                                const uint32_t *neighbors, unsigned int count, float *sums) const {
+    const float h = _constants.supportRadius;
+    const __m512 px = _mm512_set1_ps(pos[0]), py = _mm512_set1_ps(pos[1]), pz = _mm512_set1_ps(pos[2]);
+    const __m512 vh = _mm512_set1_ps(h), vh2 = _mm512_set1_ps(h * h), minDistance = _mm512_set1_ps(MIN_DISTANCE);
+    const __m512 kpoly = _mm512_set1_ps(_constants.kpoly), kspiky = _mm512_set1_ps(_constants.kspiky);
+    const __m512 restDensity = _mm512_set1_ps(_constants.restDensity);
+
+    __m512 density = _mm512_setzero_ps(), sumGradients = _mm512_setzero_ps();
+    __m512 gx = _mm512_setzero_ps(), gy = _mm512_setzero_ps(), gz = _mm512_setzero_ps();
+    for (unsigned int n = 0; n < count; n += 16) {
+        __mmask16 mask = count - n >= 16 ? (__mmask16) 0xffff : (__mmask16) ((1u << (count - n)) - 1u);
+        __m512i j = _mm512_maskz_loadu_epi32(mask, neighbors + n);
+        __m512 dx = _mm512_sub_ps(px, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, j, x, 4));
+        __m512 dy = _mm512_sub_ps(py, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, j, y, 4));
+        __m512 dz = _mm512_sub_ps(pz, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, j, z, 4));
+        __m512 r2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+        // WPoly
+        __mmask16 polyMask = mask & _mm512_cmp_ps_mask(r2, vh2, _CMP_LE_OQ) &
+                             _mm512_cmp_ps_mask(r2, minDistance, _CMP_GT_OQ);
+        __m512 h2minusr2 = _mm512_sub_ps(vh2, r2);
+        __m512 w = _mm512_mul_ps(_mm512_mul_ps(kpoly, h2minusr2), _mm512_mul_ps(h2minusr2, h2minusr2));
+        density = _mm512_mask_add_ps(density, polyMask, density, w);
+
+        // gradWSpiky / restDensity
+        __m512 r = _mm512_maskz_sqrt_ps(mask, r2);
+        __mmask16 spikyMask = mask & _mm512_cmp_ps_mask(r, vh, _CMP_LE_OQ) &
+                              _mm512_cmp_ps_mask(r, minDistance, _CMP_GT_OQ);
+        __m512 hminusr = _mm512_sub_ps(vh, r);
+        __m512 scale = _mm512_maskz_div_ps(spikyMask, _mm512_mul_ps(kspiky, _mm512_mul_ps(hminusr, hminusr)), r);
+        scale = _mm512_div_ps(scale, restDensity);
+        __m512 gradX = _mm512_mul_ps(scale, dx), gradY = _mm512_mul_ps(scale, dy), gradZ = _mm512_mul_ps(scale, dz);
+        sumGradients = _mm512_fmadd_ps(gradZ, gradZ, _mm512_fmadd_ps(gradY, gradY,
+                                                                     _mm512_fmadd_ps(gradX, gradX, sumGradients)));
+        gx = _mm512_add_ps(gx, gradX);
+        gy = _mm512_add_ps(gy, gradY);
+        gz = _mm512_add_ps(gz, gradZ);
+    }
+    sums[0] = _horizontalSumAVX512(density);
+    sums[1] = _horizontalSumAVX512(gx);
+    sums[2] = _horizontalSumAVX512(gy);
+    sums[3] = _horizontalSumAVX512(gz);
+    sums[4] = _horizontalSumAVX512(sumGradients);
+}
+
+inline void CSCI444::SPHKernels::_deltaPAVX512(const float *x, const float *y, const float *z, const float *lambdas,
+                                               const float *pos, float lambdaI, const uint32_t *neighbors,
+                                               unsigned int count, float *sum) const {
+    const float h = _constants.supportRadius;
+    const __m512 px = _mm512_set1_ps(pos[0]), py = _mm512_set1_ps(pos[1]), pz = _mm512_set1_ps(pos[2]);
+    const __m512 vh = _mm512_set1_ps(h), vh2 = _mm512_set1_ps(h * h), minDistance = _mm512_set1_ps(MIN_DISTANCE);
+    const __m512 kpoly = _mm512_set1_ps(_constants.kpoly), kspiky = _mm512_set1_ps(_constants.kspiky);
+    const __m512 scorr = _mm512_set1_ps(_constants.scorr), dcorr = _mm512_set1_ps(_constants.dcorr);
+    const __m512 vLambdaI = _mm512_set1_ps(lambdaI);
+
+    __m512 sx = _mm512_setzero_ps(), sy = _mm512_setzero_ps(), sz = _mm512_setzero_ps();
+    for (unsigned int n = 0; n < count; n += 16) {
+        __mmask16 mask = count - n >= 16 ? (__mmask16) 0xffff : (__mmask16) ((1u << (count - n)) - 1u);
+        __m512i j = _mm512_maskz_loadu_epi32(mask, neighbors + n);
+        __m512 dx = _mm512_sub_ps(px, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, j, x, 4));
+        __m512 dy = _mm512_sub_ps(py, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, j, y, 4));
+        __m512 dz = _mm512_sub_ps(pz, _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, j, z, 4));
+        __m512 lambdaJ = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, j, lambdas, 4);
+        __m512 r2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+        // sCorr = -scorr * (WPoly / dcorr)^pcorr
+        __mmask16 polyMask = _mm512_cmp_ps_mask(r2, vh2, _CMP_LE_OQ) & _mm512_cmp_ps_mask(r2, minDistance, _CMP_GT_OQ);
+        __m512 h2minusr2 = _mm512_sub_ps(vh2, r2);
+        __m512 w = _mm512_maskz_mul_ps(polyMask, _mm512_mul_ps(kpoly, h2minusr2), _mm512_mul_ps(h2minusr2, h2minusr2));
+        __m512 ratio = _mm512_div_ps(w, dcorr);
+        __m512 power = _mm512_set1_ps(1.0f);
+        for (int p = 0; p < _constants.pcorr; p++) {
+            power = _mm512_mul_ps(power, ratio);
+        }
+        __m512 coefficient = _mm512_sub_ps(_mm512_add_ps(vLambdaI, lambdaJ), _mm512_mul_ps(scorr, power));
+
+        __m512 r = _mm512_maskz_sqrt_ps(mask, r2);
+        __mmask16 spikyMask = mask & _mm512_cmp_ps_mask(r, vh, _CMP_LE_OQ) &
+                              _mm512_cmp_ps_mask(r, minDistance, _CMP_GT_OQ);
+        __m512 hminusr = _mm512_sub_ps(vh, r);
+        __m512 scale = _mm512_maskz_div_ps(spikyMask, _mm512_mul_ps(kspiky, _mm512_mul_ps(hminusr, hminusr)), r);
+        scale = _mm512_mul_ps(coefficient, scale);
+        sx = _mm512_fmadd_ps(scale, dx, sx);
+        sy = _mm512_fmadd_ps(scale, dy, sy);
+        sz = _mm512_fmadd_ps(scale, dz, sz);
+    }
+    sum[0] = _horizontalSumAVX512(sx);
+    sum[1] = _horizontalSumAVX512(sy);
+    sum[2] = _horizontalSumAVX512(sz);
+}
+
+#endif // CSCI444_SPH_KERNELS_X86
+
+#endif // __CSCI444_SPH_KERNELS_SIMD_HPP__
@@ -16,6 +16,11 @@
 #include "ShaderUtils4.hpp"
 
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -51,6 +56,25 @@ namespace CSCI444 {
           */
         static void disableSeparablePrograms();
 
+        /** @brief Sets preprocessor definitions inserted after the #version line of every shader compiled afterwards
+          *
+            * Empty by default.  Used to inject compile time constants such as compute work group sizes.
+            * @param const char* defines - one or more complete #define lines
+          */
+        static void setShaderDefines( const char *defines );
+
+        /** @brief Caches linked program binaries in directory, programs created afterwards are loaded from it
+          *
+            * Binaries are keyed by a hash of every stage's source, the shader defines, separability and the
+            * driver, so editing a shader or updating the driver misses the cache and the program is compiled
+            * from source again.  The cache is disabled by default.
+            * @param const char* directory - directory holding the binaries, created if it does not exist
+          */
+        static void enableProgramBinaryCache( const char *directory );
+        /** @brief Compiles every program created afterwards from source
+          */
+        static void disableProgramBinaryCache();
+
 		/** @brief Creates a Shader Program using a Vertex Shader and Fragment Shader
 		  *
 			* @param const char* vertexShaderFilename - name of the file corresponding to the vertex shader
@@ -198,6 +222,8 @@ namespace CSCI444 {
 
 		static bool sDEBUG;
         static bool sSEPARABLE;
+        static std::string sDEFINES;
+        static std::string sCACHE_DIRECTORY;
 
 		GLuint _vertexShaderHandle;
 		GLuint _tesselationControlShaderHandle;
@@ -218,6 +244,11 @@ namespace CSCI444 {
 
 		GLint* getUniformBlockOffsets( GLint uniformBlockIndex );
 		GLint* getUniformBlockOffsets( GLint uniformBlockIndex, const char *names[] );
+
+        std::string _programCacheFilename( const char *shaderFilenames[], GLbitfield stages );
+        bool _loadProgramBinary( const std::string &filename );
+        void _saveProgramBinary( const std::string &filename );
+        bool _finishProgram();
 	};
 
 }
@@ -226,6 +257,8 @@ namespace CSCI444 {
 
 bool CSCI444::ShaderProgram::sDEBUG = true;
 bool CSCI444::ShaderProgram::sSEPARABLE = false;
+std::string CSCI444::ShaderProgram::sDEFINES = "";
+std::string CSCI444::ShaderProgram::sCACHE_DIRECTORY = "";
 
 void CSCI444::ShaderProgram::enableDebugMessages() {
 	sDEBUG = true;
@@ -241,6 +274,25 @@ void CSCI444::ShaderProgram::disableSeparablePrograms() {
     sSEPARABLE = false;
 }
 
+void CSCI444::ShaderProgram::setShaderDefines( const char *defines ) {
+    sDEFINES = defines;
+}
+
+void CSCI444::ShaderProgram::enableProgramBinaryCache( const char *directory ) {
+    GLint numFormats = 0;
+    glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats );
+    if( numFormats == 0 ) {
+        if( sDEBUG ) printf( "[INFO]: Driver has no program binary formats, shaders are always compiled\n" );
+        sCACHE_DIRECTORY = "";
+        return;
+    }
+    mkdir( directory, 0755 );
+    sCACHE_DIRECTORY = directory;
+}
+void CSCI444::ShaderProgram::disableProgramBinaryCache() {
+    sCACHE_DIRECTORY = "";
+}
+
 CSCI444::ShaderProgram::ShaderProgram(const char *vertexShaderFilename, const char *fragmentShaderFilename ) {
 	registerShaderProgram( vertexShaderFilename, "", "", "", fragmentShaderFilename );
 }
@@ -306,11 +358,19 @@ bool CSCI444::ShaderProgram::registerShaderProgram(const char *shaderFilenames[]
 
     if( sDEBUG ) printf( "\n[INFO]: /--------------------------------------------------------\\\n");
 
+    /* load the linked program from the binary cache when this exact program was built before */
+    std::string cacheFilename = _programCacheFilename( shaderFilenames, stages );
+    if( !cacheFilename.empty() && _loadProgramBinary( cacheFilename ) ) {
+        _vertexShaderHandle = _tesselationControlShaderHandle = _tesselationEvaluationShaderHandle = 0;
+        _geometryShaderHandle = _fragmentShaderHandle = _computeShaderHandle = 0;
+        return _finishProgram();
+    }
+
     /* compile each one of our shaders */
     /// Vertex Shader
     if((GL_VERTEX_SHADER_BIT & stages) != 0){
         if (sDEBUG) printf("[INFO]: | Vertex Shader: %39s |\n", shaderFilenames[counter]);
-        _vertexShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader(shaderFilenames[counter], GL_VERTEX_SHADER);
+        _vertexShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader(shaderFilenames[counter], GL_VERTEX_SHADER, sDEFINES.c_str());
         counter++;
     }else{
         _vertexShaderHandle = 0;
@@ -324,7 +384,7 @@ bool CSCI444::ShaderProgram::registerShaderProgram(const char *shaderFilenames[]
             _tesselationControlShaderHandle = 0;
         } else {
             _tesselationControlShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader(
-                    shaderFilenames[counter], GL_TESS_CONTROL_SHADER);
+                    shaderFilenames[counter], GL_TESS_CONTROL_SHADER, sDEFINES.c_str());
         }
         counter ++;
     } else {
@@ -338,7 +398,7 @@ bool CSCI444::ShaderProgram::registerShaderProgram(const char *shaderFilenames[]
             printf( "[ERROR]:|   TESSELATION SHADER NOT SUPPORTED!!  UPGRADE TO v4.0+ |\n" );
             _tesselationEvaluationShaderHandle = 0;
         } else {
-            _tesselationEvaluationShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader( shaderFilenames[counter], GL_TESS_EVALUATION_SHADER );
+            _tesselationEvaluationShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader( shaderFilenames[counter], GL_TESS_EVALUATION_SHADER, sDEFINES.c_str() );
         }
         counter++;
     } else {
@@ -352,7 +412,7 @@ bool CSCI444::ShaderProgram::registerShaderProgram(const char *shaderFilenames[]
             printf( "[ERROR]:|   GEOMETRY SHADER NOT SUPPORTED!!!    UPGRADE TO v3.2+ |\n" );
             _geometryShaderHandle = 0;
         } else {
-            _geometryShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader( shaderFilenames[counter], GL_GEOMETRY_SHADER );
+            _geometryShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader( shaderFilenames[counter], GL_GEOMETRY_SHADER, sDEFINES.c_str() );
         }
         counter++;
     } else {
@@ -363,7 +423,7 @@ bool CSCI444::ShaderProgram::registerShaderProgram(const char *shaderFilenames[]
     if((GL_FRAGMENT_SHADER_BIT & stages) != 0) {
         if (sDEBUG) printf("[INFO]: | Fragment Shader: %37s |\n", shaderFilenames[counter]);
         _fragmentShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader(shaderFilenames[counter],
-                                                                             GL_FRAGMENT_SHADER);
+                                                                             GL_FRAGMENT_SHADER, sDEFINES.c_str());
         counter++;
     }else{
         _fragmentShaderHandle = 0;
@@ -376,7 +436,7 @@ bool CSCI444::ShaderProgram::registerShaderProgram(const char *shaderFilenames[]
             printf( "[ERROR]:|   COMPUTE SHADER NOT SUPPORTED!!!    UPGRADE TO v4.3+ |\n" );
             _computeShaderHandle = 0;
         } else {
-            _computeShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader( shaderFilenames[counter], GL_COMPUTE_SHADER );
+            _computeShaderHandle = CSCI444_INTERNAL::ShaderUtils::compileShader( shaderFilenames[counter], GL_COMPUTE_SHADER, sDEFINES.c_str() );
         }
         counter++;
     }else{
@@ -408,8 +468,19 @@ bool CSCI444::ShaderProgram::registerShaderProgram(const char *shaderFilenames[]
     }
 
     /* link all the programs together on the GPU */
+    if( !cacheFilename.empty() ) {
+        glProgramParameteri( _shaderProgramHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+    }
     glLinkProgram( _shaderProgramHandle );
 
+    if( !cacheFilename.empty() ) {
+        _saveProgramBinary( cacheFilename );
+    }
+
+    return _finishProgram();
+}
+
+bool CSCI444::ShaderProgram::_finishProgram() {
     if( sDEBUG ) printf( "[INFO]: | Shader Program: %41s", "|\n" );
 
     /* check the program log */
@@ -427,6 +498,101 @@ bool CSCI444::ShaderProgram::registerShaderProgram(const char *shaderFilenames[]
     return _shaderProgramHandle != 0;
 }
 
+std::string CSCI444::ShaderProgram::_programCacheFilename( const char *shaderFilenames[], GLbitfield stages ) {
+    if( sCACHE_DIRECTORY.empty() ) return "";
+
+    const GLbitfield stageBits[] = { GL_VERTEX_SHADER_BIT, GL_TESS_CONTROL_SHADER_BIT, GL_TESS_EVALUATION_SHADER_BIT,
+                                     GL_GEOMETRY_SHADER_BIT, GL_FRAGMENT_SHADER_BIT, GL_COMPUTE_SHADER_BIT };
+
+    /* the key covers everything that changes the linked binary */
+    unsigned long long hash = CSCI444_INTERNAL::ShaderUtils::hashString( sSEPARABLE ? "separable" : "monolithic" );
+    const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+    for( GLenum name : driverStrings ) {
+        const GLubyte *value = glGetString( name );
+        hash = CSCI444_INTERNAL::ShaderUtils::hashString( std::string( value ? (const char*)value : "" ) + '\n', hash );
+    }
+
+    int counter = 0;
+    for( GLbitfield stageBit : stageBits ) {
+        if( (stageBit & stages) == 0 ) continue;
+
+        std::string source;
+        if( !CSCI444_INTERNAL::ShaderUtils::loadShaderSource( shaderFilenames[counter], sDEFINES.c_str(), source ) ) {
+            return "";
+        }
+        char stageName[16];
+        snprintf( stageName, sizeof(stageName), "%u\n", stageBit );
+        hash = CSCI444_INTERNAL::ShaderUtils::hashString( stageName, hash );
+        hash = CSCI444_INTERNAL::ShaderUtils::hashString( source, hash );
+        counter++;
+    }
+
+    char filename[32];
+    snprintf( filename, sizeof(filename), "/%016llx.bin", hash );
+    return sCACHE_DIRECTORY + filename;
+}
+
+bool CSCI444::ShaderProgram::_loadProgramBinary( const std::string &filename ) {
+    FILE *file = fopen( filename.c_str(), "rb" );
+    if( file == NULL ) return false;
+
+    /* file layout: binary format, binary length, binary */
+    GLenum format = 0;
+    GLint length = 0;
+    std::vector<char> binary;
+    bool read = fread( &format, sizeof(format), 1, file ) == 1 && fread( &length, sizeof(length), 1, file ) == 1 && length > 0;
+    if( read ) {
+        binary.resize( length );
+        read = fread( &binary[0], 1, length, file ) == (size_t)length;
+    }
+    fclose( file );
+    if( !read ) return false;
+
+    _shaderProgramHandle = glCreateProgram();
+    glProgramParameteri( _shaderProgramHandle, GL_PROGRAM_SEPARABLE, sSEPARABLE );
+    glProgramBinary( _shaderProgramHandle, format, &binary[0], length );
+
+    /* the driver rejects binaries it can no longer use, compile from source in that case */
+    GLint status = GL_FALSE;
+    glGetProgramiv( _shaderProgramHandle, GL_LINK_STATUS, &status );
+    if( status != GL_TRUE ) {
+        glDeleteProgram( _shaderProgramHandle );
+        _shaderProgramHandle = 0;
+        return false;
+    }
+
+    if( sDEBUG ) printf( "[INFO]: | Program Binary: %38s |\n", filename.c_str() );
+    return true;
+}
+
+void CSCI444::ShaderProgram::_saveProgramBinary( const std::string &filename ) {
+    GLint status = GL_FALSE, length = 0;
+    glGetProgramiv( _shaderProgramHandle, GL_LINK_STATUS, &status );
+    glGetProgramiv( _shaderProgramHandle, GL_PROGRAM_BINARY_LENGTH, &length );
+    if( status != GL_TRUE || length <= 0 ) return;
+
+    GLenum format = 0;
+    std::vector<char> binary( length );
+    glGetProgramBinary( _shaderProgramHandle, length, &length, &format, &binary[0] );
+
+    /* write to a file of our own and rename it, jobs starting together never see a partial binary */
+    char suffix[32];
+    snprintf( suffix, sizeof(suffix), ".%d.tmp", (int)getpid() );
+    std::string partialFilename = filename + suffix;
+    FILE *file = fopen( partialFilename.c_str(), "wb" );
+    if( file == NULL ) {
+        fprintf( stderr, "[ERROR]: Could not write program binary %s\n", filename.c_str() );
+        return;
+    }
+    bool written = fwrite( &format, sizeof(format), 1, file ) == 1 && fwrite( &length, sizeof(length), 1, file ) == 1 &&
+                   fwrite( &binary[0], 1, length, file ) == (size_t)length;
+    written = fclose( file ) == 0 && written;
+    if( !written || rename( partialFilename.c_str(), filename.c_str() ) != 0 ) {
+        fprintf( stderr, "[ERROR]: Could not write program binary %s\n", filename.c_str() );
+        remove( partialFilename.c_str() );
+    }
+}
+
 GLint CSCI444::ShaderProgram::getUniformLocation(const char *uniformName ) {
 	GLint uniformLoc = glGetUniformLocation( _shaderProgramHandle, uniformName );
 	if( uniformLoc == -1 )
@@ -545,6 +711,7 @@ CSCI444::ShaderProgram::~ShaderProgram() {
 	glDeleteShader( _tesselationEvaluationShaderHandle );
 	glDeleteShader( _geometryShaderHandle );
 	glDeleteShader( _fragmentShaderHandle );
+	glDeleteShader( _computeShaderHandle );
 	glDeleteProgram( _shaderProgramHandle );
 }
 
@@ -34,7 +34,10 @@ namespace CSCI444_INTERNAL {
 		const char* GL_shader_type_to_string( GLenum type );
 
 		void readTextFromFile( const char* filename, char* &output );
-		GLuint compileShader( const char *filename, GLenum shaderType );
+		bool loadShaderSource( const char *filename, const char *defines, std::string &source );
+		GLuint compileShader( const char *filename, GLenum shaderType, const char *defines = "" );
+
+		unsigned long long hashString( const std::string &text, unsigned long long hash = 14695981039346656037ULL );
 
 		void printLog( GLuint handle );
 		void printSubroutineInfo( GLuint handle, GLenum shaderStage );
@@ -387,26 +390,57 @@ inline void CSCI444_INTERNAL::ShaderUtils::printShaderProgramInfo( GLuint handle
 	}
 }
 
+// loadShaderSource() //////////////////////////////////////////////////////////
+//
+//  Reads a shader file and inserts the given defines after its #version line
+//
+////////////////////////////////////////////////////////////////////////////////
+inline bool CSCI444_INTERNAL::ShaderUtils::loadShaderSource( const char *filename, const char *defines, std::string &source ) {
+	char *shaderString = NULL;
+
+    /* read in the text file and store the contents in a string */
+    readTextFromFile( filename, shaderString );
+    if( shaderString == NULL ) {
+        source = "";
+        return false;
+    }
+    source = shaderString;
+    delete [] shaderString;
+
+    /* the defines must follow the #version line, a #line directive keeps the log's line numbers matching the file */
+    std::string::size_type version = source.find( "#version" );
+    if( defines[0] != '\0' && version != std::string::npos ) {
+        std::string::size_type end = source.find( '\n', version );
+        end = (end == std::string::npos) ? source.length() : end + 1;
+        unsigned int line = 1;
+        for( std::string::size_type i = 0; i < end; i++ ) {
+            if( source[i] == '\n' ) line++;
+        }
+        char lineDirective[32];
+        snprintf( lineDirective, sizeof(lineDirective), "\n#line %u\n", line );
+        source.insert( end, std::string(defines) + lineDirective );
+    }
+    return true;
+}
+
 // compileShader() ///////////////////////////////////////////////////////////////
 //
 //  Compile a given shader program
 //
 ////////////////////////////////////////////////////////////////////////////////
-inline GLuint CSCI444_INTERNAL::ShaderUtils::compileShader( const char *filename, GLenum shaderType ) {
+inline GLuint CSCI444_INTERNAL::ShaderUtils::compileShader( const char *filename, GLenum shaderType, const char *defines ) {
 	GLuint shaderHandle = 0;
-	char *shaderString;
+	std::string source;
 
     /* create a handle to our shader */
 	shaderHandle = glCreateShader( shaderType );
 
     /* read in each text file and store the contents in a string */
-    readTextFromFile( filename, shaderString );
+    loadShaderSource( filename, defines, source );
+    const char *sourceString = source.c_str();
 
     /* send the contents of each program to the GPU */
-    glShaderSource( shaderHandle, 1, (const char**)&shaderString, NULL );
-
-    /* we are good programmers so free up the memory used by each buffer */
-    delete [] shaderString;
+    glShaderSource( shaderHandle, 1, &sourceString, NULL );
 
     /* compile each shader on the GPU */
     glCompileShader( shaderHandle );
@@ -418,4 +452,17 @@ inline GLuint CSCI444_INTERNAL::ShaderUtils::compileShader( const char *filename
     return shaderHandle;
 }
 
+// hashString() ////////////////////////////////////////////////////////////////
+//
+//  64 bit FNV-1a hash, pass the previous result as hash to hash several strings
+//
+////////////////////////////////////////////////////////////////////////////////
+inline unsigned long long CSCI444_INTERNAL::ShaderUtils::hashString( const std::string &text, unsigned long long hash ) {
+    for( std::string::size_type i = 0; i < text.length(); i++ ) {
+        hash ^= (unsigned char) text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 #endif // __CSCI444_SHADEREUTILS_4_H__
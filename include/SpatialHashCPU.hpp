@@ -0,0 +1,266 @@
+/** @file SpatialHashCPU.hpp
+  * @brief Spacial hash of particle positions built in parallel on the CPU
+	* @author Zachary Smeton
+	*
+	*	Particles are binned by the hash of the grid cell they are in (cells as
+	*	wide as the neighbor search radius) and looked up bucket by bucket.  The
+	*	hash can be built two ways:
+	*
+	*	ATOMIC_LIST   - every particle exchanges itself into the head of its
+	*	                bucket's linked list, lock free and a single pass, but
+	*	                walking a bucket jumps around memory
+	*	COUNTING_SORT - every thread histograms its share of the particles, the
+	*	                histograms are scanned into bucket offsets and every
+	*	                thread scatters its particles to their bucket's range.
+	*	                Three passes, but the buckets end up contiguous and
+	*	                always in the same order
+	*
+	*	@warning NOTE: COUNTING_SORT keeps a histogram of mapSize counts per thread
+  */
+
+#ifndef __CSCI444_SPATIAL_HASH_CPU_HPP__
+#define __CSCI444_SPATIAL_HASH_CPU_HPP__
+
+#include <glm/glm.hpp>
+
+#include "ParticleStore.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @class SpatialHashCPU
+        * @brief Buckets of particles by the hash of their grid cell
+        */
+    class SpatialHashCPU {
+    public:
+        enum BuildMode {
+            ATOMIC_LIST, COUNTING_SORT
+        };
+
+        SpatialHashCPU();
+
+        /** @brief Returns "atomic" or "sort"
+            */
+        static const char *modeName(BuildMode mode);
+
+        /** @brief Parses a modeName()
+            * @return false if name is not a mode
+            */
+        static bool parseMode(const char *name, BuildMode &mode);
+
+        /** @brief Selects how the next build() bins the particles
+            */
+        void setMode(BuildMode mode);
+
+        BuildMode mode() const;
+
+        /** @brief Bins the first count positions
+            * @param float cellSize        - width of the grid cells, the neighbor search radius
+            * @param unsigned int mapSize  - number of buckets
+            */
+        void build(const Float3Stream &positions, unsigned int count, float cellSize, unsigned int mapSize,
+                   ThreadPool &pool);
+
+        glm::ivec3 cell(const glm::vec3 &pos) const;
+
+        /** @brief Returns the bucket of cell
+            */
+        uint32_t hash(const glm::ivec3 &cell) const;
+
+        /** @brief Calls function(j) for every particle j in bucket
+            */
+        template<typename Function>
+        void forEachInBucket(uint32_t bucket, Function function) const;
+
+    private:
+        enum : uint32_t { EMPTY = 0xffffffff };
+
+        // Buckets per scan block of the counting sort
+        static const unsigned int SCAN_BLOCK = 4096;
+
+        void _buildList(const Float3Stream &positions, ThreadPool &pool);
+
+        void _buildSorted(const Float3Stream &positions, ThreadPool &pool);
+
+        BuildMode _mode;
+        BuildMode _builtMode;
+        float _cellSize;
+        unsigned int _mapSize;
+        unsigned int _count;
+
+        // ATOMIC_LIST: head of every bucket, next particle in the bucket of every particle
+        std::unique_ptr<std::atomic<uint32_t>[]> _heads;
+        unsigned int _headsSize;
+        std::vector<uint32_t> _next;
+
+        // COUNTING_SORT: bucket b holds _sorted[_bucketStart[b], _bucketStart[b + 1])
+        std::vector<uint32_t> _bucketStart;
+        std::vector<uint32_t> _sorted;
+        std::vector<uint32_t> _buckets;         // bucket of every particle
+        std::vector<uint32_t> _histograms;      // one row of mapSize counts per thread
+        std::vector<uint32_t> _blockStart;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::SpatialHashCPU::SpatialHashCPU()
+        : _mode(ATOMIC_LIST), _builtMode(ATOMIC_LIST), _cellSize(1.0f), _mapSize(0), _count(0), _headsSize(0) {
+}
+
+inline const char *CSCI444::SpatialHashCPU::modeName(BuildMode mode) {
+    return mode == COUNTING_SORT ? "sort" : "atomic";
+}
+
+inline bool CSCI444::SpatialHashCPU::parseMode(const char *name, BuildMode &mode) {
+    if (std::strcmp(name, modeName(ATOMIC_LIST)) == 0) {
+        mode = ATOMIC_LIST;
+    } else if (std::strcmp(name, modeName(COUNTING_SORT)) == 0) {
+        mode = COUNTING_SORT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline void CSCI444::SpatialHashCPU::setMode(BuildMode mode) {
+    _mode = mode;
+}
+
+inline CSCI444::SpatialHashCPU::BuildMode CSCI444::SpatialHashCPU::mode() const {
+    return _mode;
+}
+
+inline glm::ivec3 CSCI444::SpatialHashCPU::cell(const glm::vec3 &pos) const {
+    return glm::ivec3(static_cast<int>(std::floor(pos.x / _cellSize)),
+                      static_cast<int>(std::floor(pos.y / _cellSize)),
+                      static_cast<int>(std::floor(pos.z / _cellSize)));
+}
+
+// SOURCE: Optimized Spatial Hashing for Collision Detection of Deformable Objects
+// Matthias Teschner
+inline uint32_t CSCI444::SpatialHashCPU::hash(const glm::ivec3 &cell) const {
+    const uint32_t P1 = 73856093;
+    const uint32_t P2 = 19349663;
+    const uint32_t P3 = 83492791;
+    return (((uint32_t) cell.x * P1) ^ ((uint32_t) cell.y * P2) ^ ((uint32_t) cell.z * P3)) % _mapSize;
+}
+
+inline void CSCI444::SpatialHashCPU::build(const Float3Stream &positions, unsigned int count, float cellSize,
+                                           unsigned int mapSize, ThreadPool &pool) {
+    _cellSize = cellSize;
+    _mapSize = mapSize;
+    _count = count;
+    _builtMode = _mode;
+    if (_mode == COUNTING_SORT) {
+        _buildSorted(positions, pool);
+    } else {
+        _buildList(positions, pool);
+    }
+}
+
+inline void CSCI444::SpatialHashCPU::_buildList(const Float3Stream &positions, ThreadPool &pool) {
+    if (_headsSize != _mapSize) {
+        _heads.reset(new std::atomic<uint32_t>[_mapSize]);
+        _headsSize = _mapSize;
+    }
+    _next.resize(_count);
+
+    pool.parallelFor(_mapSize, SCAN_BLOCK, [this](unsigned int bucket) {
+        _heads[bucket].store(EMPTY, std::memory_order_relaxed);
+    });
+    pool.parallelFor(_count, 1024, [this, &positions](unsigned int i) {
+        // One node per particle, so the node index is the particle index
+        uint32_t bucket = hash(cell(positions.get(i)));
+        _next[i] = _heads[bucket].exchange(i, std::memory_order_relaxed);
+    });
+}
+
+// Histogram, scan and scatter, the same passes as gridCount/prefixSum/gridScatter on the GPU
+inline void CSCI444::SpatialHashCPU::_buildSorted(const Float3Stream &positions, ThreadPool &pool) {
+    unsigned int numParts = pool.numThreads();
+    unsigned int partSize = (_count + numParts - 1) / numParts;
+    unsigned int numBlocks = (_mapSize + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    _histograms.resize((size_t) numParts * _mapSize);
+    _buckets.resize(_count);
+    _sorted.resize(_count);
+    _bucketStart.resize(_mapSize + 1);
+    _blockStart.resize(numBlocks + 1);
+
+    // Every part counts the buckets of its particles
+    pool.parallelFor(numParts, 1, [this, &positions, partSize](unsigned int part) {
+        uint32_t *histogram = _histograms.data() + (size_t) part * _mapSize;
+        std::fill(histogram, histogram + _mapSize, 0);
+        unsigned int end = std::min(_count, (part + 1) * partSize);
+        for (unsigned int i = part * partSize; i < end; i++) {
+            uint32_t bucket = hash(cell(positions.get(i)));
+            _buckets[i] = bucket;
+            histogram[bucket]++;
+        }
+    });
+
+    // Scan bucket by bucket and part by part within each block, so histogram[part][bucket] becomes where
+    // the part's first particle in the bucket goes relative to the block
+    pool.parallelFor(numBlocks, 1, [this, numParts](unsigned int block) {
+        unsigned int end = std::min(_mapSize, (block + 1) * SCAN_BLOCK);
+        uint32_t sum = 0;
+        for (unsigned int bucket = block * SCAN_BLOCK; bucket < end; bucket++) {
+            _bucketStart[bucket] = sum;
+            for (unsigned int part = 0; part < numParts; part++) {
+                uint32_t &count = _histograms[(size_t) part * _mapSize + bucket];
+                uint32_t start = sum;
+                sum += count;
+                count = start;
+            }
+        }
+        _blockStart[block + 1] = sum;
+    });
+    _blockStart[0] = 0;
+    for (unsigned int block = 0; block < numBlocks; block++) {
+        _blockStart[block + 1] += _blockStart[block];
+    }
+    pool.parallelFor(_mapSize, SCAN_BLOCK, [this](unsigned int bucket) {
+        _bucketStart[bucket] += _blockStart[bucket / SCAN_BLOCK];
+    });
+    _bucketStart[_mapSize] = _count;
+
+    // Every part scatters its particles, in index order within each bucket
+    pool.parallelFor(numParts, 1, [this, partSize](unsigned int part) {
+        uint32_t *offsets = _histograms.data() + (size_t) part * _mapSize;
+        unsigned int end = std::min(_count, (part + 1) * partSize);
+        for (unsigned int i = part * partSize; i < end; i++) {
+            uint32_t bucket = _buckets[i];
+            _sorted[_blockStart[bucket / SCAN_BLOCK] + offsets[bucket]++] = i;
+        }
+    });
+}
+
+template<typename Function>
+inline void CSCI444::SpatialHashCPU::forEachInBucket(uint32_t bucket, Function function) const {
+    if (_builtMode == COUNTING_SORT) {
+        for (uint32_t k = _bucketStart[bucket]; k < _bucketStart[bucket + 1]; k++) {
+            function(_sorted[k]);
+        }
+    } else {
+        uint32_t node = _heads[bucket].load(std::memory_order_relaxed);
+        while (node != EMPTY) {
+            function(node);
+            node = _next[node];
+        }
+    }
+}
+
+#endif // __CSCI444_SPATIAL_HASH_CPU_HPP__
@@ -0,0 +1,256 @@
+/** @file ThreadPool.hpp
+  * @brief Persistent worker threads that balance their tasks by work stealing
+	* @author Zachary Smeton
+	*
+	*	Every thread owns a deque of tasks.  A thread pushes the tasks it spawns
+	*	onto the back of its own deque and pops from the back, so it keeps
+	*	working on what is still in its cache; a thread that runs dry steals
+	*	from the front of another thread's deque, taking the oldest and usually
+	*	largest piece of outstanding work.  Uneven tasks (particles with 10x
+	*	more neighbors than others) therefore never leave a core idle while
+	*	another one still has a queue of chunks.
+	*
+	*	The thread calling wait() or parallelFor() works as thread 0 until the
+	*	outstanding tasks are done, so a pool of n threads starts n - 1 workers.
+	*	Pinning only applies to those workers, the caller is usually the render
+	*	thread and is left wherever the application put it; core 0 stays free
+	*	for it.
+	*
+	*	@warning NOTE: tasks may push more tasks, but must not call wait() themselves
+  */
+
+#ifndef __CSCI444_THREAD_POOL_HPP__
+#define __CSCI444_THREAD_POOL_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @class ThreadPool
+        * @brief Work stealing pool of persistent threads
+        */
+    class ThreadPool {
+    public:
+        typedef std::function<void()> Task;
+
+        /** @brief Starts the workers
+            * @param unsigned int numThreads - threads including the caller, 0 uses every hardware thread
+            * @param bool pinThreads         - pins worker t to core t, the caller keeps its affinity (Linux only,
+            *                                  ignored elsewhere)
+            */
+        ThreadPool(unsigned int numThreads = 0, bool pinThreads = false);
+
+        /** @brief Stops the workers, the pool must be idle
+            */
+        ~ThreadPool();
+
+        unsigned int numThreads() const;
+
+        /** @brief Queues task on the calling thread's deque (thread 0's for threads outside the pool)
+            */
+        void push(const Task &task);
+
+        /** @brief Works on the queued tasks until every task pushed so far, and every task they pushed, is done
+            */
+        void wait();
+
+        /** @brief Calls function(i) for every i in [0, count) in chunks of grain indices and waits for them
+            */
+        template<typename Function>
+        void parallelFor(unsigned int count, unsigned int grain, Function function);
+
+        /** @brief Returns the number of tasks that were taken from another thread's deque
+            */
+        unsigned int steals() const;
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void _worker(unsigned int thread);
+
+        bool _runOne(unsigned int thread);
+
+        // Pins the calling thread to core (modulo the number of cores)
+        static void _pin(unsigned int core);
+
+        // Index of this thread in this pool, 0 for the caller and for threads of other pools
+        unsigned int _threadIndex() const;
+
+        // The pool this thread is a worker of and its index there, a worker of one pool may use another
+        static const ThreadPool *&_workerPool();
+
+        static unsigned int &_workerIndex();
+
+        std::vector<std::unique_ptr<Queue>> _queues;
+        std::vector<std::thread> _workers;
+
+        std::atomic<unsigned int> _queued;      // tasks sitting in a deque
+        std::atomic<unsigned int> _pending;     // tasks pushed and not finished
+        std::atomic<unsigned int> _steals;
+        std::atomic<bool> _stop;
+        bool _pinThreads;
+        std::mutex _sleepMutex;
+        std::condition_variable _sleep;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+inline CSCI444::ThreadPool::ThreadPool(unsigned int numThreads, bool pinThreads)
+        : _queued(0), _pending(0), _steals(0), _stop(false), _pinThreads(pinThreads) {
+    if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0) numThreads = 1;
+
+    for (unsigned int t = 0; t < numThreads; t++) {
+        _queues.emplace_back(new Queue());
+    }
+    for (unsigned int t = 1; t < numThreads; t++) {
+        _workers.emplace_back(&ThreadPool::_worker, this, t);
+    }
+}
+
+inline CSCI444::ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _stop = true;
+    }
+    _sleep.notify_all();
+    for (auto &worker : _workers) {
+        worker.join();
+    }
+}
+
+inline unsigned int CSCI444::ThreadPool::numThreads() const {
+    return _queues.size();
+}
+
+inline const CSCI444::ThreadPool *&CSCI444::ThreadPool::_workerPool() {
+    static thread_local const ThreadPool *pool = nullptr;
+    return pool;
+}
+
+inline unsigned int &CSCI444::ThreadPool::_workerIndex() {
+    static thread_local unsigned int index = 0;
+    return index;
+}
+
+inline unsigned int CSCI444::ThreadPool::_threadIndex() const {
+    return _workerPool() == this ? _workerIndex() : 0;
+}
+
+inline void CSCI444::ThreadPool::_pin(unsigned int core) {
+#ifdef __linux__
+    unsigned int cores = std::thread::hardware_concurrency();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cores != 0 ? core % cores : 0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void) core;
+#endif
+}
+
+inline void CSCI444::ThreadPool::push(const Task &task) {
+    unsigned int thread = _threadIndex();
+    // Counted before it is visible to thieves, so _queued never drops below the tasks actually queued
+    _pending++;
+    _queued++;
+    {
+        std::lock_guard<std::mutex> lock(_queues[thread]->mutex);
+        _queues[thread]->tasks.push_back(task);
+    }
+    {
+        // Taking the lock orders the notify after a worker's check of _queued, so no wakeup is lost
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+    }
+    _sleep.notify_one();
+}
+
+// Pops from the back of the own deque, or steals from the front of the others starting at the next thread
+inline bool CSCI444::ThreadPool::_runOne(unsigned int thread) {
+    Task task;
+    for (unsigned int k = 0; k < _queues.size() && !task; k++) {
+        Queue &queue = *_queues[(thread + k) % _queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        if (k == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            _steals++;
+        }
+    }
+    if (!task) {
+        return false;
+    }
+
+    _queued--;
+    task();
+    _pending--;
+    return true;
+}
+
+inline void CSCI444::ThreadPool::_worker(unsigned int thread) {
+    _workerPool() = this;
+    _workerIndex() = thread;
+    if (_pinThreads) {
+        _pin(thread);
+    }
+    while (true) {
+        if (_runOne(thread)) continue;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleep.wait(lock, [this]() { return _stop || _queued > 0; });
+        if (_stop) return;
+    }
+}
+
+inline void CSCI444::ThreadPool::wait() {
+    unsigned int thread = _threadIndex();
+    while (_pending > 0) {
+        if (!_runOne(thread)) {
+            // Everything left is running on other threads
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<typename Function>
+inline void CSCI444::ThreadPool::parallelFor(unsigned int count, unsigned int grain, Function function) {
+    if (grain == 0) grain = 1;
+    for (unsigned int begin = 0; begin < count; begin += grain) {
+        unsigned int end = begin + grain < count ? begin + grain : count;
+        push([=]() {
+            for (unsigned int i = begin; i < end; i++) function(i);
+        });
+    }
+    wait();
+}
+
+inline unsigned int CSCI444::ThreadPool::steals() const {
+    return _steals;
+}
+
+#endif // __CSCI444_THREAD_POOL_HPP__
@@ -0,0 +1,198 @@
+/** @file TriangleBVH.hpp
+  * @brief Bounding volume hierarchy over a triangle mesh for closest triangle queries
+	* @author Zachary Smeton
+	*
+	*	The triangles are split at the median centroid along the longest axis
+	*	of their centroids' bounds until at most LEAF_SIZE are left.  The nodes
+	*	are stored depth first in one flat array, an interior node's left child
+	*	is the node after it and first holds its right child, so the tree can
+	*	be copied to a shader storage buffer as is.
+	*
+	*	A closest triangle query descends into the nearer child first and skips
+	*	every node whose box is further away than the best triangle so far,
+	*	which leaves a handful of leaves per query instead of every triangle.
+  */
+
+#ifndef __CSCI444_TRIANGLE_BVH_HPP__
+#define __CSCI444_TRIANGLE_BVH_HPP__
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+
+/** @namespace CSCI444
+  * @brief CSCI444 Helper Functions for OpenGL
+	*/
+namespace CSCI444 {
+
+    /** @class TriangleBVH
+        * @brief Median split BVH of triangles in a flat, depth first node array
+        */
+    class TriangleBVH {
+    public:
+        // std430 layout, 48 bytes
+        struct Node {
+            glm::vec4 boundsMin;
+            glm::vec4 boundsMax;
+            uint32_t first;         // leaf: first entry of triangleOrder(), interior: index of the right child
+            uint32_t count;         // triangles in a leaf, 0 for interior nodes
+            uint32_t padding[2];
+        };
+
+        static const unsigned int LEAF_SIZE = 4;
+
+        /** @brief Builds the tree over triangles, anything with glm::vec4 v1, v2 and v3 corners
+            */
+        template<typename TriangleType>
+        void build(const std::vector<TriangleType> &triangles);
+
+        /** @brief Finds the triangle closest to point
+            * @param Distance distance - distance(t) returns the signed squared distance from point to triangle t
+            * @param float& minSDist   - the signed squared distance of the closest triangle
+            * @return the index of the closest triangle, -1 if the tree is empty
+            */
+        template<typename Distance>
+        int nearest(const glm::vec3 &point, Distance distance, float &minSDist) const;
+
+        const std::vector<Node> &nodes() const;
+
+        /** @brief Returns the triangle indices in leaf order, leaf n holds [nodes()[n].first, + count)
+            */
+        const std::vector<uint32_t> &triangleOrder() const;
+
+    private:
+        // Deep enough for any median split tree of 32 bit triangle counts
+        static const unsigned int MAX_DEPTH = 64;
+
+        uint32_t _build(uint32_t first, uint32_t count, const std::vector<glm::vec3> &mins,
+                        const std::vector<glm::vec3> &maxs, const std::vector<glm::vec3> &centroids);
+
+        static float _boxDistance2(const Node &node, const glm::vec3 &point);
+
+        std::vector<Node> _nodes;
+        std::vector<uint32_t> _order;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+template<typename TriangleType>
+inline void CSCI444::TriangleBVH::build(const std::vector<TriangleType> &triangles) {
+    std::vector<glm::vec3> mins(triangles.size()), maxs(triangles.size()), centroids(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++) {
+        glm::vec3 a(triangles[i].v1), b(triangles[i].v2), c(triangles[i].v3);
+        mins[i] = glm::min(a, glm::min(b, c));
+        maxs[i] = glm::max(a, glm::max(b, c));
+        centroids[i] = (a + b + c) / 3.0f;
+    }
+
+    _nodes.clear();
+    _order.resize(triangles.size());
+    for (uint32_t i = 0; i < _order.size(); i++) {
+        _order[i] = i;
+    }
+    if (!_order.empty()) {
+        _nodes.reserve(2 * (_order.size() / LEAF_SIZE + 1));
+        _build(0, (uint32_t) _order.size(), mins, maxs, centroids);
+    }
+}
+
+inline uint32_t CSCI444::TriangleBVH::_build(uint32_t first, uint32_t count, const std::vector<glm::vec3> &mins,
+                                             const std::vector<glm::vec3> &maxs,
+                                             const std::vector<glm::vec3> &centroids) {
+    glm::vec3 boundsMin(mins[_order[first]]), boundsMax(maxs[_order[first]]);
+    glm::vec3 centroidMin(centroids[_order[first]]), centroidMax(centroidMin);
+    for (uint32_t k = first + 1; k < first + count; k++) {
+        boundsMin = glm::min(boundsMin, mins[_order[k]]);
+        boundsMax = glm::max(boundsMax, maxs[_order[k]]);
+        centroidMin = glm::min(centroidMin, centroids[_order[k]]);
+        centroidMax = glm::max(centroidMax, centroids[_order[k]]);
+    }
+
+    uint32_t index = (uint32_t) _nodes.size();
+    Node node = {};
+    node.boundsMin = glm::vec4(boundsMin, 0.0f);
+    node.boundsMax = glm::vec4(boundsMax, 0.0f);
+    _nodes.push_back(node);
+
+    if (count <= LEAF_SIZE) {
+        _nodes[index].first = first;
+        _nodes[index].count = count;
+        return index;
+    }
+
+    // Median split along the longest axis of the centroids
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    uint32_t half = count / 2;
+    std::nth_element(_order.begin() + first, _order.begin() + first + half, _order.begin() + first + count,
+                     [&centroids, axis](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    _build(first, half, mins, maxs, centroids);
+    uint32_t right = _build(first + half, count - half, mins, maxs, centroids);
+    _nodes[index].first = right;
+    _nodes[index].count = 0;
+    return index;
+}
+
+template<typename Distance>
+inline int CSCI444::TriangleBVH::nearest(const glm::vec3 &point, Distance distance, float &minSDist) const {
+    int closest = -1;
+    float best = INFINITY;
+    minSDist = INFINITY;
+    if (_nodes.empty()) return closest;
+
+    uint32_t stack[MAX_DEPTH];
+    unsigned int size = 0;
+    stack[size++] = 0;
+    while (size > 0) {
+        const Node &node = _nodes[stack[--size]];
+        if (_boxDistance2(node, point) >= best) continue;
+
+        if (node.count > 0) {
+            for (uint32_t k = node.first; k < node.first + node.count; k++) {
+                float dist = distance(_order[k]);
+                if (std::abs(dist) < best) {
+                    best = std::abs(dist);
+                    minSDist = dist;
+                    closest = (int) _order[k];
+                }
+            }
+            continue;
+        }
+
+        // Push the further child first so the nearer one is searched first and tightens best
+        uint32_t left = (uint32_t) (&node - _nodes.data()) + 1;
+        uint32_t right = node.first;
+        float leftDist = _boxDistance2(_nodes[left], point);
+        float rightDist = _boxDistance2(_nodes[right], point);
+        if (leftDist < rightDist) {
+            std::swap(left, right);
+            std::swap(leftDist, rightDist);
+        }
+        if (leftDist < best) stack[size++] = left;
+        if (rightDist < best) stack[size++] = right;
+    }
+    return closest;
+}
+
+inline const std::vector<CSCI444::TriangleBVH::Node> &CSCI444::TriangleBVH::nodes() const {
+    return _nodes;
+}
+
+inline const std::vector<uint32_t> &CSCI444::TriangleBVH::triangleOrder() const {
+    return _order;
+}
+
+inline float CSCI444::TriangleBVH::_boxDistance2(const Node &node, const glm::vec3 &point) {
+    glm::vec3 outside = glm::max(glm::vec3(node.boundsMin) - point, glm::vec3(0.0f)) +
+                        glm::max(point - glm::vec3(node.boundsMax), glm::vec3(0.0f));
+    return glm::dot(outside, outside);
+}
+
+#endif // __CSCI444_TRIANGLE_BVH_HPP__
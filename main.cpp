@@ -25,11 +25,16 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <iostream>
 
+#include <algorithm>
 #include <deque>
+#include <string>
+#include <chrono>
 
 #include <CSCI441/OpenGLUtils3.hpp>
 #include <CSCI441/ShaderUtils3.hpp>
@@ -37,6 +42,11 @@
 #include "include/MaterialReader.h"
 #include "include/ShaderProgram4.hpp"
 #include "include/ModelLoaderSDF.hpp"
+#include "include/FluidSolverCPU.hpp"
+#include "include/BufferSet.hpp"
+#include "include/ComputeScheduler.hpp"
+#include "include/GPUProfiler.hpp"
+#include "include/ParticleStore.hpp"
 
 #define DEBUG 0
 #define SDF 0
@@ -107,10 +117,16 @@ struct character_info {
 
 /// CONFIGURATIONS ///
 // Fluid Dynamics
-const int WORK_GROUP_SIZE = 1000;
-const uint NUM_PARTICLES = WORK_GROUP_SIZE * 15; // S
-const uint HASH_MAP_SIZE = NUM_PARTICLES;
-const uint MAX_NEIGHBORS = 500;
+const GLuint DEFAULT_PARTICLES = 15000;
+const GLuint DEFAULT_WORK_GROUP_SIZE = 256; // a whole number of 32 wide warps and 64 wide wavefronts
+const GLuint DEFAULT_NEIGHBORS = 160; // initial neighbor list budget per particle, grown on overflow
+
+// Set from the command line or a config file by parseArguments(), then fixed by setupSizes()
+GLuint numParticles = DEFAULT_PARTICLES;
+GLuint hashMapSize = 0;                 // CPU solver hash buckets, 0 uses numParticles
+GLuint neighborsPerParticle = DEFAULT_NEIGHBORS;
+GLuint defaultWorkGroupSize = DEFAULT_WORK_GROUP_SIZE;
+GLuint solverIters = 0;                 // constraint solver iterations, 0 uses SOLVER_ITERS
 
 // Source: http://graphics.stanford.edu/courses/cs348c/PA1_PBF2016/index.html
 const uint SUBSTEPS = 2;
@@ -119,6 +135,9 @@ const float PARTICLE_RADIUS = 0.05f;
 const float REST_DENSITY = 600.0;
 const float SUPPORT_RADIUS = 0.5;
 const float EPSILON = 6000.0;
+// Gauss-Seidel projects one constraint at a time on positions the ones before it corrected, so it does not overshoot
+// like Jacobi's simultaneous corrections and needs far less relaxation (see --validate-solver)
+const float COLORED_EPSILON = 1.0;
 const float MAX_DELTA_T = 0.0083;
 const float COLLISION_EPSILON = 0.0001;
 const float KPOLY = (315.0f / (64.0f * M_PI * pow(SUPPORT_RADIUS, 9)));
@@ -130,6 +149,42 @@ const int PCORR = 4;
 const float KXSPH = 0.003;
 const float VORT_EPSILON = 0.01;
 
+// --validate fails when the rms distance between the GPU and CPU particles grows past this fraction of the support
+// radius, the GPU sums neighbors in whatever order the atomics sorted them so the two never match exactly
+const float VALIDATE_RMS_TOLERANCE = 0.1f;
+// --validate-simd fails when a vectorized neighbor sum differs from the scalar one by more than this fraction, the
+// levels only add the terms in another order
+const float VALIDATE_SIMD_TOLERANCE = 1e-3f;
+
+// Frames the CPU may record ahead of the GPU, more only adds latency
+const GLuint MAX_FRAMES_IN_FLIGHT = 2;
+// --validate-frames fails when a particle ends up further than this fraction of the support radius from where it
+// ends up with one frame in flight.  On the CPU solver a 1e-6 nudge of a settled scene moves no particle more than
+// 6e-5 of the support radius in 10 frames, the GPU atomics summing neighbors in another order are a nudge like that
+const float VALIDATE_FRAMES_TOLERANCE = 1e-3f;
+// Frames --validate-frames runs before comparing, the random start throws particles around too chaotically to
+// compare any two runs
+const GLuint VALIDATE_FRAMES_WARMUP = 150;
+
+// Uniform grid for the neighbor search, covers the box the particles are confined to
+const glm::vec3 GRID_MIN(-4.0f, -5.0f, -4.0f);
+const glm::vec3 GRID_MAX(4.0f, 20.0f, 4.0f);
+const float CELL_SIZE = SUPPORT_RADIUS;
+const GLuint GRID_DIMS[3] = {(GLuint) ceil((GRID_MAX.x - GRID_MIN.x) / CELL_SIZE),
+                             (GLuint) ceil((GRID_MAX.y - GRID_MIN.y) / CELL_SIZE),
+                             (GLuint) ceil((GRID_MAX.z - GRID_MIN.z) / CELL_SIZE)};
+const GLuint NUM_CELLS = GRID_DIMS[0] * GRID_DIMS[1] * GRID_DIMS[2];
+const GLuint SCAN_BLOCK_SIZE = 1024; // elements scanned per work group in prefixSum.c.glsl
+// Cell counts keep the epoch of the step that wrote them above the low CELL_COUNT_BITS bits, so counts left over from
+// older steps read as zero and the counts never have to be cleared (see gridCount.c.glsl)
+const GLuint CELL_COUNT_BITS = 24;
+const GLuint MAX_GRID_EPOCH = (1u << (32 - CELL_COUNT_BITS)) - 1;
+
+// Indirect dispatches of the neighbor search, zeroed by neighborRebuild.c.glsl when the lists are reused
+const GLuint DISPATCH_GRID_COUNT = 0, DISPATCH_GRID_SCATTER = 1, DISPATCH_NEIGHBOR_FIND = 2, DISPATCH_CELL_SCAN = 3,
+        DISPATCH_NEIGHBOR_SCAN = 4, DISPATCH_SINGLE = 5;
+const GLuint NUM_NEIGHBOR_DISPATCHES = 6;
+
 float restDensity = REST_DENSITY;
 float epsilon = EPSILON;
 float supportRad = SUPPORT_RADIUS;
@@ -141,6 +196,8 @@ float vEps = VORT_EPSILON;
 float sCorr = SCORR;
 float kXsph = KXSPH;
 float simTime = 0.0;
+GLuint neighborCapacity = 0; // entries in the packed neighbor list
+GLuint maxNeighborCapacity = 0xffffffffu; // largest list a shader storage block can hold
 
 // Materials
 MaterialSettings matReader;
@@ -160,6 +217,35 @@ std::vector<int> indices;
 const string OBJECT = "models/peashooter.obj";
 
 
+/// RUN OPTIONS ///
+struct RunOptions {
+    bool headless = false;              // step the CPU solver without creating a window
+    bool benchmark = false;             // fixed dt, no vsync, fixed frame count, then write the results and exit
+    unsigned int frames = 600;          // frames to simulate in headless and benchmark mode
+    unsigned int seed = 1;              // seed of the initial particle positions
+    const char *benchmarkOut = "benchmark.json";    // .csv writes CSV, anything else JSON
+    unsigned int threads = 0;           // CPU solver threads (0 = all cores)
+    bool pinThreads = false;            // pin CPU solver worker thread t to core t
+    CSCI444::SpatialHashCPU::BuildMode hashMode = CSCI444::SpatialHashCPU::ATOMIC_LIST;    // CPU solver hash build
+    bool hashBenchmark = false;         // time both CPU hash builds at 100k-10M particles and exit
+    CSCI444::SPHKernels::Level cpuSIMD = CSCI444::SPHKernels::detect();    // CPU solver lambda/deltaP instruction set
+    unsigned int validateSubsteps = 0;  // substeps to compare the GPU against the CPU solver
+    unsigned int validateSIMDSubsteps = 0;  // substeps to compare every CPU instruction set against scalar
+    unsigned int validateSolverSubsteps = 0;    // substeps to compare colored Gauss-Seidel against Jacobi
+    bool validateSDF = false;           // check the bricked SDF lookup and collider on analytic fields and exit
+    unsigned int validateFrames = 0;    // frames to compare MAX_FRAMES_IN_FLIGHT frames in flight against one
+    float neighborSkin = 0.0f;          // extra neighbor search radius, lists are reused until a particle moves half
+    bool profile = false;               // time every GPU stage and show it in the overlay
+    const char *profileCSV = NULL;      // file the stage timings are written to on exit
+    const char *autotuneOut = NULL;     // time the work group sizes at startup and write the fastest to this file
+    const char *shaderCache = "shaderCache";    // directory of linked program binaries, NULL compiles every start
+    const char *sdfCache = "sdfCache";  // directory of finished signed distance fields, NULL generates every start
+    unsigned int reorderSteps = 0;      // steps between Morton reorders of the particle buffers (0 = never)
+    CSCI444::ConstraintSolver solver = CSCI444::SOLVER_JACOBI;     // Jacobi or colored Gauss-Seidel iterations
+    bool sdfCPU = false;                // build the obstacle SDF on the CPU (triangle BVH) instead of a compute shader
+    unsigned int sdfBand = 0;           // cells from the mesh with exact CPU SDF distances, 0 = every cell
+} runOptions;
+
 /// OTHER PARAMS ///
 GLint windowWidth, windowHeight;
 GLboolean shiftDown = false;
@@ -176,25 +262,59 @@ glm::vec3 lightPos = glm::vec3(6, 10, 1);
 
 // Simulation timing
 double lastTime = 0.0;
+CSCI444::GPUProfiler *profiler = NULL;
+// Issues the memory barriers between the passes of fluidUpdate() and the draws reading its buffers
+CSCI444::ComputeScheduler scheduler;
 
 /// SHADER PROGRAMS ///
 
 CSCI444::ShaderProgram *phongProgram = NULL;
 CSCI444::ShaderProgram *particleProgram = NULL;
-CSCI444::ShaderProgram *spacialHashProgram = NULL;
+CSCI444::ShaderProgram *predictProgram = NULL;
+CSCI444::ShaderProgram *neighborRebuildProgram = NULL;
+CSCI444::ShaderProgram *gridCountProgram = NULL;
+CSCI444::ShaderProgram *prefixSumProgram = NULL;
+CSCI444::ShaderProgram *gridScatterProgram = NULL;
 CSCI444::ShaderProgram *neighborFindProgram = NULL;
-CSCI444::ShaderProgram *lambdaProgram = NULL;
-CSCI444::ShaderProgram *deltaPProgram = NULL;
-CSCI444::ShaderProgram *applyDeltaPProgram = NULL;
+CSCI444::ShaderProgram *solverProgram = NULL;
+CSCI444::ShaderProgram *solverColoredProgram = NULL;
 CSCI444::ShaderProgram *vorticityProgram = NULL;
 CSCI444::ShaderProgram *xsphProgram = NULL;
+CSCI444::ShaderProgram *reorderProgram = NULL;
 CSCI444::ShaderProgram *sdfVisProgram = NULL;
 CSCI444::ShaderProgram *sdfProgram = NULL;
 
+// Per particle compute kernels, each compiled with its own WORK_GROUP_SIZE by compileFluidKernel()
+enum FluidKernel {
+    KERNEL_PREDICT, KERNEL_GRID_COUNT, KERNEL_GRID_SCATTER, KERNEL_NEIGHBOR_FIND, KERNEL_SOLVER,
+    KERNEL_SOLVER_COLORED, KERNEL_VORTICITY, KERNEL_XSPH, KERNEL_REORDER, NUM_FLUID_KERNELS
+};
+
+struct FluidKernelInfo {
+    const char *name;                   // name used by --work-group
+    const char *filename;
+    CSCI444::ShaderProgram **program;
+    const char *stages[2];              // profiler stages timed by autotuneWorkGroups()
+} fluidKernels[NUM_FLUID_KERNELS] = {
+        {"predict",      "shaders/fluidShaders/predict.c.glsl",      &predictProgram,      {"predict"}},
+        {"gridCount",    "shaders/fluidShaders/gridCount.c.glsl",    &gridCountProgram,    {"gridCount"}},
+        {"gridScatter",  "shaders/fluidShaders/gridScatter.c.glsl",  &gridScatterProgram,  {"gridScatter"}},
+        {"neighborFind", "shaders/fluidShaders/neighborFind.c.glsl", &neighborFindProgram, {"neighborCount",
+                                                                                            "neighborFill"}},
+        {"solver",       "shaders/fluidShaders/solver.c.glsl",       &solverProgram,       {"lambda", "deltaP"}},
+        {"solverColored", "shaders/fluidShaders/solverColored.c.glsl", &solverColoredProgram, {"gaussSeidel",
+                                                                                                "confine"}},
+        {"vorticity",    "shaders/fluidShaders/vorticity.c.glsl",    &vorticityProgram,    {"vorticity"}},
+        {"xsph",         "shaders/fluidShaders/xsph.c.glsl",         &xsphProgram,         {"xsph"}},
+        {"reorder",      "shaders/fluidShaders/reorder.c.glsl",      &reorderProgram,      {"reorder"}}
+};
+
+GLuint workGroupSizes[NUM_FLUID_KERNELS] = {}; // 0 until setupSizes() fills in defaultWorkGroupSize
+
 /// DATA ///
 // VAO/VBOs
-const GLuint LIGHT = 0, GROUND = 1, PARTICLES = 2, SDF_PLANE = 3;
-GLuint vaods[4];
+const GLuint LIGHT = 0, GROUND = 1, SDF_PLANE = 2;
+GLuint vaods[3];
 GLuint lightVbod;
 GLuint planeVbod;
 
@@ -224,13 +344,6 @@ struct PlaneShaderAttributeLocations {
     GLint texCoord = 2;
 } planeShaderAttribLocs;
 
-struct ParticleShaderAttributeLocations {
-    GLint index = 0;
-    GLint position = 1;
-    GLint velocity = 2;
-    GLint color = 3;
-} particleShaderAttribLocs;
-
 struct SphereAttributes {
     GLuint vaod;
     GLuint vbodPos;
@@ -238,11 +351,12 @@ struct SphereAttributes {
     GLuint vbodIndex;
 } sphereAttributes;
 
+// color and modelOffset take one float attribute per particle stream
 struct SphereAttributeLocations {
     GLint position = 0;
     GLint normal = 1;
-    GLint color = 2;
-    GLint modelOffset = 3;
+    GLint color[3] = {2, 3, 4};
+    GLint modelOffset[3] = {5, 6, 7};
 } sphereAttribLocs;
 
 // SSBOS and Textures
@@ -255,78 +369,99 @@ struct SphereAttributeLocations {
  * Neighbors
  * Color
  */
+// Slots of the ping-pong sets, a pass reading one slot and writing the next is followed by a swap instead of a copy
+enum PositionSlot {POSITION_CURRENT, POSITION_NEW, POSITION_SOLVED, NUM_POSITION_SLOTS};
+enum VelocitySlot {VELOCITY_CURRENT, VELOCITY_NEW, NUM_VELOCITY_SLOTS};
+enum IdSlot {ID_CURRENT, ID_NEW, NUM_ID_SLOTS};
+
 struct ParticleSSBOS {
-    GLuint index;
-    GLuint position;
-    GLuint newPosition;
-    GLuint velocity;
-    GLuint newVelocity;
+    CSCI444::BufferSet positions;   // position, newPosition and solvedPosition
+    CSCI444::BufferSet velocities;  // velocity and newVelocity
+    CSCI444::BufferSet ids;         // stable id of the particle in each slot, slots change when reordered
     GLuint lambda;
-    GLuint deltaP;
     GLuint color;
 } particleSSBOs;
 
 struct NeighborSSBOS {
-    GLuint counter;
-    GLuint hashMap;
-    GLuint linkedList;
-    GLuint neighborData;
-    GLuint hashClear;
-    GLuint listClear;
+    GLuint cellCounts;
+    GLuint cellStart;
+    GLuint sortedIndices;
+    GLuint particleRanks;
+    GLuint cellRanks;
+    GLuint particleCells;
+    GLuint sortedPositions;
+    GLuint scanBlockSums;
+    GLuint neighborList;
+    GLuint neighborOffsets;
+    GLuint neighborCounts;
+    GLuint neighborStats;
+    GLuint neighborStatsReadback;
+    GLuint buildPositions;
+    GLuint neighborDispatch;
 } neighborSSBOs;
 
 struct FluidSSBOLocations {
-    GLint index = 0;
     GLint position = 1;
     GLint newPosition = 2;
     GLint velocity = 3;
     GLint newVelocity = 4;
     GLint lambda = 5;
-    GLint deltaP = 6;
+    GLint solvedPosition = 6;
     GLint color = 7;
-    GLint hashMap = 8;
-    GLint linkedList = 9;
-    GLint neighbors = 10;
-    GLint counter = 0;
+    GLint cellCounts = 8;
+    GLint cellStart = 9;
+    GLint neighborList = 10;
+    GLint sortedIndices = 13;
+    GLint particleCells = 14;
+    GLint sortedPositions = 15;
+    GLint scanInput = 16;
+    GLint scanOutput = 17;
+    GLint scanBlockSums = 18;
+    GLint neighborOffsets = 19;
+    GLint neighborCounts = 20;
+    GLint neighborStats = 21;
+    GLint buildPositions = 22;
+    GLint neighborDispatch = 23;
+    GLint particleRanks = 24;
+    GLint particleIds = 25;
+    GLint newParticleIds = 26;
+    GLint cellRanks = 27;
 } fluidSSBOLocs;
 
 struct SDFSSBOLocations {
     GLint sdf = 11;
     GLint triangles = 12;
+    GLint bvh = 28;
 } sdfSSBOLocs;
 
 
 // Particle Structs and Data
-struct Float4 {
-    float x, y, z, w;
+// Mirrors NeighborStatsBuf in neighborFind.c.glsl
+struct NeighborStats {
+    GLuint totalNeighbors;
+    GLuint overflow;
+    GLuint maxNeighbors;
+    GLfloat maxDisplacement2;   // squared distance moved since the last build, reset every step
+    GLuint builds;              // steps that rebuilt the neighbor lists
+    GLuint steps;
 };
 
-struct NodeType {
-    uint nextNodeIndex;
-    uint particleIndex;
-};
+// Host copy of the particle SSBOs, x, y and z live in separate streams
+CSCI444::ParticleStore particleData;
 
-struct HashType {
-    uint headNodeIndex;
-};
+// Last neighbor statistics read back from the GPU, the fence guards the in flight copy
+NeighborStats neighborStats = {0, 0, 0, 0.0f, 0, 0};
+GLsync neighborStatsFence = NULL;
 
-struct NeighborType {
-    uint count;
-    uint neighboring[MAX_NEIGHBORS];
-};
-
-struct ParticleData {
-    GLuint idx[NUM_PARTICLES];
-    glm::vec4 position[NUM_PARTICLES];
-    glm::vec4 velocity[NUM_PARTICLES];
-    glm::vec4 color[NUM_PARTICLES];
-} particleData;
+// Epoch the grid cell counts of the current step are tagged with, 1 to MAX_GRID_EPOCH
+GLuint gridEpoch = 0;
+// Steps since the particle buffers were last sorted into Morton order
+GLuint stepsSinceReorder = 0;
 
-HashType hashMap[HASH_MAP_SIZE];
-HashType hashClear[HASH_MAP_SIZE];
-NodeType linkedList[NUM_PARTICLES];
-NodeType listClear[NUM_PARTICLES];
-NeighborType neighborData[NUM_PARTICLES];
+// Fences of the frames in flight, see throttleFrames().  Only --validate-frames runs fewer than the maximum
+GLsync frameFences[MAX_FRAMES_IN_FLIGHT] = {NULL};
+GLuint frameFenceIndex = 0;
+GLuint framesInFlight = MAX_FRAMES_IN_FLIGHT;
 
 /// SDF ///
 CSCI444::ModelLoaderSDF *modelLoader = NULL;
@@ -344,6 +479,36 @@ struct TextShaderUniformLocations {
     GLint text_mvp_location;
 } textShaderUniformLocs;
 
+struct ScanUniformLocations {
+    GLint count;
+    GLint pass;
+    GLint epoch;
+} scanUniformLocs;
+
+struct GridUniformLocations {
+    GLint epoch;
+} gridUniformLocs;
+
+struct NeighborUniformLocations {
+    GLint pass;
+} neighborUniformLocs;
+
+struct SolverUniformLocations {
+    GLint pass;
+} solverUniformLocs;
+
+struct ColoredSolverUniformLocations {
+    GLint pass;
+    GLint colorOffset;
+    GLint colorStride;
+    GLint epsilon;
+} coloredUniformLocs;
+
+struct ReorderUniformLocations {
+    GLint pass;
+    GLint epoch;
+} reorderUniformLocs;
+
 struct TextShaderAttributeLocations {
     GLint text_texCoord_location;
 } textShaderAttribLocs;
@@ -364,6 +529,293 @@ void convertSphericalToCartesian() {
     eyePoint.z = cameraAngles.z * -cosf(cameraAngles.x) * sinf(cameraAngles.y);
 }
 
+// Fills a FluidParameters with the current FluidDynamics values
+CSCI444::FluidParameters fluidParameters(float dt) {
+    CSCI444::FluidParameters params;
+    params.maxParticles = numParticles;
+    params.neighborCapacity = neighborCapacity;
+    params.mapSize = hashMapSize;
+    params.supportRadius = supportRad;
+    params.dt = dt;
+    params.solverIters = solverIters;
+    params.restDensity = restDensity;
+    params.epsilon = epsilon;
+    params.collisionEpsilon = COLLISION_EPSILON;
+    params.kpoly = KPOLY;
+    params.kspiky = KSPIKY;
+    params.scorr = SCORR;
+    params.dcorr = DCORR;
+    params.pcorr = PCORR;
+    params.kxsph = KXSPH;
+    params.vortEpsilon = VORT_EPSILON;
+    params.time = simTime;
+    params.neighborSkin = runOptions.neighborSkin;
+    params.coloredEpsilon = COLORED_EPSILON;
+    return params;
+}
+
+void printUsage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --headless [frames]    run the CPU solver without a window (default %u frames)\n", runOptions.frames);
+    printf("  --benchmark [frames]   run a fixed scene with a fixed dt and no vsync, then write the results\n");
+    printf("  --benchmark-out <file> benchmark results file, .csv for CSV otherwise JSON (default %s)\n",
+           runOptions.benchmarkOut);
+    printf("  --particles <n>        number of particles (default %u)\n", DEFAULT_PARTICLES);
+    printf("  --map-size <n>         CPU solver hash map buckets (default: the particle count)\n");
+    printf("  --neighbors <n>        initial neighbor list entries per particle (default %u)\n", DEFAULT_NEIGHBORS);
+    printf("  --solver <solver>      density constraint iterations: jacobi or colored (Gauss-Seidel over\n");
+    printf("                         colored grid cells) (default jacobi)\n");
+    printf("  --solver-iters <n>     constraint solver iterations per substep (default %u)\n", SOLVER_ITERS);
+    printf("  --config <file>        read options from file, written as on the command line, # comments\n");
+    printf("  --work-group-size <n>  compute work group size of every particle kernel (default %u)\n",
+           DEFAULT_WORK_GROUP_SIZE);
+    printf("  --work-group <kernel> <n>  work group size of one kernel:");
+    for (GLuint kernel = 0; kernel < NUM_FLUID_KERNELS; kernel++) {
+        printf(" %s", fluidKernels[kernel].name);
+    }
+    printf("\n");
+    printf("  --autotune [file]      time the work group sizes, use the fastest and save them as a config file\n");
+    printf("                         (default workgroups.cfg)\n");
+    printf("  --shader-cache <dir>   directory of cached program binaries (default %s)\n", runOptions.shaderCache);
+    printf("  --no-shader-cache      compile every shader from source\n");
+    printf("  --sdf-cache <dir>      directory of cached signed distance fields (default %s)\n", runOptions.sdfCache);
+    printf("  --no-sdf-cache         generate the signed distance field on every start\n");
+    printf("  --seed <n>             seed of the initial particle positions (default %u)\n", runOptions.seed);
+    printf("  --threads <n>          number of CPU solver threads (default: all cores)\n");
+    printf("  --pin-threads          pin every CPU solver worker thread to its own core (Linux)\n");
+    printf("  --sdf-cpu              build the obstacle's signed distance field on the CPU with a triangle BVH\n");
+    printf("  --sdf-band <cells>     with --sdf-cpu, exact distances only this many cells from the mesh, the rest\n");
+    printf("                         are jump flooded (default 0, exact everywhere)\n");
+    printf("  --hash <mode>          CPU solver hash build: atomic (lock free lists) or sort (counting sort)\n");
+    printf("                         (default atomic)\n");
+    printf("  --hash-benchmark       time both CPU hash builds at 100k to 10M particles and exit\n");
+    printf("  --cpu-simd <level>     CPU solver instruction set: scalar, avx2 or avx512 (default %s)\n",
+           CSCI444::SPHKernels::levelName(CSCI444::SPHKernels::detect()));
+    printf("  --reorder <steps>      sort the particle buffers into Morton order every <steps> steps (default never)\n");
+    printf("  --validate <substeps>  compare the GPU solver against the CPU solver, exit with an error if they drift\n");
+    printf("  --validate-simd [substeps]  compare the CPU solver's neighbor sums at every supported instruction set\n");
+    printf("                         against scalar, exit with an error if they differ (default 240 substeps)\n");
+    printf("  --validate-solver [substeps]  exit with an error if the colored solver needs more iterations than\n");
+    printf("                         Jacobi at --solver-iters to reach Jacobi's mean density error (default 240)\n");
+    printf("  --validate-frames [frames]  run the scene with 1 and with %u frames in flight, exit with an error if\n",
+           MAX_FRAMES_IN_FLIGHT);
+    printf("                         any particle ends up elsewhere (default 10 frames)\n");
+    printf("  --validate-sdf         check the bricked SDF lookup against the dense field at every cell, and the CPU\n");
+    printf("                         SDF collider, on analytic spheres and exit\n");
+    printf("  --profile [csv]        show GPU stage timings, and write them to csv on exit\n");
+    printf("  --skin <radius>        reuse neighbor lists built with this extra radius (0 to %.2f, default 0)\n",
+           SUPPORT_RADIUS);
+}
+
+void parseArguments(int argc, char *argv[]);
+
+// Tokens of every config file read, options like --benchmark-out keep pointers to them so they live until exit.
+// A deque never moves its strings when it grows
+std::deque<std::string> configTokens;
+// Config files being parsed, outermost first, to catch files that include themselves
+std::vector<std::string> openConfigFiles;
+
+// Reads whitespace separated options from filename and parses them like the command line
+void parseConfigFile(const char *program, const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]: Could not open config file \"%s\"\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    // The same file can be reached through different relative paths
+    char *resolved = realpath(filename, NULL);
+    std::string path(resolved != NULL ? resolved : filename);
+    free(resolved);
+    if (std::find(openConfigFiles.begin(), openConfigFiles.end(), path) != openConfigFiles.end()) {
+        fprintf(stderr, "[ERROR]: Config file \"%s\" includes itself through --config\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    openConfigFiles.push_back(path);
+
+    std::vector<char *> args(1, const_cast<char *>(program));
+    char token[512];
+    while (fscanf(file, "%511s", token) == 1) {
+        if (token[0] == '#') {
+            int c;
+            while ((c = fgetc(file)) != '\n' && c != EOF);
+            continue;
+        }
+        configTokens.push_back(token);
+        args.push_back(&configTokens.back()[0]);
+    }
+    fclose(file);
+
+    parseArguments(args.size(), &args[0]);
+    openConfigFiles.pop_back();
+}
+
+void parseArguments(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            runOptions.headless = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                runOptions.frames = (unsigned int) atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--benchmark") == 0) {
+            runOptions.benchmark = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                runOptions.frames = (unsigned int) atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--benchmark-out") == 0 && i + 1 < argc) {
+            runOptions.benchmarkOut = argv[++i];
+        } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            numParticles = (GLuint) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--map-size") == 0 && i + 1 < argc) {
+            hashMapSize = (GLuint) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            if (!CSCI444::parseConstraintSolver(argv[++i], runOptions.solver)) {
+                fprintf(stderr, "[ERROR]: Unknown --solver \"%s\"\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--solver-iters") == 0 && i + 1 < argc) {
+            solverIters = (GLuint) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--neighbors") == 0 && i + 1 < argc) {
+            neighborsPerParticle = (GLuint) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            parseConfigFile(argv[0], argv[++i]);
+        } else if (strcmp(argv[i], "--work-group-size") == 0 && i + 1 < argc) {
+            defaultWorkGroupSize = (GLuint) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--work-group") == 0 && i + 2 < argc) {
+            GLuint kernel = 0;
+            while (kernel < NUM_FLUID_KERNELS && strcmp(argv[i + 1], fluidKernels[kernel].name) != 0) {
+                kernel++;
+            }
+            if (kernel == NUM_FLUID_KERNELS) {
+                fprintf(stderr, "[ERROR]: Unknown kernel \"%s\" for --work-group\n", argv[i + 1]);
+                exit(EXIT_FAILURE);
+            }
+            workGroupSizes[kernel] = (GLuint) atoi(argv[i + 2]);
+            if (workGroupSizes[kernel] == 0) {
+                fprintf(stderr, "[ERROR]: --work-group sizes must be greater than 0\n");
+                exit(EXIT_FAILURE);
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--shader-cache") == 0 && i + 1 < argc) {
+            runOptions.shaderCache = argv[++i];
+        } else if (strcmp(argv[i], "--no-shader-cache") == 0) {
+            runOptions.shaderCache = NULL;
+        } else if (strcmp(argv[i], "--sdf-cache") == 0 && i + 1 < argc) {
+            runOptions.sdfCache = argv[++i];
+        } else if (strcmp(argv[i], "--no-sdf-cache") == 0) {
+            runOptions.sdfCache = NULL;
+        } else if (strcmp(argv[i], "--autotune") == 0) {
+            runOptions.autotuneOut = "workgroups.cfg";
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                runOptions.autotuneOut = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            runOptions.seed = (unsigned int) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            runOptions.threads = (unsigned int) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pin-threads") == 0) {
+            runOptions.pinThreads = true;
+        } else if (strcmp(argv[i], "--sdf-cpu") == 0) {
+            runOptions.sdfCPU = true;
+        } else if (strcmp(argv[i], "--sdf-band") == 0 && i + 1 < argc) {
+            runOptions.sdfBand = (unsigned int) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+            if (!CSCI444::SpatialHashCPU::parseMode(argv[++i], runOptions.hashMode)) {
+                fprintf(stderr, "[ERROR]: Unknown --hash mode \"%s\"\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--hash-benchmark") == 0) {
+            runOptions.hashBenchmark = true;
+        } else if (strcmp(argv[i], "--cpu-simd") == 0 && i + 1 < argc) {
+            if (!CSCI444::SPHKernels::parseLevel(argv[++i], runOptions.cpuSIMD)) {
+                fprintf(stderr, "[ERROR]: Unknown --cpu-simd level \"%s\"\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            if (runOptions.cpuSIMD > CSCI444::SPHKernels::detect()) {
+                fprintf(stderr, "[ERROR]: This CPU does not support --cpu-simd %s, the best it supports is %s\n",
+                        argv[i], CSCI444::SPHKernels::levelName(CSCI444::SPHKernels::detect()));
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            runOptions.reorderSteps = (unsigned int) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--validate") == 0 && i + 1 < argc) {
+            runOptions.validateSubsteps = (unsigned int) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--validate-solver") == 0) {
+            runOptions.validateSolverSubsteps = 240;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                runOptions.validateSolverSubsteps = (unsigned int) atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--validate-simd") == 0) {
+            runOptions.validateSIMDSubsteps = 240;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                runOptions.validateSIMDSubsteps = (unsigned int) atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--validate-frames") == 0) {
+            runOptions.validateFrames = 10;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                runOptions.validateFrames = (unsigned int) atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--validate-sdf") == 0) {
+            runOptions.validateSDF = true;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            runOptions.profile = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                runOptions.profileCSV = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--skin") == 0 && i + 1 < argc) {
+            runOptions.neighborSkin = (float) atof(argv[++i]);
+            if (runOptions.neighborSkin < 0.0f || runOptions.neighborSkin > SUPPORT_RADIUS) {
+                printf("[ERROR]: --skin must be between 0 and the support radius (%.2f)\n", SUPPORT_RADIUS);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            printUsage(argv[0]);
+            exit(strcmp(argv[i], "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+}
+
+// Validates the sizes read by parseArguments() and derives the ones that depend on the particle count
+void setupSizes() {
+    if (numParticles == 0) {
+        fprintf(stderr, "[ERROR]: --particles must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+    if (defaultWorkGroupSize == 0) {
+        fprintf(stderr, "[ERROR]: --work-group-size must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+    for (GLuint kernel = 0; kernel < NUM_FLUID_KERNELS; kernel++) {
+        if (workGroupSizes[kernel] == 0) {
+            workGroupSizes[kernel] = defaultWorkGroupSize;
+        }
+    }
+    if (runOptions.sdfBand > 0 && !runOptions.sdfCPU) {
+        fprintf(stderr, "[ERROR]: --sdf-band needs --sdf-cpu, the compute shader computes every cell exactly\n");
+        exit(EXIT_FAILURE);
+    }
+    if (hashMapSize == 0) {
+        hashMapSize = numParticles;
+    }
+    if (solverIters == 0) {
+        solverIters = SOLVER_ITERS;
+    }
+
+    GLuint64 capacity = (GLuint64) numParticles * neighborsPerParticle;
+    if (capacity > 0xffffffffu) {
+        fprintf(stderr, "[ERROR]: %u particles with %u neighbors each do not fit a 32 bit neighbor list\n",
+                numParticles, neighborsPerParticle);
+        exit(EXIT_FAILURE);
+    }
+    neighborCapacity = (GLuint) capacity;
+
+    if (numParticles >= (1u << CELL_COUNT_BITS)) {
+        fprintf(stderr, "[ERROR]: --particles must be less than %u, the grid cell counts hold %u bits\n",
+                1u << CELL_COUNT_BITS, CELL_COUNT_BITS);
+        exit(EXIT_FAILURE);
+    }
+}
+
 //*************************************************************************************
 
 // GLFW Event Callbacks
@@ -482,7 +934,8 @@ GLFWwindow *setupGLFW() {
     }
 
     glfwMakeContextCurrent(window);
-    glfwSwapInterval(1);
+    // Benchmarks run as fast as the GPU allows
+    glfwSwapInterval(runOptions.benchmark || runOptions.validateFrames > 0 ? 0 : 1);
 
     // register callbacks
     glfwSetKeyCallback(window, key_callback);
@@ -517,10 +970,64 @@ void setupOpenGL() {
     CSCI441::OpenGLUtils::printOpenGLInfo();
 }
 
+// Returns the largest one dimensional work group the device can run
+GLuint maxWorkGroupSize() {
+    GLint maxSize = 0, maxInvocations = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxSize);
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+    return (GLuint) std::min(maxSize, maxInvocations);
+}
+
+// (Re)compiles a particle kernel with WORK_GROUP_SIZE set to its entry in workGroupSizes
+// The FluidDynamics block and SSBOs are bound by the shaders' layout qualifiers, only plain uniforms are looked up
+void compileFluidKernel(GLuint kernel) {
+    GLuint limit = maxWorkGroupSize();
+    if (workGroupSizes[kernel] > limit) {
+        printf("[INFO]: Work group size %u of %s is larger than the device allows, using %u\n",
+               workGroupSizes[kernel], fluidKernels[kernel].name, limit);
+        workGroupSizes[kernel] = limit;
+    }
+
+    // The obstacle's SDF buffer is only bound when it was built, predict.c.glsl collides with it then
+    char defines[96];
+    snprintf(defines, sizeof(defines), "#define WORK_GROUP_SIZE %u\n#define SDF_COLLISION %d", workGroupSizes[kernel],
+             SDF);
+    CSCI444::ShaderProgram::setShaderDefines(defines);
+    const char *filenames[] = {fluidKernels[kernel].filename};
+    delete *fluidKernels[kernel].program;
+    *fluidKernels[kernel].program = new CSCI444::ShaderProgram(filenames, GL_COMPUTE_SHADER_BIT);
+    CSCI444::ShaderProgram::setShaderDefines("");
+
+    if (kernel == KERNEL_GRID_COUNT) {
+        gridUniformLocs.epoch = gridCountProgram->getUniformLocation("gridEpoch");
+    } else if (kernel == KERNEL_NEIGHBOR_FIND) {
+        neighborUniformLocs.pass = neighborFindProgram->getUniformLocation("neighborPass");
+    } else if (kernel == KERNEL_SOLVER) {
+        solverUniformLocs.pass = solverProgram->getUniformLocation("solverPass");
+    } else if (kernel == KERNEL_SOLVER_COLORED) {
+        coloredUniformLocs.pass = solverColoredProgram->getUniformLocation("coloredPass");
+        coloredUniformLocs.colorOffset = solverColoredProgram->getUniformLocation("colorOffset");
+        coloredUniformLocs.colorStride = solverColoredProgram->getUniformLocation("colorStride");
+        coloredUniformLocs.epsilon = solverColoredProgram->getUniformLocation("coloredEpsilon");
+    } else if (kernel == KERNEL_REORDER) {
+        reorderUniformLocs.pass = reorderProgram->getUniformLocation("reorderPass");
+        reorderUniformLocs.epoch = reorderProgram->getUniformLocation("reorderEpoch");
+    }
+}
+
+// Work groups needed to cover every particle, the shaders skip the invocations past the end
+GLuint workGroupCount(GLuint kernel) {
+    return (numParticles + workGroupSizes[kernel] - 1) / workGroupSizes[kernel];
+}
+
 // load our shaders and get locations for uniforms and attributes
 void setupShaders() {
     // Set Programs to be seperable
     CSCI444::ShaderProgram::enableSeparablePrograms();
+    // Reuse the programs linked by earlier runs
+    if (runOptions.shaderCache != NULL) {
+        CSCI444::ShaderProgram::enableProgramBinaryCache(runOptions.shaderCache);
+    }
 
     // Load our shader programs
     const char *phongShaderFilenames[] = {"shaders/phong.v.glsl", "shaders/phong.f.glsl"};
@@ -528,20 +1035,16 @@ void setupShaders() {
     const char *particleShaderFilenames[] = {"shaders/particle.v.glsl", "shaders/particle.f.glsl"};
     particleProgram = new CSCI444::ShaderProgram(particleShaderFilenames,
                                                  GL_VERTEX_SHADER_BIT | GL_FRAGMENT_SHADER_BIT);
-    const char *hashShaderFilenames[] = {"shaders/fluidShaders/spacialHash.v.glsl"};
-    spacialHashProgram = new CSCI444::ShaderProgram(hashShaderFilenames, GL_VERTEX_SHADER_BIT);
-    const char *neighborFindFilenames[] = {"shaders/fluidShaders/neighborFind.c.glsl"};
-    neighborFindProgram = new CSCI444::ShaderProgram(neighborFindFilenames, GL_COMPUTE_SHADER_BIT);
-    const char *lambdaFilenames[] = {"shaders/fluidShaders/lambda.c.glsl"};
-    lambdaProgram = new CSCI444::ShaderProgram(lambdaFilenames, GL_COMPUTE_SHADER_BIT);
-    const char *deltaPFilenames[] = {"shaders/fluidShaders/deltaP.c.glsl"};
-    deltaPProgram = new CSCI444::ShaderProgram(deltaPFilenames, GL_COMPUTE_SHADER_BIT);
-    const char *applyDeltaPFilenames[] = {"shaders/fluidShaders/applyDeltaP.c.glsl"};
-    applyDeltaPProgram = new CSCI444::ShaderProgram(applyDeltaPFilenames, GL_COMPUTE_SHADER_BIT);
-    const char *vorticityFilenames[] = {"shaders/fluidShaders/vorticity.c.glsl"};
-    vorticityProgram = new CSCI444::ShaderProgram(vorticityFilenames, GL_COMPUTE_SHADER_BIT);
-    const char *xsphFilenames[] = {"shaders/fluidShaders/xsph.c.glsl"};
-    xsphProgram = new CSCI444::ShaderProgram(xsphFilenames, GL_COMPUTE_SHADER_BIT);
+    for (GLuint kernel = 0; kernel < NUM_FLUID_KERNELS; kernel++) {
+        compileFluidKernel(kernel);
+    }
+    const char *neighborRebuildFilenames[] = {"shaders/fluidShaders/neighborRebuild.c.glsl"};
+    neighborRebuildProgram = new CSCI444::ShaderProgram(neighborRebuildFilenames, GL_COMPUTE_SHADER_BIT);
+    const char *prefixSumFilenames[] = {"shaders/fluidShaders/prefixSum.c.glsl"};
+    prefixSumProgram = new CSCI444::ShaderProgram(prefixSumFilenames, GL_COMPUTE_SHADER_BIT);
+    scanUniformLocs.count = prefixSumProgram->getUniformLocation("scanCount");
+    scanUniformLocs.pass = prefixSumProgram->getUniformLocation("scanPass");
+    scanUniformLocs.epoch = prefixSumProgram->getUniformLocation("scanEpoch");
 
     const char *sdfVisFilenames[] = {"shaders/visSDF.v.glsl", "shaders/visSDF.f.glsl"};
     sdfVisProgram = new CSCI444::ShaderProgram(sdfVisFilenames, GL_VERTEX_SHADER_BIT | GL_FRAGMENT_SHADER_BIT);
@@ -566,42 +1069,14 @@ void setupPipelines() {
 
 void setupParticleData() {
     // randomly initialize particle data
-    for (GLuint i = 0; i < NUM_PARTICLES; i++) {
-        particleData.position[i].x = ((rand() % 10000) / 1250.0) - 4.0;
-        particleData.position[i].y = ((rand() % 10000) / 1250.0) - 0.0;
-        particleData.position[i].z = ((rand() % 10000) / 1250.0) - 4.0;
-        particleData.velocity[i].x = 0.0;
-        particleData.velocity[i].y = 0.0;
-        particleData.velocity[i].z = 0.0;
-        particleData.color[i].x = 0.0;
-        particleData.color[i].y = 0.0;
-        particleData.color[i].z = 1.0;
-        particleData.color[i].w = 1.0;
-        particleData.idx[i] = i;
-    }
-
-    // setup hash map
-    for (auto &i : hashMap) {
-        i = {0xffffffff};
-    }
-    // set up hash clearer
-    for (auto &i : hashClear) {
-        i = {0xffffffff};
-    }
-    // setup linked list data
-    for (auto &i : linkedList) {
-        i = {0xffffffff, 0xffffffff};
-    }
-    // setup list clearer
-    for (auto &i : listClear) {
-        i = {0xffffffff, 0xffffffff};
-    }
-    // setup neighbor data
-    for (auto &i : neighborData) {
-        for (unsigned int &j : i.neighboring) {
-            j = 0xffffffff;
-        }
-        i.count = 0;
+    particleData.resize(numParticles);
+    srand(runOptions.seed);
+    for (GLuint i = 0; i < numParticles; i++) {
+        particleData.position().x()[i] = ((rand() % 10000) / 1250.0) - 4.0;
+        particleData.position().y()[i] = ((rand() % 10000) / 1250.0) - 0.0;
+        particleData.position().z()[i] = ((rand() % 10000) / 1250.0) - 4.0;
+        particleData.velocity().set(i, glm::vec3(0.0));
+        particleData.color().set(i, glm::vec3(0.0, 0.0, 1.0));
     }
 }
 
@@ -620,23 +1095,25 @@ void setupUBOs() {
     const GLchar *lightNames[] = {"Light.diffuse", "Light.specular", "Light.ambient", "Light.position"};
     const GLchar *materialNames[] = {"Material.diffuse", "Material.specular", "Material.shininess", "Material.ambient"};
     const GLchar *fluidNames[] = {"FluidDynamics.maxParticles", "FluidDynamics.mapSize", "FluidDynamics.supportRadius",
-                                  "FluidDynamics.dt", "FluidDynamics.maxNeighbors", "FluidDynamics.solverIters",
+                                  "FluidDynamics.dt", "FluidDynamics.neighborCapacity", "FluidDynamics.solverIters",
                                   "FluidDynamics.restDensity", "FluidDynamics.epsilon",
                                   "FluidDynamics.collisionEpsilon", "FluidDynamics.kpoly", "FluidDynamics.kspiky",
                                   "FluidDynamics.scorr", "FluidDynamics.dcorr", "FluidDynamics.pcorr",
-                                  "FluidDynamics.kxsph", "FluidDynamics.vortEpsilon", "FluidDynamics.time"};
+                                  "FluidDynamics.kxsph", "FluidDynamics.vortEpsilon", "FluidDynamics.time",
+                                  "FluidDynamics.particleStride", "FluidDynamics.gridMin", "FluidDynamics.cellSize",
+                                  "FluidDynamics.gridDims", "FluidDynamics.numCells", "FluidDynamics.neighborSkin"};
 
     // get block offsets
     matriciesUniformBuffer.offsets = phongProgram->getUniformBlockOffsets("Matricies", matrixNames);
     lightUniformBuffer.offsets = phongProgram->getUniformBlockOffsets("Light", lightNames);
     materialUniformBuffer.offsets = phongProgram->getUniformBlockOffsets("Material", materialNames);
-    fluidUniformBuffer.offsets = spacialHashProgram->getUniformBlockOffsets("FluidDynamics", fluidNames);
+    fluidUniformBuffer.offsets = gridCountProgram->getUniformBlockOffsets("FluidDynamics", fluidNames);
 
     // get block size
     matriciesUniformBuffer.blockSize = phongProgram->getUniformBlockSize("Matricies");
     lightUniformBuffer.blockSize = phongProgram->getUniformBlockSize("Light");
     materialUniformBuffer.blockSize = phongProgram->getUniformBlockSize("Material");
-    fluidUniformBuffer.blockSize = spacialHashProgram->getUniformBlockSize("FluidDynamics");
+    fluidUniformBuffer.blockSize = gridCountProgram->getUniformBlockSize("FluidDynamics");
 
     // Create UBO buffers and bind
     // Matrix Buffer
@@ -684,12 +1161,12 @@ void setupUBOs() {
     glBindBuffer(GL_UNIFORM_BUFFER, fluidUniformBuffer.handle);
     glBufferData(GL_UNIFORM_BUFFER, fluidUniformBuffer.blockSize, NULL, GL_DYNAMIC_DRAW);
     glBindBufferBase(GL_UNIFORM_BUFFER, fluidUniformBuffer.blockBinding, fluidUniformBuffer.handle);
-    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[0], sizeof(GLuint), &NUM_PARTICLES);
-    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[1], sizeof(GLuint), &HASH_MAP_SIZE);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[0], sizeof(GLuint), &numParticles);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[1], sizeof(GLuint), &hashMapSize);
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[2], sizeof(GLfloat), &supportRad);
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[3], sizeof(GLfloat), &MAX_DELTA_T);
-    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[4], sizeof(GLuint), &MAX_NEIGHBORS);
-    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[5], sizeof(GLuint), &SOLVER_ITERS);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[4], sizeof(GLuint), &neighborCapacity);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[5], sizeof(GLuint), &solverIters);
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[6], sizeof(GLfloat), &restDensity);
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[7], sizeof(GLfloat), &epsilon);
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[8], sizeof(GLfloat), &COLLISION_EPSILON);
@@ -701,16 +1178,26 @@ void setupUBOs() {
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[14], sizeof(GLfloat), &KXSPH);
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[15], sizeof(GLfloat), &VORT_EPSILON);
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[16], sizeof(GLfloat), &simTime);
-    glUniformBlockBinding(spacialHashProgram->getShaderProgramHandle(),
-                          spacialHashProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
+    GLuint particleStride = particleData.stride();
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[17], sizeof(GLuint), &particleStride);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[18], sizeof(float) * 3, &(GRID_MIN)[0]);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[19], sizeof(GLfloat), &CELL_SIZE);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[20], sizeof(GLuint) * 3, GRID_DIMS);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[21], sizeof(GLuint), &NUM_CELLS);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[22], sizeof(GLfloat), &runOptions.neighborSkin);
+    glUniformBlockBinding(predictProgram->getShaderProgramHandle(),
+                          predictProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
+    glUniformBlockBinding(neighborRebuildProgram->getShaderProgramHandle(),
+                          neighborRebuildProgram->getUniformBlockIndex("FluidDynamics"),
+                          fluidUniformBuffer.blockBinding);
+    glUniformBlockBinding(gridCountProgram->getShaderProgramHandle(),
+                          gridCountProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
+    glUniformBlockBinding(gridScatterProgram->getShaderProgramHandle(),
+                          gridScatterProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
     glUniformBlockBinding(neighborFindProgram->getShaderProgramHandle(),
                           neighborFindProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
-    glUniformBlockBinding(lambdaProgram->getShaderProgramHandle(),
-                          lambdaProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
-    glUniformBlockBinding(deltaPProgram->getShaderProgramHandle(),
-                          deltaPProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
-    glUniformBlockBinding(applyDeltaPProgram->getShaderProgramHandle(),
-                          applyDeltaPProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
+    glUniformBlockBinding(solverProgram->getShaderProgramHandle(),
+                          solverProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
     glUniformBlockBinding(vorticityProgram->getShaderProgramHandle(),
                           vorticityProgram->getUniformBlockIndex("FluidDynamics"), fluidUniformBuffer.blockBinding);
     glUniformBlockBinding(xsphProgram->getShaderProgramHandle(),
@@ -720,203 +1207,249 @@ void setupUBOs() {
     //------------ END UBOS ----------
 }
 
-void setupSSBOs() {
-    //------------ START SSBOs --------
-    /// Index SSBO
-    // generate, bind, and buffer data
-    glGenBuffers(1, &particleSSBOs.index);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.index);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.index, particleSSBOs.index);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * NUM_PARTICLES, NULL, GL_DYNAMIC_DRAW);
-    GLint bufMask = GL_MAP_WRITE_BIT;
-    GLuint *indices = (GLuint *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * NUM_PARTICLES, bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        indices[i] = particleData.idx[i];
+// Writes the full size of every neighbor search dispatch, they follow the work group sizes of the kernels
+void writeNeighborDispatchSizes() {
+    GLuint fullDispatches[NUM_NEIGHBOR_DISPATCHES][4] = {};
+    fullDispatches[DISPATCH_GRID_COUNT][0] = workGroupCount(KERNEL_GRID_COUNT);
+    fullDispatches[DISPATCH_GRID_SCATTER][0] = workGroupCount(KERNEL_GRID_SCATTER);
+    fullDispatches[DISPATCH_NEIGHBOR_FIND][0] = workGroupCount(KERNEL_NEIGHBOR_FIND);
+    fullDispatches[DISPATCH_CELL_SCAN][0] = (NUM_CELLS + SCAN_BLOCK_SIZE) / SCAN_BLOCK_SIZE;
+    fullDispatches[DISPATCH_NEIGHBOR_SCAN][0] = (numParticles + SCAN_BLOCK_SIZE) / SCAN_BLOCK_SIZE;
+    fullDispatches[DISPATCH_SINGLE][0] = 1;
+    for (GLuint i = 0; i < NUM_NEIGHBOR_DISPATCHES; i++) {
+        fullDispatches[i][1] = 1;
+        fullDispatches[i][2] = 1;
     }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    scheduler.pass("dispatchSizes").updates(neighborSSBOs.neighborDispatch).submit();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborDispatch);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(fullDispatches), sizeof(fullDispatches), fullDispatches);
+}
 
-    /// Position SSBO
-    // generate, bind, and buffer data
-    glGenBuffers(1, &particleSSBOs.position);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.position);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.position, particleSSBOs.position);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * NUM_PARTICLES, NULL, GL_DYNAMIC_DRAW);
-    Float4 *positions = (Float4 *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 4 * sizeof(float) * NUM_PARTICLES,
-                                                    bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        positions[i].x = particleData.position[i].x;
-        positions[i].y = particleData.position[i].y;
-        positions[i].z = particleData.position[i].z;
-        positions[i].w = particleData.position[i].w;
+// Particle ids in their initial slots
+std::vector<GLuint> identityIds() {
+    std::vector<GLuint> ids(numParticles);
+    for (GLuint i = 0; i < numParticles; i++) {
+        ids[i] = i;
     }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    return ids;
+}
 
-    /// Updated Position SSBO
-    // generate, bind, and buffer data
-    glGenBuffers(1, &particleSSBOs.newPosition);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.newPosition);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.newPosition, particleSSBOs.newPosition);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * NUM_PARTICLES, NULL, GL_DYNAMIC_DRAW);
-    Float4 *newPositions = (Float4 *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 4 * sizeof(float) * NUM_PARTICLES,
-                                                       bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        newPositions[i].x = particleData.position[i].x;
-        newPositions[i].y = particleData.position[i].y;
-        newPositions[i].z = particleData.position[i].z;
-        newPositions[i].w = 1.0;
+// Spreads the low 10 bits of v out to every third bit
+GLuint64 spreadBits(GLuint v) {
+    GLuint64 x = v & 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// Position of every grid cell along the Morton (Z-order) curve through the grid
+std::vector<GLuint> mortonCellRanks() {
+    std::vector<std::pair<GLuint64, GLuint> > codes(NUM_CELLS);
+    for (GLuint z = 0; z < GRID_DIMS[2]; z++) {
+        for (GLuint y = 0; y < GRID_DIMS[1]; y++) {
+            for (GLuint x = 0; x < GRID_DIMS[0]; x++) {
+                GLuint cell = x + GRID_DIMS[0] * (y + GRID_DIMS[1] * z);
+                codes[cell] = std::make_pair(spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2), cell);
+            }
+        }
     }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    std::sort(codes.begin(), codes.end());
 
-    /// Velocity SSBO
-    // generate, bind, and buffer data
-    glGenBuffers(1, &particleSSBOs.velocity);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.velocity);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.velocity, particleSSBOs.velocity);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * NUM_PARTICLES, NULL, GL_DYNAMIC_DRAW);
-    Float4 *vels = (Float4 *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 4 * sizeof(float) * NUM_PARTICLES, bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        vels[i].x = particleData.velocity[i].x;
-        vels[i].y = particleData.velocity[i].y;
-        vels[i].z = particleData.velocity[i].z;
-        vels[i].w = 1.0;
+    std::vector<GLuint> ranks(NUM_CELLS);
+    for (GLuint rank = 0; rank < NUM_CELLS; rank++) {
+        ranks[codes[rank].second] = rank;
     }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    return ranks;
+}
+
+void setupSSBOs() {
+    //------------ START SSBOs --------
+    GLint bufMask = GL_MAP_WRITE_BIT;
+    /// Position SSBOs (position, updated position and solved position)
+    // generate, bind, and buffer data
+    const GLuint positionBindings[NUM_POSITION_SLOTS] = {fluidSSBOLocs.position, fluidSSBOLocs.newPosition,
+                                                         fluidSSBOLocs.solvedPosition};
+    particleSSBOs.positions.create(positionBindings, NUM_POSITION_SLOTS, particleData.position().bytes(),
+                                   particleData.position().data());
 
-    /// New Velocity SSBO
+    /// Velocity SSBOs (velocity and new velocity)
     // generate, bind, and buffer data
-    glGenBuffers(1, &particleSSBOs.newVelocity);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.newVelocity);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.newVelocity, particleSSBOs.newVelocity);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * NUM_PARTICLES, NULL, GL_DYNAMIC_DRAW);
-    Float4 *newVels = (Float4 *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 4 * sizeof(float) * NUM_PARTICLES,
-                                                  bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        newVels[i].x = particleData.velocity[i].x;
-        newVels[i].y = particleData.velocity[i].y;
-        newVels[i].z = particleData.velocity[i].z;
-        newVels[i].w = 1.0;
-    }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    const GLuint velocityBindings[NUM_VELOCITY_SLOTS] = {fluidSSBOLocs.velocity, fluidSSBOLocs.newVelocity};
+    particleSSBOs.velocities.create(velocityBindings, NUM_VELOCITY_SLOTS, particleData.velocity().bytes(),
+                                    particleData.velocity().data());
 
     /// Lamda SSBO
     // generate, bind, and buffer data
     glGenBuffers(1, &particleSSBOs.lambda);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.lambda);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.lambda, particleSSBOs.lambda);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * NUM_PARTICLES, NULL, GL_DYNAMIC_DRAW);
-    auto lambdas = (float *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float) * NUM_PARTICLES, bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++) {
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * numParticles, NULL, GL_DYNAMIC_DRAW);
+    auto lambdas = (float *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float) * numParticles, bufMask);
+    for (int i = 0; i < numParticles; i++) {
         lambdas[i] = 0.0f;
     }
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 
-    /// DeltaP SSBO
-    // generate, bind, and buffer data
-    glGenBuffers(1, &particleSSBOs.deltaP);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.deltaP);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.deltaP, particleSSBOs.deltaP);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * NUM_PARTICLES, NULL, GL_DYNAMIC_DRAW);
-    auto deltaPs = (Float4 *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 4 * sizeof(float) * NUM_PARTICLES, bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        deltaPs[i].x = 0.0f;
-        deltaPs[i].y = 0.0f;
-        deltaPs[i].z = 0.0f;
-        deltaPs[i].w = 0.0f;
-    }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
     /// Color SSBO
     // generate, bind, and buffer data
     glGenBuffers(1, &particleSSBOs.color);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.color);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.color, particleSSBOs.color);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * NUM_PARTICLES, NULL, GL_DYNAMIC_DRAW);
-    Float4 *colors = (Float4 *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 4 * sizeof(float) * NUM_PARTICLES,
-                                                 bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        colors[i].x = particleData.color[i].x;
-        colors[i].y = particleData.color[i].y;
-        colors[i].z = particleData.color[i].z;
-        colors[i].w = 1.0;
-    }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, particleData.color().bytes(), particleData.color().data(), GL_DYNAMIC_DRAW);
+
+    /// Cell Count SSBO
+    // generate, bind, and buffer data
+    // Epoch tagged, starts out zero (epoch 0) and is only cleared again when the epoch wraps
+    glGenBuffers(1, &neighborSSBOs.cellCounts);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.cellCounts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.cellCounts, neighborSSBOs.cellCounts);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * NUM_CELLS, NULL, GL_DYNAMIC_DRAW);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+    /// Cell Start SSBO
+    // generate, bind, and buffer data
+    // Exclusive prefix sum of the cell counts, cell c holds sorted particles [cellStart[c], cellStart[c + 1])
+    glGenBuffers(1, &neighborSSBOs.cellStart);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.cellStart);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.cellStart, neighborSSBOs.cellStart);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (NUM_CELLS + 1), NULL, GL_DYNAMIC_DRAW);
+
+    /// Sorted Index SSBO
+    // generate, bind, and buffer data
+    glGenBuffers(1, &neighborSSBOs.sortedIndices);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.sortedIndices);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.sortedIndices, neighborSSBOs.sortedIndices);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * numParticles, NULL, GL_DYNAMIC_DRAW);
+
+    /// Particle Rank SSBO
+    // generate, bind, and buffer data
+    // Inverse of sortedIndices, lets the solver find the neighbors staged in its work group
+    glGenBuffers(1, &neighborSSBOs.particleRanks);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.particleRanks);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.particleRanks, neighborSSBOs.particleRanks);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * numParticles, NULL, GL_DYNAMIC_DRAW);
+
+    /// Particle Id SSBOs (id and new id)
+    // generate, bind, and buffer data
+    const GLuint idBindings[NUM_ID_SLOTS] = {fluidSSBOLocs.particleIds, fluidSSBOLocs.newParticleIds};
+    std::vector<GLuint> ids = identityIds();
+    particleSSBOs.ids.create(idBindings, NUM_ID_SLOTS, sizeof(GLuint) * numParticles, &ids[0]);
+
+    /// Cell Rank SSBO
+    // generate, bind, and buffer data
+    std::vector<GLuint> ranks = mortonCellRanks();
+    glGenBuffers(1, &neighborSSBOs.cellRanks);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.cellRanks);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.cellRanks, neighborSSBOs.cellRanks);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * NUM_CELLS, &ranks[0], GL_STATIC_DRAW);
+
+    /// Particle Cell SSBO
+    // generate, bind, and buffer data
+    glGenBuffers(1, &neighborSSBOs.particleCells);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.particleCells);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.particleCells, neighborSSBOs.particleCells);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint) * numParticles, NULL, GL_DYNAMIC_DRAW);
 
-    /// Hash SSBO
+    /// Sorted Position SSBO
     // generate, bind, and buffer data
-    glGenBuffers(1, &neighborSSBOs.hashMap);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.hashMap);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.hashMap, neighborSSBOs.hashMap);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(HashType) * HASH_MAP_SIZE, NULL, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &neighborSSBOs.sortedPositions);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.sortedPositions);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.sortedPositions, neighborSSBOs.sortedPositions);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, particleData.position().bytes(), NULL, GL_DYNAMIC_DRAW);
 
-    /// HashClear SSBO
+    /// Scan Block Sum SSBO
     // generate, bind, and buffer data
-    glGenBuffers(1, &neighborSSBOs.hashClear);
-    glBindBuffer(GL_COPY_READ_BUFFER, neighborSSBOs.hashClear);
-    glBufferData(GL_COPY_READ_BUFFER, sizeof(HashType) * HASH_MAP_SIZE, hashClear, GL_STATIC_COPY);
+    // One sum per scanned block of the largest scan
+    GLuint scanBlocks = (std::max(NUM_CELLS, numParticles) + SCAN_BLOCK_SIZE) / SCAN_BLOCK_SIZE;
+    glGenBuffers(1, &neighborSSBOs.scanBlockSums);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.scanBlockSums);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.scanBlockSums, neighborSSBOs.scanBlockSums);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * scanBlocks, NULL, GL_DYNAMIC_DRAW);
+
+    /// Neighbor List SSBO
+    // generate, bind, and buffer data
+    // Every particle's neighbors packed back to back, grown by checkNeighborStats when they do not fit
+    GLint64 maxBlockSize = 0;
+    glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+    maxNeighborCapacity = (GLuint) std::min<GLint64>(maxBlockSize / sizeof(GLuint), 0xffffffffu);
+    if (neighborCapacity > maxNeighborCapacity) {
+        printf("[INFO]: Neighbor list of %u entries is larger than a storage block, using %u\n", neighborCapacity,
+               maxNeighborCapacity);
+        neighborCapacity = maxNeighborCapacity;
+        glBindBuffer(GL_UNIFORM_BUFFER, fluidUniformBuffer.handle);
+        glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[4], sizeof(GLuint), &neighborCapacity);
+    }
+    glGenBuffers(1, &neighborSSBOs.neighborList);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborList);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.neighborList, neighborSSBOs.neighborList);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * neighborCapacity, NULL, GL_DYNAMIC_DRAW);
 
-    /// Linked List SSBO
+    /// Neighbor Count SSBO
     // generate, bind, and buffer data
-    glGenBuffers(1, &neighborSSBOs.linkedList);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.linkedList);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.linkedList, neighborSSBOs.linkedList);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(NodeType) * NUM_PARTICLES, listClear, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &neighborSSBOs.neighborCounts);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborCounts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.neighborCounts, neighborSSBOs.neighborCounts);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * numParticles, NULL, GL_DYNAMIC_DRAW);
 
-    /// ListClear SSBO
+    /// Neighbor Offset SSBO
     // generate, bind, and buffer data
-    glGenBuffers(1, &neighborSSBOs.listClear);
-    glBindBuffer(GL_COPY_READ_BUFFER, neighborSSBOs.listClear);
-    glBufferData(GL_COPY_READ_BUFFER, sizeof(NodeType) * NUM_PARTICLES, listClear, GL_STATIC_COPY);
+    // Exclusive prefix sum of the neighbor counts, the last entry is the total
+    glGenBuffers(1, &neighborSSBOs.neighborOffsets);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborOffsets);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.neighborOffsets, neighborSSBOs.neighborOffsets);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (numParticles + 1), NULL, GL_DYNAMIC_DRAW);
 
-    /// Neighbor Data SSBO
+    /// Neighbor Stats SSBO
+    // generate, bind, and buffer data
+    // Starts with an infinite displacement so the first step builds the lists
+    NeighborStats initialStats = neighborStats;
+    initialStats.maxDisplacement2 = INFINITY;
+    glGenBuffers(1, &neighborSSBOs.neighborStats);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborStats);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.neighborStats, neighborSSBOs.neighborStats);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(NeighborStats), &initialStats, GL_DYNAMIC_DRAW);
+
+    // Host readable copy of the stats so reading them never waits on the simulation in flight
+    glGenBuffers(1, &neighborSSBOs.neighborStatsReadback);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, neighborSSBOs.neighborStatsReadback);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(NeighborStats), NULL, GL_STREAM_READ);
+
+    /// Build Position SSBO
     // generate, bind, and buffer data
-    glGenBuffers(1, &neighborSSBOs.neighborData);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborData);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.neighbors, neighborSSBOs.neighborData);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(NeighborType) * NUM_PARTICLES, neighborData, GL_DYNAMIC_DRAW);
-    /// Atomic SSBO
+    glGenBuffers(1, &neighborSSBOs.buildPositions);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.buildPositions);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.buildPositions, neighborSSBOs.buildPositions);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, particleData.position().bytes(), NULL, GL_DYNAMIC_DRAW);
+
+    /// Neighbor Dispatch SSBO
     // generate, bind, and buffer data
-    glGenBuffers(1, &neighborSSBOs.counter);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, neighborSSBOs.counter);
-    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, fluidSSBOLocs.counter, neighborSSBOs.counter);
-    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+    // The first half is dispatched, the second half holds the full sizes neighborRebuild.c.glsl copies from
+    GLuint neighborDispatches[2 * NUM_NEIGHBOR_DISPATCHES][4] = {};
+    glGenBuffers(1, &neighborSSBOs.neighborDispatch);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborDispatch);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.neighborDispatch, neighborSSBOs.neighborDispatch);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(neighborDispatches), neighborDispatches, GL_DYNAMIC_DRAW);
+    writeNeighborDispatchSizes();
     //------------ END SSBOs --------
 }
 
+// Points the bound sphere VAO's model offsets at the current position buffer, which changes every step
+void pointSphereOffsets() {
+    glBindBuffer(GL_ARRAY_BUFFER, particleSSBOs.positions.buffer(POSITION_CURRENT));
+    for (int c = 0; c < 3; c++) {
+        glVertexAttribPointer(sphereAttribLocs.modelOffset[c], 1, GL_FLOAT, GL_FALSE, sizeof(float),
+                              (void *) (sizeof(float) * c * particleData.stride()));
+    }
+}
+
 void setupVAOs() {
     // generate our vertex array object descriptors
-    glGenVertexArrays(4, vaods);
+    glGenVertexArrays(3, vaods);
     // will be used to store VBO descriptors for ARRAY_BUFFER and ELEMENT_ARRAY_BUFFER
     GLuint vbods[2];
 
-    //------------ BEGIN PARTICLE VAO ------------
-    // generate our vertex buffer object descriptors for the GROUND
-    glBindVertexArray(vaods[PARTICLES]);
-    // bind the VBO to our particle position ssbo
-    glBindBuffer(GL_ARRAY_BUFFER, particleSSBOs.position);
-    // enable our position attribute
-    glEnableVertexAttribArray(particleShaderAttribLocs.position);
-    // map the position attribute to data within our buffer
-    glVertexAttribPointer(particleShaderAttribLocs.position, 4, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-    // bind the VBO to our particle color ssbo
-    glBindBuffer(GL_ARRAY_BUFFER, particleSSBOs.color);
-    // enable our color attribute
-    glEnableVertexAttribArray(particleShaderAttribLocs.color);
-    // map the color attribute to data within our buffer
-    glVertexAttribPointer(particleShaderAttribLocs.color, 4, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-    // bind the VBO to our particle velocity ssbo
-    glBindBuffer(GL_ARRAY_BUFFER, particleSSBOs.velocity);
-    // enable our velocity attribute
-    glEnableVertexAttribArray(particleShaderAttribLocs.velocity);
-    // map the velocity attribute to data within our buffer
-    glVertexAttribPointer(particleShaderAttribLocs.velocity, 4, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-    // bind the VBO to our particle index ssbo
-    glBindBuffer(GL_ARRAY_BUFFER, particleSSBOs.index);
-    // enable our index attribute
-    glEnableVertexAttribArray(particleShaderAttribLocs.index);
-    // map the index attribute to data within our buffer
-    glVertexAttribIPointer(particleShaderAttribLocs.index, 1, GL_UNSIGNED_INT, 0, (void *) 0);
-    //------------  END  PARTICLE VAO------------
-
     //------------ BEGIN LIGHT VAO ------------
     // Draw Ground
     glBindVertexArray(vaods[LIGHT]);
@@ -1080,20 +1613,22 @@ void setupVAOs() {
     glVertexAttribPointer(sphereAttribLocs.normal, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, (void *) 0);
 
     // Color data
-    // Use the particle color for the model color
+    // Use the particle color for the model color, one attribute per color stream
     glBindBuffer(GL_ARRAY_BUFFER, particleSSBOs.color);
-    // enable vertex attribute
-    glEnableVertexAttribArray(sphereAttribLocs.color);
-    glVertexAttribPointer(sphereAttribLocs.color, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 4, (void *) 0);
-    glVertexAttribDivisor(sphereAttribLocs.color, 1);
+    for (int c = 0; c < 3; c++) {
+        glEnableVertexAttribArray(sphereAttribLocs.color[c]);
+        glVertexAttribPointer(sphereAttribLocs.color[c], 1, GL_FLOAT, GL_FALSE, sizeof(float),
+                              (void *) (sizeof(float) * c * particleData.stride()));
+        glVertexAttribDivisor(sphereAttribLocs.color[c], 1);
+    }
 
     // Position data
-    // Use the particle position vector for the model offset
-    glBindBuffer(GL_ARRAY_BUFFER, particleSSBOs.position);
-    // enable vertex attribute
-    glEnableVertexAttribArray(sphereAttribLocs.modelOffset);
-    glVertexAttribPointer(sphereAttribLocs.modelOffset, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 4, (void *) 0);
-    glVertexAttribDivisor(sphereAttribLocs.modelOffset, 1);
+    // Use the particle position vector for the model offset, one attribute per position stream
+    for (int c = 0; c < 3; c++) {
+        glEnableVertexAttribArray(sphereAttribLocs.modelOffset[c]);
+        glVertexAttribDivisor(sphereAttribLocs.modelOffset[c], 1);
+    }
+    pointSphereOffsets();
 
     // bind the VBO for our Sphere Element Array Buffer
     glGenBuffers(1, &sphereAttributes.vbodIndex);
@@ -1104,17 +1639,26 @@ void setupVAOs() {
 }
 
 void setupSDFs() {
+    if (runOptions.sdfCache != NULL) {
+        CSCI444::ModelLoaderSDF::enableSDFCache(runOptions.sdfCache);
+    }
+
     // Load model
     modelLoader = new CSCI444::ModelLoaderSDF(OBJECT.c_str());
 
     // Set data
     modelLoader->setSDFLocation(sdfSSBOLocs.sdf);
     modelLoader->setTriangleLocation(sdfSSBOLocs.triangles);
+    modelLoader->setBVHLocation(sdfSSBOLocs.bvh);
 
     // Calculate SDF
-    //modelLoader->calculateSignedDistanceFieldCPU(0.5, 1.0, glm::mat4(1.0));
     modelLoaderMtx = glm::translate(glm::mat4(1.0), glm::vec3(0.0, -3.1, 0.0));
-    modelLoader->calculateSignedDistanceField(sdfProgram, 0.1, 0.1, modelLoaderMtx);
+    if (runOptions.sdfCPU) {
+        modelLoader->calculateSignedDistanceFieldCPU(0.1, 0.1, modelLoaderMtx, runOptions.threads,
+                                                     runOptions.sdfBand);
+    } else {
+        modelLoader->calculateSignedDistanceField(sdfProgram, 0.1, 0.1, modelLoaderMtx);
+    }
 }
 
 // load in our model data to VAOs and VBOs
@@ -1210,94 +1754,56 @@ void setupFonts() {
     glVertexAttribPointer(textShaderAttribLocs.text_texCoord_location, 4, GL_FLOAT, GL_FALSE, 0, (void *) 0);
 }
 
-void debugSpacialHash() {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.hashMap);
+void debugGrid() {
+    scheduler.pass("debugGrid").reads(neighborSSBOs.cellStart, GL_BUFFER_UPDATE_BARRIER_BIT).submit();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.cellStart);
     GLint bufMask = GL_MAP_READ_BIT;
-    HashType *hash = (HashType *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(HashType) * HASH_MAP_SIZE,
-                                                   bufMask);
-    int h = 0;
-    for (int i = 0; i < HASH_MAP_SIZE; i++) {
-        hashMap[i] = hash[i];
-        if (hashMap[i].headNodeIndex != 0xffffffff)
-            h++;
-    }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-    printf("Hash Cells Used: %d\n", h);
-
-
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.linkedList);
-    NodeType *list = (NodeType *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(NodeType) * NUM_PARTICLES,
-                                                   bufMask);
-    int l = 0;
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        linkedList[i] = list[i];
-        if (linkedList[i].particleIndex > NUM_PARTICLES) {
-            l++;
-        }
-    }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-    printf("Invalid Particle Indices: %d\n", l);
-
-    int invalidCount = 0;
-    int maxNumHashCell = 0;
-    int maxCount = 0;
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        // Follow linked list, make sure list ends
-        int count = 0;
-        uint j = 0;
-        NodeType n = linkedList[i];
-        while (j < NUM_PARTICLES && count < NUM_PARTICLES) {
-            // Exit on null
-            if (n.nextNodeIndex == 0xffffffff) {
-                break;
-            } else {
-                // Or go to next node
-                j = n.nextNodeIndex;
-                n = linkedList[n.nextNodeIndex];
-            }
-            count++;
-        }
-
-        if (count > NUM_PARTICLES) {
-            // Count how many particles have too many neighbors
+    GLuint *cellStart = (GLuint *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * (NUM_CELLS + 1),
+                                                    bufMask);
+    int used = 0, invalidCount = 0;
+    GLuint maxNumCell = 0;
+    for (int i = 0; i < NUM_CELLS; i++) {
+        if (cellStart[i + 1] < cellStart[i]) {
+            // Cell ranges must never run backwards
             invalidCount++;
-        } else if (count > maxNumHashCell) {
-            // Find the maximum valid number of neighbors a particle has
-            maxNumHashCell = count;
-            // Reset the number of particles with that many neighbors
-            maxCount = 1;
-        } else if (count == maxNumHashCell) {
-            // Count how many particles have the maximum number of neighbors
-            maxCount++;
+            continue;
         }
-
+        GLuint count = cellStart[i + 1] - cellStart[i];
+        if (count > 0) used++;
+        if (count > maxNumCell) maxNumCell = count;
     }
-    printf("Infinite Loops Found In Linked List: %d\n", invalidCount);
-    printf("Max Number in Hash Cell (One Hash Cell): %d\n", maxNumHashCell);
-    printf("Max Number in Hash Cell Count (One Hash Cell): %d\n", maxCount);
+    printf("Grid Cells Used: %d of %u\n", used, NUM_CELLS);
+    printf("Invalid Cell Ranges: %d\n", invalidCount);
+    printf("Particles Sorted: %u of %u\n", cellStart[NUM_CELLS], numParticles);
+    printf("Max Number in Grid Cell (One Grid Cell): %u\n", maxNumCell);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 }
 
 void debugNeighborFind() {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborData);
+    scheduler.pass("debugNeighborFind").reads(neighborSSBOs.neighborOffsets, GL_BUFFER_UPDATE_BARRIER_BIT).submit();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborOffsets);
     GLint bufMask = GL_MAP_READ_BIT;
-    auto *neighborList = (NeighborType *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0,
-                                                           sizeof(NeighborType) * NUM_PARTICLES, bufMask);
-    int invalidCount = 0, maxCount = 0;
-    int maxNeighbors = 0;
-    for (int i = 0; i < NUM_PARTICLES; i++) {
-        if (neighborList[i].count > MAX_NEIGHBORS) {
+    auto *offsets = (GLuint *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * (numParticles + 1),
+                                                bufMask);
+    int invalidCount = 0;
+    GLuint maxNeighbors = 0;
+    for (int i = 0; i < numParticles; i++) {
+        if (offsets[i + 1] < offsets[i]) {
             invalidCount++;
-        } else if (neighborList[i].count == MAX_NEIGHBORS) {
-            maxCount++;
+            continue;
         }
-        if (neighborList[i].count > maxNeighbors) {
-            maxNeighbors = neighborList[i].count;
+        GLuint count = offsets[i + 1] - offsets[i];
+        if (count > maxNeighbors) {
+            maxNeighbors = count;
         }
     }
+    GLuint total = offsets[numParticles];
     glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-    printf("Invalid Neighbor Counts: %d\n", invalidCount);
-    printf("Actual Max Neighbor Counts: %d\n", maxCount);
-    printf("Max Number of Neighbors: %d\n\n", maxNeighbors);
+    printf("Invalid Neighbor Ranges: %d\n", invalidCount);
+    printf("Total Neighbors: %u of %u (%.1f per particle)\n", total, neighborCapacity,
+           (float) total / numParticles);
+    printf("Overflowed Neighbors: %u\n", total > neighborCapacity ? total - neighborCapacity : 0);
+    printf("Max Number of Neighbors: %u\n\n", maxNeighbors);
 }
 
 //*************************************************************************************
@@ -1348,8 +1854,114 @@ void render_text(const char *text, FT_Face face, float x, float y, float sx, flo
 }
 
 
-void fluidUpdate() {
-    /***** TIME AND TIMESTAMP *****/
+// Dispatches one of the neighbor search stages with the size neighborRebuild.c.glsl chose
+void dispatchNeighborStage(GLuint dispatch) {
+    glDispatchComputeIndirect((GLintptr) (sizeof(GLuint) * 4 * dispatch));
+}
+
+// Exclusive prefix sum of count uints in input, output must hold count + 1 uints and receives the total last
+// When blocksDispatch is a neighbor dispatch the scan only runs when that stage does
+// A nonzero epoch scans epoch tagged cell counts, counts of other epochs are summed as zero
+void prefixSum(GLuint input, GLuint output, GLuint count, GLint blocksDispatch = -1, GLuint epoch = 0) {
+    GLuint numBlocks = (count + SCAN_BLOCK_SIZE) / SCAN_BLOCK_SIZE;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.scanInput, input);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.scanOutput, output);
+
+    prefixSumProgram->useProgram();
+    glUniform1ui(scanUniformLocs.count, count);
+    glUniform1ui(scanUniformLocs.epoch, epoch);
+    for (GLuint pass = 0; pass < 3; pass++) {
+        // Scan each block, scan the block sums, then add the block sums back
+        glUniform1ui(scanUniformLocs.pass, pass);
+        scheduler.pass("prefixSum").reads(input).reads(output).reads(neighborSSBOs.scanBlockSums)
+                .writes(output).writes(neighborSSBOs.scanBlockSums);
+        if (blocksDispatch >= 0) {
+            scheduler.reads(neighborSSBOs.neighborDispatch, GL_COMMAND_BARRIER_BIT);
+        }
+        scheduler.submit();
+        if (blocksDispatch >= 0) {
+            dispatchNeighborStage(pass == 1 ? DISPATCH_SINGLE : (GLuint) blocksDispatch);
+        } else {
+            glDispatchCompute(pass == 1 ? 1 : numBlocks, 1, 1);
+        }
+    }
+}
+
+// Fences the frame just submitted and waits on the one framesInFlight frames back, so the CPU records the next
+// frame while the GPU still runs this one without queueing an unbounded number of frames.  With one frame in flight
+// every frame waits for itself, like the forced map at the end of fluidUpdate() used to
+void throttleFrames() {
+    GLsync &fence = frameFences[frameFenceIndex];
+    if (fence != NULL) {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fence);
+    }
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frameFenceIndex = (frameFenceIndex + 1) % framesInFlight;
+}
+
+// Waits for every frame in flight, framesInFlight may change afterwards
+void drainFrames() {
+    for (GLsync &fence : frameFences) {
+        if (fence != NULL) {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(fence);
+            fence = NULL;
+        }
+    }
+    frameFenceIndex = 0;
+}
+
+// Makes the next step rebuild the neighbor lists no matter how far the particles moved
+void forceNeighborRebuild() {
+    const GLfloat displacement = INFINITY;
+    scheduler.pass("forceRebuild").updates(neighborSSBOs.neighborStats).submit();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborStats);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(NeighborStats, maxDisplacement2), sizeof(GLfloat),
+                    &displacement);
+}
+
+// Reads the neighbor statistics of an earlier step once the GPU has finished it and grows the
+// neighbor list when it overflowed, particles past the end of the list lost neighbors for that step
+void checkNeighborStats() {
+    if (neighborStatsFence == NULL ||
+        glClientWaitSync(neighborStatsFence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        return;
+    }
+    glDeleteSync(neighborStatsFence);
+    neighborStatsFence = NULL;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, neighborSSBOs.neighborStatsReadback);
+    glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(NeighborStats), &neighborStats);
+
+    if (neighborStats.overflow > 0 && neighborCapacity < maxNeighborCapacity) {
+        // Leave headroom so a slowly compressing fluid does not overflow every step
+        GLuint newCapacity = (GLuint) std::min<GLuint64>((GLuint64) neighborStats.totalNeighbors * 5 / 4,
+                                                         maxNeighborCapacity);
+        printf("[INFO]: Neighbor list overflowed by %u entries (max %u neighbors on one particle), growing %u -> %u\n",
+               neighborStats.overflow, neighborStats.maxNeighbors, neighborCapacity, newCapacity);
+        neighborCapacity = newCapacity;
+
+        scheduler.pass("growNeighborList").updates(neighborSSBOs.neighborList).submit();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborList);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * neighborCapacity, NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.neighborList, neighborSSBOs.neighborList);
+
+        glBindBuffer(GL_UNIFORM_BUFFER, fluidUniformBuffer.handle);
+        glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[4], sizeof(GLuint), &neighborCapacity);
+        forceNeighborRebuild();
+    } else if (neighborStats.overflow > 0) {
+        printf("[ERROR]: Neighbor list overflowed by %u entries and is already the largest storage block (%u)\n",
+               neighborStats.overflow, neighborCapacity);
+    }
+}
+
+// Returns the wall clock time since the last substep, capped at MAX_DELTA_T
+// Benchmarks and --validate-frames always step MAX_DELTA_T so every run does the same work
+float nextTimeStep() {
+    if (runOptions.benchmark || runOptions.validateFrames > 0) {
+        return MAX_DELTA_T;
+    }
     double time = glfwGetTime();
     float dt = time - lastTime;
     lastTime = time;
@@ -1357,6 +1969,136 @@ void fluidUpdate() {
     if (dt > MAX_DELTA_T) {
         dt = MAX_DELTA_T;
     }
+    return dt;
+}
+
+// Starts a new epoch of the cell counts, only running out of epochs needs a real clear
+void advanceGridEpoch() {
+    if (++gridEpoch > MAX_GRID_EPOCH) {
+        gridEpoch = 1;
+        profiler->begin("cellClear");
+        scheduler.pass("cellClear").updates(neighborSSBOs.cellCounts).submit();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.cellCounts);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        profiler->end();
+    }
+}
+
+// Sorts positions, velocities and ids by the Morton rank of each particle's cell so particles close in space are
+// close in memory. Borrows the grid's counts, cell starts and particle cells, which the forced rebuild of the
+// neighbor lists (whose entries are slots) overwrites right after. Everything else is rewritten each step.
+void reorderParticles() {
+    GLuint position = particleSSBOs.positions.buffer(POSITION_CURRENT);
+    GLuint velocity = particleSSBOs.velocities.buffer(VELOCITY_CURRENT);
+    advanceGridEpoch();
+
+    profiler->begin("reorder");
+    scheduler.pass("reorderCount").reads(position).writes(neighborSSBOs.cellCounts)
+            .writes(neighborSSBOs.particleCells).submit();
+    reorderProgram->useProgram();
+    glUniform1ui(reorderUniformLocs.pass, 0);
+    glUniform1ui(reorderUniformLocs.epoch, gridEpoch);
+    glDispatchCompute(workGroupCount(KERNEL_REORDER), 1, 1);
+    prefixSum(neighborSSBOs.cellCounts, neighborSSBOs.cellStart, NUM_CELLS, -1, gridEpoch);
+    scheduler.pass("reorderScatter").reads(position).reads(velocity).reads(particleSSBOs.ids.buffer(ID_CURRENT))
+            .reads(neighborSSBOs.cellStart).reads(neighborSSBOs.particleCells)
+            .writes(particleSSBOs.positions.buffer(POSITION_SOLVED))
+            .writes(particleSSBOs.velocities.buffer(VELOCITY_NEW)).writes(particleSSBOs.ids.buffer(ID_NEW)).submit();
+    reorderProgram->useProgram();
+    glUniform1ui(reorderUniformLocs.pass, 1);
+    glDispatchCompute(workGroupCount(KERNEL_REORDER), 1, 1);
+    particleSSBOs.positions.swap(POSITION_CURRENT, POSITION_SOLVED);
+    particleSSBOs.velocities.swap(VELOCITY_CURRENT, VELOCITY_NEW);
+    particleSSBOs.ids.swap(ID_CURRENT, ID_NEW);
+    profiler->end();
+
+    forceNeighborRebuild();
+}
+
+// Jacobi iterations, two dispatches each: deltaP needs the lambda of every neighbor, including the ones in other
+// work groups
+void solveJacobi() {
+    GLuint position = particleSSBOs.positions.buffer(POSITION_CURRENT);
+    GLuint velocity = particleSSBOs.velocities.buffer(VELOCITY_CURRENT);
+    solverProgram->useProgram();
+    for (GLuint i = 0; i < solverIters; i++) {
+        GLuint solvedPosition = particleSSBOs.positions.buffer(POSITION_SOLVED);
+        GLuint newPosition = particleSSBOs.positions.buffer(POSITION_NEW);
+        bool last = i + 1 == solverIters;
+        // Calculate Lambda
+        profiler->begin("lambda");
+        scheduler.pass("lambda").reads(newPosition).reads(neighborSSBOs.sortedIndices)
+                .reads(neighborSSBOs.particleRanks).reads(neighborSSBOs.neighborList)
+                .reads(neighborSSBOs.neighborOffsets).writes(particleSSBOs.lambda).submit();
+        glUniform1ui(solverUniformLocs.pass, 0);
+        glDispatchCompute(workGroupCount(KERNEL_SOLVER), 1, 1);
+        profiler->end();
+        // Calculate deltaP and apply it to solvedPosition, the last iteration also updates velocity
+        profiler->begin("deltaP");
+        scheduler.pass("deltaP").reads(newPosition).reads(particleSSBOs.lambda).reads(neighborSSBOs.sortedIndices)
+                .reads(neighborSSBOs.particleRanks).reads(neighborSSBOs.neighborList)
+                .reads(neighborSSBOs.neighborOffsets).writes(solvedPosition);
+        if (last) {
+            scheduler.reads(position).writes(velocity).writes(particleSSBOs.color);
+        }
+        scheduler.submit();
+        glUniform1ui(solverUniformLocs.pass, last ? 2 : 1);
+        glDispatchCompute(workGroupCount(KERNEL_SOLVER), 1, 1);
+        profiler->end();
+        // The solved positions are the next iteration's input
+        particleSSBOs.positions.swap(POSITION_NEW, POSITION_SOLVED);
+    }
+}
+
+// Gauss-Seidel iterations: one dispatch per color of grid cells projects the constraints of the color's cells in
+// place, the next color sees their corrections.  Cells of a color are further apart than twice the neighbor radius,
+// so none of their particles are shared or neighbors of each other's
+void solveColored() {
+    GLuint position = particleSSBOs.positions.buffer(POSITION_CURRENT);
+    GLuint velocity = particleSSBOs.velocities.buffer(VELOCITY_CURRENT);
+    GLuint newPosition = particleSSBOs.positions.buffer(POSITION_NEW);
+    GLuint range = (GLuint) ceil((supportRad + runOptions.neighborSkin) / CELL_SIZE);
+    GLuint stride = 2 * range + 1;
+    GLuint cellsPerColor = ((GRID_DIMS[0] + stride - 1) / stride) * ((GRID_DIMS[1] + stride - 1) / stride) *
+                           ((GRID_DIMS[2] + stride - 1) / stride);
+    GLuint colorGroups = (cellsPerColor + workGroupSizes[KERNEL_SOLVER_COLORED] - 1) /
+                         workGroupSizes[KERNEL_SOLVER_COLORED];
+
+    solverColoredProgram->useProgram();
+    glUniform1ui(coloredUniformLocs.colorStride, stride);
+    glUniform1f(coloredUniformLocs.epsilon, COLORED_EPSILON);
+    for (GLuint i = 0; i < solverIters; i++) {
+        bool last = i + 1 == solverIters;
+        profiler->begin("gaussSeidel");
+        glUniform1ui(coloredUniformLocs.pass, 0);
+        for (GLuint z = 0; z < stride; z++) {
+            for (GLuint y = 0; y < stride; y++) {
+                for (GLuint x = 0; x < stride; x++) {
+                    scheduler.pass("gaussSeidel").reads(newPosition).reads(neighborSSBOs.cellStart)
+                            .reads(neighborSSBOs.sortedIndices).reads(neighborSSBOs.neighborList)
+                            .reads(neighborSSBOs.neighborOffsets).writes(newPosition).writes(particleSSBOs.lambda)
+                            .writes(particleSSBOs.color).submit();
+                    glUniform3ui(coloredUniformLocs.colorOffset, x, y, z);
+                    glDispatchCompute(colorGroups, 1, 1);
+                }
+            }
+        }
+        profiler->end();
+        // Collision detection and response, the last iteration also updates velocity
+        profiler->begin("confine");
+        scheduler.pass("confine").reads(newPosition).writes(newPosition);
+        if (last) {
+            scheduler.reads(position).writes(velocity);
+        }
+        scheduler.submit();
+        glUniform1ui(coloredUniformLocs.pass, last ? 2 : 1);
+        glDispatchCompute(workGroupCount(KERNEL_SOLVER_COLORED), 1, 1);
+        profiler->end();
+    }
+}
+
+void fluidUpdate(float dt) {
+    /***** TIME AND TIMESTAMP *****/
     simTime += dt;
 
     static int count = 0;
@@ -1366,104 +2108,140 @@ void fluidUpdate() {
 #if WATER
     /// Buffers
     // Bind buffers
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.position, particleSSBOs.position);
+    particleSSBOs.positions.bind();
+    particleSSBOs.velocities.bind();
+    particleSSBOs.ids.bind();
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.color, particleSSBOs.color);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.velocity, particleSSBOs.velocity);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.index, particleSSBOs.index);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.hashMap, neighborSSBOs.hashMap);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.linkedList, neighborSSBOs.linkedList);
-    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, fluidSSBOLocs.counter, neighborSSBOs.counter);
-
-    // Clear buffer data
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.hashMap);
-    glBindBuffer(GL_COPY_READ_BUFFER, neighborSSBOs.hashClear);
-    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_SHADER_STORAGE_BUFFER, 0, 0, sizeof(GLuint) * HASH_MAP_SIZE);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.linkedList);
-    glBindBuffer(GL_COPY_READ_BUFFER, neighborSSBOs.listClear);
-    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_SHADER_STORAGE_BUFFER, 0, 0, sizeof(NodeType) * NUM_PARTICLES);
-    GLuint zero = 0;
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, neighborSSBOs.counter);
-    glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.cellCounts, neighborSSBOs.cellCounts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, fluidSSBOLocs.cellStart, neighborSSBOs.cellStart);
+
+    // Sort the particles back into spatial order before the neighbor loops have scattered too far
+    if (runOptions.reorderSteps > 0 && ++stepsSinceReorder >= runOptions.reorderSteps) {
+        stepsSinceReorder = 0;
+        reorderParticles();
+    }
+    advanceGridEpoch();
 
     // Buffer uniform data
     glBindBuffer(GL_UNIFORM_BUFFER, fluidUniformBuffer.handle);
     glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[3], sizeof(GLfloat), &dt);
 
-    /// Compute Neighbors
-    // Spacial Hash
-    spacialHashProgram->useProgram();
+    GLuint position = particleSSBOs.positions.buffer(POSITION_CURRENT);
+    GLuint velocity = particleSSBOs.velocities.buffer(VELOCITY_CURRENT);
+
+    /// Predict Positions
+    // Apply forces and measure how far every particle moved since the neighbor lists were built
+    checkNeighborStats();
+    profiler->begin("predict");
+    scheduler.pass("predict").reads(position).reads(velocity).reads(neighborSSBOs.buildPositions)
+            .writes(particleSSBOs.positions.buffer(POSITION_NEW)).writes(velocity)
+            .writes(neighborSSBOs.neighborStats).submit();
+    predictProgram->useProgram();
+    glDispatchCompute(workGroupCount(KERNEL_PREDICT), 1, 1);
+    profiler->end();
+    // Rebuild only when some particle moved more than half the skin, otherwise every neighbor stage below is
+    // dispatched with zero work groups and the lists from the last build are reused
+    profiler->begin("neighborRebuild");
+    scheduler.pass("neighborRebuild").reads(neighborSSBOs.neighborStats).writes(neighborSSBOs.neighborStats)
+            .writes(neighborSSBOs.neighborDispatch).submit();
+    neighborRebuildProgram->useProgram();
+    glDispatchCompute(1, 1, 1);
+    profiler->end();
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, neighborSSBOs.neighborDispatch);
+
+    // Every particle kernel from here on reads the predicted positions
+    GLuint newPosition = particleSSBOs.positions.buffer(POSITION_NEW);
 
-    double start_time = glfwGetTime();
-    glBindVertexArray(vaods[PARTICLES]);
-    glEnable(GL_RASTERIZER_DISCARD); // Disable rasterizing
-    glDrawArrays(GL_POINTS, 0, NUM_PARTICLES); // Draw the particles#
-    glMemoryBarrier(GL_ALL_BARRIER_BITS); // Make sure all data was processes
-    glDisable(GL_RASTERIZER_DISCARD); // Renable rasterization
-    double spacial_time = glfwGetTime();
+    /// Compute Neighbors
+    // Count the particles in each grid cell
+    profiler->begin("gridCount");
+    scheduler.pass("gridCount").reads(neighborSSBOs.neighborDispatch, GL_COMMAND_BARRIER_BIT).reads(newPosition)
+            .writes(neighborSSBOs.cellCounts).writes(neighborSSBOs.particleCells).submit();
+    gridCountProgram->useProgram();
+    glUniform1ui(gridUniformLocs.epoch, gridEpoch);
+    dispatchNeighborStage(DISPATCH_GRID_COUNT);
+    profiler->end();
+    // Cell ranges
+    profiler->begin("cellScan");
+    prefixSum(neighborSSBOs.cellCounts, neighborSSBOs.cellStart, NUM_CELLS, DISPATCH_CELL_SCAN, gridEpoch);
+    profiler->end();
+    // Sort the particles by cell
+    profiler->begin("gridScatter");
+    scheduler.pass("gridScatter").reads(neighborSSBOs.neighborDispatch, GL_COMMAND_BARRIER_BIT).reads(newPosition)
+            .reads(neighborSSBOs.cellStart).reads(neighborSSBOs.particleCells)
+            .writes(neighborSSBOs.sortedIndices).writes(neighborSSBOs.particleRanks)
+            .writes(neighborSSBOs.sortedPositions).submit();
+    gridScatterProgram->useProgram();
+    dispatchNeighborStage(DISPATCH_GRID_SCATTER);
+    profiler->end();
 
     // Neighbor Find
+    // Count every particle's neighbors, scan the counts into offsets, then fill the packed list
+    profiler->begin("neighborCount");
+    scheduler.pass("neighborCount").reads(neighborSSBOs.neighborDispatch, GL_COMMAND_BARRIER_BIT)
+            .reads(neighborSSBOs.cellStart).reads(neighborSSBOs.sortedIndices).reads(neighborSSBOs.sortedPositions)
+            .writes(neighborSSBOs.neighborCounts).writes(neighborSSBOs.neighborStats).submit();
     neighborFindProgram->useProgram();
-    glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS); // Make sure all data was processes
-    double neighbor_time = glfwGetTime();
+    glUniform1ui(neighborUniformLocs.pass, 0);
+    dispatchNeighborStage(DISPATCH_NEIGHBOR_FIND);
+    profiler->end();
+    profiler->begin("neighborScan");
+    prefixSum(neighborSSBOs.neighborCounts, neighborSSBOs.neighborOffsets, numParticles, DISPATCH_NEIGHBOR_SCAN);
+    profiler->end();
+    profiler->begin("neighborFill");
+    scheduler.pass("neighborFill").reads(neighborSSBOs.neighborDispatch, GL_COMMAND_BARRIER_BIT)
+            .reads(neighborSSBOs.cellStart).reads(neighborSSBOs.sortedIndices).reads(neighborSSBOs.sortedPositions)
+            .reads(neighborSSBOs.neighborOffsets).writes(neighborSSBOs.neighborList)
+            .writes(neighborSSBOs.buildPositions).writes(neighborSSBOs.neighborStats).submit();
+    neighborFindProgram->useProgram();
+    glUniform1ui(neighborUniformLocs.pass, 1);
+    dispatchNeighborStage(DISPATCH_NEIGHBOR_FIND);
+    profiler->end();
+    // Copy the stats out for checkNeighborStats, only one copy is ever in flight
+    if (neighborStatsFence == NULL) {
+        scheduler.pass("statsReadback").reads(neighborSSBOs.neighborStats, GL_BUFFER_UPDATE_BARRIER_BIT)
+                .updates(neighborSSBOs.neighborStatsReadback).submit();
+        glBindBuffer(GL_COPY_READ_BUFFER, neighborSSBOs.neighborStats);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, neighborSSBOs.neighborStatsReadback);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(NeighborStats));
+        neighborStatsFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
 
 
 #if DEBUG
-    debugSpacialHash();
+    debugGrid();
     debugNeighborFind();
 #endif
 
     /// Constraint solve
-    for (int i = 0; i < SOLVER_ITERS; i++) {
-        // Calculate Lambda
-        lambdaProgram->useProgram();
-        glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
-        glMemoryBarrier(GL_ALL_BARRIER_BITS);
-        // Calculate deltaP
-        deltaPProgram->useProgram();
-        glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
-        glMemoryBarrier(GL_ALL_BARRIER_BITS);
-        // Update newPos and velocity
-        applyDeltaPProgram->useProgram();
-        glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
-        glMemoryBarrier(GL_ALL_BARRIER_BITS);
-    }
-    double constraint_time = glfwGetTime();
+    if (runOptions.solver == CSCI444::SOLVER_COLORED_GS) {
+        solveColored();
+    } else {
+        solveJacobi();
+    }
+    newPosition = particleSSBOs.positions.buffer(POSITION_NEW);
 
     /// Velocity Update
     // Vorticity confinement
+    profiler->begin("vorticity");
+    scheduler.pass("vorticity").reads(newPosition).reads(velocity).reads(neighborSSBOs.neighborList)
+            .reads(neighborSSBOs.neighborOffsets).writes(particleSSBOs.velocities.buffer(VELOCITY_NEW)).submit();
     vorticityProgram->useProgram();
-    glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
-    // Update velocity
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.velocity);
-    glBindBuffer(GL_COPY_READ_BUFFER, particleSSBOs.newVelocity);
-    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_SHADER_STORAGE_BUFFER, 0, 0, 4 * sizeof(float) * NUM_PARTICLES);
+    glDispatchCompute(workGroupCount(KERNEL_VORTICITY), 1, 1);
+    // The new velocity becomes the velocity
+    particleSSBOs.velocities.swap(VELOCITY_CURRENT, VELOCITY_NEW);
+    profiler->end();
     // XSPH
+    profiler->begin("xsph");
+    scheduler.pass("xsph").reads(newPosition).reads(particleSSBOs.velocities.buffer(VELOCITY_CURRENT))
+            .reads(neighborSSBOs.neighborList).reads(neighborSSBOs.neighborOffsets)
+            .writes(particleSSBOs.velocities.buffer(VELOCITY_NEW)).writes(particleSSBOs.color).submit();
     xsphProgram->useProgram();
-    glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
-    glMemoryBarrier(GL_ALL_BARRIER_BITS);
-    // Update velocity
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.velocity);
-    glBindBuffer(GL_COPY_READ_BUFFER, particleSSBOs.newVelocity);
-    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_SHADER_STORAGE_BUFFER, 0, 0, 4 * sizeof(float) * NUM_PARTICLES);
-    // Update pos (fully, possibly just do a copyBuffer command)
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.position);
-    glBindBuffer(GL_COPY_READ_BUFFER, particleSSBOs.newPosition);
-    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_SHADER_STORAGE_BUFFER, 0, 0, 4 * sizeof(float) * NUM_PARTICLES);
-
-    double vel_time = glfwGetTime();
-
-    // Bind hash map buffer (No idea why I have to do this but with out this, the fluid simulation does not work)
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.hashMap);
-    HashType *hash = (HashType *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(HashType) * HASH_MAP_SIZE,
-                                                   GL_MAP_READ_BIT);
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-    /*
-    printf("Hash: %f sec \tNeighbor: %f sec \tConstraint: %f sec\tVelocity: %f sec\n", spacial_time - start_time,
-           neighbor_time - spacial_time, constraint_time - neighbor_time, vel_time - constraint_time);
-    */
+    glDispatchCompute(workGroupCount(KERNEL_XSPH), 1, 1);
+    // The new velocity and position become the velocity and position, the old ones are overwritten next step
+    particleSSBOs.velocities.swap(VELOCITY_CURRENT, VELOCITY_NEW);
+    particleSSBOs.positions.swap(POSITION_CURRENT, POSITION_NEW);
+    profiler->end();
 #endif
 }
 
@@ -1471,7 +2249,7 @@ void fluidUpdate() {
 void renderScene(GLFWwindow *window) {
     // Update Fluid data
     for (int i = 0; i < SUBSTEPS; i++) {
-        fluidUpdate();
+        fluidUpdate(nextTimeStep());
     }
 
     /***** MATRICES *****/
@@ -1507,11 +2285,18 @@ void renderScene(GLFWwindow *window) {
     glBufferSubData(GL_UNIFORM_BUFFER, matriciesUniformBuffer.offsets[2], sizeof(glm::mat4), &(pMtx)[0][0]);
     glBufferSubData(GL_UNIFORM_BUFFER, matriciesUniformBuffer.offsets[3], sizeof(glm::mat4), &(nMtx)[0][0]);
 
+    profiler->begin("drawParticles");
     particleProgram->useProgram();
     // bind our sphere VAO
     glBindVertexArray(sphereAttributes.vaod);
+    // The particles are drawn straight from the position and color SSBOs
+    scheduler.pass("drawParticles")
+            .reads(particleSSBOs.positions.buffer(POSITION_CURRENT), GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT)
+            .reads(particleSSBOs.color, GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT).submit();
+    pointSphereOffsets();
     // draw our sphere!
-    glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, NUM_PARTICLES);
+    glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, numParticles);
+    profiler->end();
 #endif
     /***** GROUND *****/
     // Set shader
@@ -1538,14 +2323,17 @@ void renderScene(GLFWwindow *window) {
     glBufferSubData(GL_UNIFORM_BUFFER, lightUniformBuffer.offsets[3], sizeof(float) * 3, &(lightPos)[0]);
 
     // bind our Ground VAO
+    profiler->begin("drawGround");
     glBindVertexArray(vaods[GROUND]);
     // draw our ground!
     glDrawElements(GL_TRIANGLES, sizeof(groundIndices) / sizeof(unsigned short), GL_UNSIGNED_SHORT, (void *) 0);
+    profiler->end();
 
 #if SDF
     /***** SDF *****/
 #if SDF_DEBUG
     // Show the sdf using a sliding plane
+    profiler->begin("drawSDFPlane");
     sdfVisProgram->useProgram();
     // bind our plane VAO
     glBindVertexArray(vaods[SDF_PLANE]);
@@ -1560,6 +2348,7 @@ void renderScene(GLFWwindow *window) {
     glBufferData(GL_ARRAY_BUFFER, sizeof(sdfPlaneVerticesT), sdfPlaneVerticesT, GL_DYNAMIC_DRAW);
     // draw our ground!
     glDrawElements(GL_TRIANGLES, sizeof(sdfPlaneIndices) / sizeof(unsigned short), GL_UNSIGNED_SHORT, (void *) 0);
+    profiler->end();
 #endif
     /**** OBJECT ****/
     // Material settings
@@ -1597,8 +2386,10 @@ void renderScene(GLFWwindow *window) {
     glBufferSubData(GL_UNIFORM_BUFFER, matriciesUniformBuffer.offsets[3], sizeof(glm::mat4), &(nMtx)[0][0]);
 
     // Draw
+    profiler->begin("drawObject");
     phongProgram->useProgram();
     modelLoader->draw(grndShaderAttribLocs.position, grndShaderAttribLocs.normal);
+    profiler->end();
 #endif
 }
 
@@ -1691,8 +2482,644 @@ static void updateParams() {
     time_last = glfwGetTime();
 }
 
+// Copies the initial particle data into a CPU solver
+CSCI444::FluidSolverCPU *createCPUSolver() {
+    auto solver = new CSCI444::FluidSolverCPU(fluidParameters(MAX_DELTA_T), runOptions.threads,
+                                              runOptions.pinThreads);
+    solver->setSIMDLevel(runOptions.cpuSIMD);
+    solver->setHashMode(runOptions.hashMode);
+    solver->setConstraintSolver(runOptions.solver);
+#if SDF
+    // predict.c.glsl collides with the obstacle in SDF builds, so the CPU solver does too
+    if (modelLoader != NULL) {
+        solver->setObstacle(modelLoader->brickedSDF());
+    }
+#endif
+    for (GLuint i = 0; i < numParticles; i++) {
+        solver->setPosition(i, particleData.position().get(i));
+        solver->setVelocity(i, particleData.velocity().get(i));
+    }
+    return solver;
+}
+
+// Steps the CPU solver at a fixed time step, no window or OpenGL context is created
+int runHeadless() {
+    setupParticleData();
+    CSCI444::FluidSolverCPU *solver = createCPUSolver();
+    printf("[INFO]: Headless CPU solver: %u particles, %u threads, %s, %s x %u iterations, %u frames\n",
+           numParticles, solver->numThreads(), CSCI444::SPHKernels::levelName(solver->simdLevel()),
+           CSCI444::constraintSolverName(solver->constraintSolver()), solverIters, runOptions.frames);
+
+    auto start = std::chrono::steady_clock::now();
+    for (GLuint frame = 0; frame < runOptions.frames; frame++) {
+        for (int i = 0; i < SUBSTEPS; i++) {
+            solver->step(MAX_DELTA_T);
+        }
+        if ((frame + 1) % 60 == 0 || frame + 1 == runOptions.frames) {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf("[INFO]: Frame %u, simulation time %.3f, %.3f frames/sec, density error %.5f\n", frame + 1,
+                   solver->parameters().time, (frame + 1) / elapsed, solver->densityError());
+        }
+    }
+    printf("[INFO]: %u chunks were stolen by idle threads\n", solver->taskSteals());
+
+    delete solver;
+    return EXIT_SUCCESS;
+}
+
+// Times the two CPU hash builds over random particles at the scene's density (two per support radius), no
+// window or OpenGL context is created
+int runHashBenchmark() {
+    const unsigned int sizes[] = {100000, 1000000, 10000000};
+    const unsigned int REPEATS = 10;
+    const float spacing = 0.5f * SUPPORT_RADIUS;
+    const CSCI444::SpatialHashCPU::BuildMode modes[] = {CSCI444::SpatialHashCPU::ATOMIC_LIST,
+                                                        CSCI444::SpatialHashCPU::COUNTING_SORT};
+
+    CSCI444::ThreadPool pool(runOptions.threads, runOptions.pinThreads);
+    printf("[INFO]: Hash build benchmark, %u threads, best of %u builds\n", pool.numThreads(), REPEATS);
+    for (unsigned int count : sizes) {
+        CSCI444::Float3Stream positions(count);
+        float side = spacing * std::cbrt((float) count);
+        srand(runOptions.seed);
+        for (unsigned int i = 0; i < count; i++) {
+            positions.set(i, side * glm::vec3(rand(), rand(), rand()) / (float) RAND_MAX);
+        }
+
+        for (auto mode : modes) {
+            CSCI444::SpatialHashCPU hash;
+            hash.setMode(mode);
+            hash.build(positions, count, SUPPORT_RADIUS, count, pool);
+
+            double best = 0.0;
+            for (unsigned int repeat = 0; repeat < REPEATS; repeat++) {
+                auto start = std::chrono::steady_clock::now();
+                hash.build(positions, count, SUPPORT_RADIUS, count, pool);
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                best = repeat == 0 || ms < best ? ms : best;
+            }
+            printf("[INFO]: %8u particles, %-6s %9.3f ms, %7.1f M particles/sec\n", count,
+                   CSCI444::SpatialHashCPU::modeName(mode), best, count / best / 1000.0);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+// Steps the CPU solver and compares the lambda and deltaP neighbor sums of every instruction set the CPU supports
+// against the scalar loop on its neighbor lists every 60 substeps, no window or OpenGL context is created.
+// Fails when any level differs by more than VALIDATE_SIMD_TOLERANCE
+int runSIMDValidation() {
+    setupParticleData();
+    CSCI444::FluidSolverCPU *solver = createCPUSolver();
+    CSCI444::SPHKernels::Level best = CSCI444::SPHKernels::detect();
+    printf("[INFO]: Validating the CPU solver's instruction sets up to %s against scalar for %u substeps\n",
+           CSCI444::SPHKernels::levelName(best), runOptions.validateSIMDSubsteps);
+
+    bool passed = true;
+    for (GLuint step = 1; step <= runOptions.validateSIMDSubsteps; step++) {
+        solver->step(MAX_DELTA_T);
+        if (step % 60 != 0 && step != runOptions.validateSIMDSubsteps) continue;
+
+        for (int level = CSCI444::SPHKernels::SCALAR + 1; level <= best; level++) {
+            float error = solver->simdError((CSCI444::SPHKernels::Level) level);
+            printf("[INFO]: Substep %u: %-6s max relative error %g\n", step,
+                   CSCI444::SPHKernels::levelName((CSCI444::SPHKernels::Level) level), error);
+            if (!(error <= VALIDATE_SIMD_TOLERANCE)) {
+                passed = false;
+            }
+        }
+    }
+
+    if (best == CSCI444::SPHKernels::SCALAR) {
+        printf("[INFO]: This CPU only supports scalar, there is nothing to compare\n");
+    }
+    if (!passed) {
+        fprintf(stderr, "[ERROR]: A vectorized neighbor sum differed from scalar by more than %g\n",
+                VALIDATE_SIMD_TOLERANCE);
+    }
+    delete solver;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Returns the CPU solver's density error averaged over every substep of a run from the initial particle data
+double meanDensityError(CSCI444::ConstraintSolver method, GLuint iterations, GLuint substeps) {
+    CSCI444::FluidSolverCPU *solver = createCPUSolver();
+    solver->setConstraintSolver(method);
+    solver->parameters().solverIters = iterations;
+    double total = 0.0;
+    for (GLuint step = 0; step < substeps; step++) {
+        solver->step(MAX_DELTA_T);
+        total += solver->densityError();
+    }
+    delete solver;
+    return substeps > 0 ? total / substeps : 0.0;
+}
+
+// Measures Jacobi's mean density error at solverIters iterations, then the fewest colored Gauss-Seidel iterations
+// that reach it, no window or OpenGL context is created.  Fails when colored needs more iterations than Jacobi
+int runSolverValidation() {
+    setupParticleData();
+    GLuint substeps = runOptions.validateSolverSubsteps;
+    printf("[INFO]: Validating colored Gauss-Seidel against Jacobi, %u particles, %u substeps\n", numParticles,
+           substeps);
+
+    double target = meanDensityError(CSCI444::SOLVER_JACOBI, solverIters, substeps);
+    printf("[INFO]: jacobi  x %u iterations: mean density error %.6f\n", solverIters, target);
+    GLuint needed = 0;
+    for (GLuint iterations = 1; iterations <= solverIters && needed == 0; iterations++) {
+        double error = meanDensityError(CSCI444::SOLVER_COLORED_GS, iterations, substeps);
+        printf("[INFO]: colored x %u iterations: mean density error %.6f\n", iterations, error);
+        if (error <= target) {
+            needed = iterations;
+        }
+    }
+
+    if (needed == 0) {
+        fprintf(stderr, "[ERROR]: The colored solver did not reach Jacobi's density error in %u iterations\n",
+                solverIters);
+        return EXIT_FAILURE;
+    }
+    printf("[INFO]: The colored solver reaches Jacobi's density error in %u of %u iterations\n", needed, solverIters);
+    return EXIT_SUCCESS;
+}
+
+// Bricks the signed distance field of a sphere in a box of uneven size, so the grid ends partway through the last
+// bricks, and checks it against the dense field: every cell with SDFBricks::validate(), then the CPU collider at
+// random points against collideSDF() on the dense cells.  Points in reach of the surface must get the dense push up
+// to the 8 bit normals, points further out none, and points deep in the sphere a push of at least the contact
+// distance plus farDistance pointing out of the sphere.  Every kind of brick has to show up.  No window or OpenGL
+// context is created
+int runSDFValidation() {
+    const float RADIUS = 2.0f;
+    const glm::vec3 HALF_EXTENTS(2.6f, 2.3f, 2.9f);
+    const float RESOLUTIONS[] = {0.1f, 0.05f};
+    const unsigned int POINTS = 200000;
+    const float NORMAL_TOLERANCE = 0.5f / 127.0f + 1e-6f;
+
+    bool passed = true;
+    srand(runOptions.seed);
+    for (float resolution : RESOLUTIONS) {
+        glm::uvec3 dims = glm::uvec3(glm::round(2.0f * HALF_EXTENTS / resolution)) + 1u;
+        std::vector<char> denseData(sizeof(CSCI444::SignedDistanceField) +
+                                    (size_t) dims.x * dims.y * dims.z * sizeof(CSCI444::SDFCell), 0);
+        auto dense = (CSCI444::SignedDistanceField *) denseData.data();
+        dense->transformMtx = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / resolution)) *
+                              glm::translate(glm::mat4(1.0f), HALF_EXTENTS);
+        dense->xDim = dims.x;
+        dense->yDim = dims.y;
+        dense->zDim = dims.z;
+        for (GLuint z = 0; z < dims.z; z++) {
+            for (GLuint y = 0; y < dims.y; y++) {
+                for (GLuint x = 0; x < dims.x; x++) {
+                    glm::vec3 pos = resolution * glm::vec3(x, y, z) - HALF_EXTENTS;
+                    float length = glm::length(pos);
+                    CSCI444::SDFCell &cell = dense->cells[x + dims.x * (y + dims.y * z)];
+                    cell.distance = length - RADIUS;
+                    cell.normal = glm::vec4(length > 0.0f ? pos / length : glm::vec3(0.0f, 1.0f, 0.0f), 0.0f);
+                }
+            }
+        }
+
+        std::vector<char> brickedData;
+        CSCI444::SDFBricks::build(dense, resolution, brickedData);
+        auto bricked = (const CSCI444::BrickedSDF *) brickedData.data();
+        CSCI444::SDFBricks::Validation cells = CSCI444::SDFBricks::validate(dense, bricked);
+        printf("[INFO]: Resolution %g, (%u, %u, %u) cells, %u of %u bricks kept: %u band, %u inside and %u outside "
+               "cells, %u mismatches, max normal error %g\n", resolution, dims.x, dims.y, dims.z, bricked->numBricks,
+               bricked->brickDims.x * bricked->brickDims.y * bricked->brickDims.z, cells.bandCells, cells.insideCells,
+               cells.outsideCells, cells.mismatches, cells.maxNormalError);
+        if (cells.mismatches > 0 || cells.bandCells == 0 || cells.insideCells == 0 || cells.outsideCells == 0) {
+            passed = false;
+        }
+
+        float deepPush = SDF_CONTACT_DISTANCE + bricked->farDistance;
+        float centerBrick = sqrtf(3.0f) * SDF_BRICK_SIZE * resolution;
+        unsigned int contacts = 0, deep = 0, failures = 0;
+        for (unsigned int point = 0; point < POINTS; point++) {
+            glm::vec3 pos = HALF_EXTENTS * (2.0f * glm::vec3(rand(), rand(), rand()) / (float) RAND_MAX - 1.0f);
+            glm::vec3 push = CSCI444::SDFBricks::collide(bricked, pos, glm::vec3(0.0f), COLLISION_EPSILON);
+
+            glm::uvec3 index = glm::uvec3(glm::round(glm::vec3(dense->transformMtx * glm::vec4(pos, 1.0f))));
+            const CSCI444::SDFCell &cell = dense->cells[index.x + dims.x * (index.y + dims.y * index.z)];
+            bool ok;
+            if (cell.distance > SDF_CONTACT_DISTANCE) {
+                ok = push == glm::vec3(0.0f);
+            } else if (cell.distance > -bricked->farDistance) {
+                float depth = (SDF_CONTACT_DISTANCE - cell.distance) + COLLISION_EPSILON;
+                ok = glm::length(push - depth * glm::vec3(cell.normal)) <= depth * NORMAL_TOLERANCE * sqrtf(3.0f);
+                contacts++;
+            } else {
+                // Points of the brick around the center may be on the far side of its normal's cell
+                ok = glm::length(push) >= deepPush * (1.0f - NORMAL_TOLERANCE * sqrtf(3.0f)) &&
+                     (glm::dot(push, pos) > 0.0f || glm::length(pos) < centerBrick);
+                deep++;
+            }
+            if (!ok) failures++;
+        }
+        printf("[INFO]: Resolution %g, %u random points: %u in contact, %u deep inside, %u collided differently\n",
+               resolution, POINTS, contacts, deep, failures);
+        if (failures > 0 || contacts == 0 || deep == 0) {
+            passed = false;
+        }
+    }
+
+    if (!passed) {
+        fprintf(stderr, "[ERROR]: The bricked SDF differed from the dense field\n");
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Runs the GPU and CPU solvers side by side from the same initial state and reports how far they drift apart
+// Returns false when the rms error of any substep exceeds VALIDATE_RMS_TOLERANCE
+bool validateAgainstCPU(GLuint substeps) {
+    const double tolerance = VALIDATE_RMS_TOLERANCE * supportRad;
+    bool passed = true;
+    CSCI444::FluidSolverCPU *solver = createCPUSolver();
+    CSCI444::Float3Stream gpuPositions(numParticles);
+    std::vector<GLuint> gpuIds(numParticles);
+
+    printf("[INFO]: Validating GPU solver against CPU solver for %u substeps\n", substeps);
+    for (GLuint step = 0; step < substeps; step++) {
+        // Both solvers see the same time for the wall drops
+        glBindBuffer(GL_UNIFORM_BUFFER, fluidUniformBuffer.handle);
+        glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[16], sizeof(GLfloat), &simTime);
+        fluidUpdate(MAX_DELTA_T);
+        solver->step(MAX_DELTA_T);
+
+        scheduler.pass("validateReadback")
+                .reads(particleSSBOs.positions.buffer(POSITION_CURRENT), GL_BUFFER_UPDATE_BARRIER_BIT)
+                .reads(particleSSBOs.ids.buffer(ID_CURRENT), GL_BUFFER_UPDATE_BARRIER_BIT).submit();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.positions.buffer(POSITION_CURRENT));
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuPositions.bytes(), gpuPositions.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.ids.buffer(ID_CURRENT));
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * numParticles, &gpuIds[0]);
+
+        // Reorders move the GPU particles to other slots, the ids say which CPU particle each slot holds
+        double maxError = 0.0, sumError = 0.0;
+        for (GLuint i = 0; i < numParticles; i++) {
+            double error = glm::length(gpuPositions.get(i) - solver->positions().get(gpuIds[i]));
+            sumError += error * error;
+            if (error > maxError) maxError = error;
+        }
+        double rmsError = sqrt(sumError / numParticles);
+        printf("[INFO]: Substep %u: max position error %f, rms position error %f\n", step + 1, maxError, rmsError);
+        if (!(rmsError <= tolerance)) {
+            passed = false;
+        }
+    }
+
+    if (!passed) {
+        fprintf(stderr, "[ERROR]: GPU solver drifted more than %f (rms) from the CPU solver\n", tolerance);
+    }
+    delete solver;
+    return passed;
+}
+
+// Uploads positions and velocities, in id order, to every slot of the particle buffers and sets the simulation clock
+void uploadParticleSSBOs(const CSCI444::Float3Stream &positions, const CSCI444::Float3Stream &velocities,
+                         GLfloat time) {
+    std::vector<GLuint> ids = identityIds();
+    scheduler.pass("resetParticles");
+    for (unsigned int slot = 0; slot < particleSSBOs.positions.size(); slot++) {
+        scheduler.updates(particleSSBOs.positions.buffer(slot));
+    }
+    for (unsigned int slot = 0; slot < particleSSBOs.velocities.size(); slot++) {
+        scheduler.updates(particleSSBOs.velocities.buffer(slot));
+    }
+    scheduler.updates(particleSSBOs.ids.buffer(ID_CURRENT)).submit();
+    for (unsigned int slot = 0; slot < particleSSBOs.positions.size(); slot++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.positions.buffer(slot));
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.bytes(), positions.data());
+    }
+    for (unsigned int slot = 0; slot < particleSSBOs.velocities.size(); slot++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.velocities.buffer(slot));
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, velocities.bytes(), velocities.data());
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.ids.buffer(ID_CURRENT));
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * numParticles, &ids[0]);
+    stepsSinceReorder = 0;
+
+    simTime = time;
+    glBindBuffer(GL_UNIFORM_BUFFER, fluidUniformBuffer.handle);
+    glBufferSubData(GL_UNIFORM_BUFFER, fluidUniformBuffer.offsets[16], sizeof(GLfloat), &simTime);
+    forceNeighborRebuild();
+}
+
+// Uploads the initial particle data again and restarts the simulation clock
+void resetParticleSSBOs() {
+    uploadParticleSSBOs(particleData.position(), particleData.velocity(), 0.0f);
+}
+
+// Reads the current positions and velocities back from the GPU in id order
+void readParticleSSBOs(CSCI444::Float3Stream &positions, CSCI444::Float3Stream &velocities) {
+    CSCI444::Float3Stream gpuPositions(numParticles), gpuVelocities(numParticles);
+    std::vector<GLuint> gpuIds(numParticles);
+    scheduler.pass("particleReadback")
+            .reads(particleSSBOs.positions.buffer(POSITION_CURRENT), GL_BUFFER_UPDATE_BARRIER_BIT)
+            .reads(particleSSBOs.velocities.buffer(VELOCITY_CURRENT), GL_BUFFER_UPDATE_BARRIER_BIT)
+            .reads(particleSSBOs.ids.buffer(ID_CURRENT), GL_BUFFER_UPDATE_BARRIER_BIT).submit();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.positions.buffer(POSITION_CURRENT));
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuPositions.bytes(), gpuPositions.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.velocities.buffer(VELOCITY_CURRENT));
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuVelocities.bytes(), gpuVelocities.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particleSSBOs.ids.buffer(ID_CURRENT));
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * numParticles, &gpuIds[0]);
+
+    // Reorders move particles to other slots, the ids say which particle each slot holds
+    positions.resize(numParticles);
+    velocities.resize(numParticles);
+    for (GLuint i = 0; i < numParticles; i++) {
+        positions.set(gpuIds[i], gpuPositions.get(i));
+        velocities.set(gpuIds[i], gpuVelocities.get(i));
+    }
+}
+
+// Renders frames frames of the scene like the main loop, then waits until the GPU has finished all of them
+void runFrames(GLFWwindow *window, GLuint frames) {
+    for (GLuint frame = 0; frame < frames && !glfwWindowShouldClose(window); frame++) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+        profiler->collect();
+        renderScene(window);
+        glfwSwapBuffers(window);
+        throttleFrames();
+        glfwPollEvents();
+    }
+    drainFrames();
+}
+
+// Regression check for the pipelined frame loop.  Runs the seeded scene VALIDATE_FRAMES_WARMUP frames, then frames
+// more from that state twice: with one frame in flight, the synchronous loop from before the forced map was dropped,
+// and with MAX_FRAMES_IN_FLIGHT.  Returns false when any particle of the two runs ends up more than
+// VALIDATE_FRAMES_TOLERANCE apart
+bool validateFramesInFlight(GLFWwindow *window, GLuint frames) {
+    const double tolerance = VALIDATE_FRAMES_TOLERANCE * supportRad;
+    const GLuint FLIGHTS[2] = {1, MAX_FRAMES_IN_FLIGHT};
+
+    printf("[INFO]: Validating %u frames in flight against 1 for %u frames, after %u warm up frames\n",
+           MAX_FRAMES_IN_FLIGHT, frames, VALIDATE_FRAMES_WARMUP);
+    resetParticleSSBOs();
+    drainFrames();
+    framesInFlight = 1;
+    runFrames(window, VALIDATE_FRAMES_WARMUP);
+    CSCI444::Float3Stream startPositions, startVelocities;
+    readParticleSSBOs(startPositions, startVelocities);
+    GLfloat startTime = simTime;
+
+    CSCI444::Float3Stream positions[2], velocities;
+    for (GLuint run = 0; run < 2; run++) {
+        uploadParticleSSBOs(startPositions, startVelocities, startTime);
+        framesInFlight = FLIGHTS[run];
+        runFrames(window, frames);
+        readParticleSSBOs(positions[run], velocities);
+    }
+    framesInFlight = MAX_FRAMES_IN_FLIGHT;
+
+    double maxError = 0.0;
+    GLuint outside = 0;
+    for (GLuint i = 0; i < numParticles; i++) {
+        double error = glm::length(positions[1].get(i) - positions[0].get(i));
+        if (error > maxError) maxError = error;
+        if (!(error <= tolerance)) outside++;
+    }
+    printf("[INFO]: %u frames in flight: max position error %g against 1, %u particles past %g\n",
+           MAX_FRAMES_IN_FLIGHT, maxError, outside, tolerance);
+    if (outside > 0) {
+        fprintf(stderr, "[ERROR]: %u particles ended up elsewhere with %u frames in flight than with 1\n", outside,
+                MAX_FRAMES_IN_FLIGHT);
+    }
+    return outside == 0;
+}
+
+// Steps the simulation with every particle kernel compiled at each candidate work group size, keeps the size
+// each kernel ran fastest at and writes them to filename as a --config file
+void autotuneWorkGroups(const char *filename) {
+    const GLuint CANDIDATES[] = {32, 64, 96, 128, 192, 256, 384, 512, 768, 1024};
+    const GLuint WARMUP_STEPS = 4, TIMED_STEPS = 16;
+
+    GLuint bestSizes[NUM_FLUID_KERNELS];
+    double bestMs[NUM_FLUID_KERNELS];
+    for (GLuint kernel = 0; kernel < NUM_FLUID_KERNELS; kernel++) {
+        bestSizes[kernel] = workGroupSizes[kernel];
+        bestMs[kernel] = INFINITY;
+    }
+
+    printf("[INFO]: Tuning work group sizes over %u steps per size\n", TIMED_STEPS);
+    CSCI444::GPUProfiler *appProfiler = profiler;
+    GLuint limit = maxWorkGroupSize();
+    for (GLuint size : CANDIDATES) {
+        if (size > limit) break;
+
+        for (GLuint kernel = 0; kernel < NUM_FLUID_KERNELS; kernel++) {
+            workGroupSizes[kernel] = size;
+            compileFluidKernel(kernel);
+        }
+        writeNeighborDispatchSizes();
+
+        // Every step rebuilds the neighbor lists so the neighbor kernels are timed even with a skin
+        profiler = new CSCI444::GPUProfiler();
+        for (GLuint step = 0; step < WARMUP_STEPS + TIMED_STEPS; step++) {
+            profiler->setEnabled(step >= WARMUP_STEPS);
+            forceNeighborRebuild();
+            fluidUpdate(MAX_DELTA_T);
+        }
+        glFinish();
+        profiler->collect();
+        std::vector<CSCI444::GPUProfiler::StageStats> stages = profiler->stats();
+        delete profiler;
+
+        for (GLuint kernel = 0; kernel < NUM_FLUID_KERNELS; kernel++) {
+            double ms = 0.0;
+            bool timed = false;
+            for (const char *stage : fluidKernels[kernel].stages) {
+                for (const auto &stats : stages) {
+                    if (stage != NULL && stats.name == stage && stats.samples > 0) {
+                        ms += stats.avgMs;
+                        timed = true;
+                    }
+                }
+            }
+            // Kernels that did not run (reorder without --reorder) keep their size
+            if (timed && ms < bestMs[kernel]) {
+                bestMs[kernel] = ms;
+                bestSizes[kernel] = size;
+            }
+        }
+    }
+    profiler = appProfiler;
+
+    for (GLuint kernel = 0; kernel < NUM_FLUID_KERNELS; kernel++) {
+        workGroupSizes[kernel] = bestSizes[kernel];
+        compileFluidKernel(kernel);
+        printf("[INFO]: %-14s work group size %4u, %.4f ms\n", fluidKernels[kernel].name, bestSizes[kernel],
+               bestMs[kernel]);
+    }
+    writeNeighborDispatchSizes();
+    resetParticleSSBOs();
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]: Could not open \"%s\" for writing\n", filename);
+        return;
+    }
+    fprintf(file, "# Work group sizes tuned for %u particles on %s\n", numParticles,
+            (const char *) glGetString(GL_RENDERER));
+    for (GLuint kernel = 0; kernel < NUM_FLUID_KERNELS; kernel++) {
+        fprintf(file, "--work-group %s %u\n", fluidKernels[kernel].name, bestSizes[kernel]);
+    }
+    fclose(file);
+    printf("[INFO]: Wrote work group sizes to %s, load them with --config %s\n", filename, filename);
+}
+
+// Returns text as the inside of a JSON string, with quotes, backslashes and control characters escaped
+std::string jsonEscape(const char *text) {
+    std::string escaped;
+    for (const char *c = text; *c != '\0'; c++) {
+        switch (*c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if ((unsigned char) *c < 0x20) {
+                    char code[7];
+                    snprintf(code, sizeof(code), "\\u%04x", (unsigned char) *c);
+                    escaped += code;
+                } else {
+                    escaped += *c;
+                }
+        }
+    }
+    return escaped;
+}
+
+void writeBenchmarkResults(const char *filename, double seconds, const std::vector<double> &frameTimes) {
+    std::vector<double> sortedTimes(frameTimes);
+    std::sort(sortedTimes.begin(), sortedTimes.end());
+    double frameP99 = sortedTimes.empty() ? 0.0 : sortedTimes[(sortedTimes.size() * 99 + 99) / 100 - 1];
+    double fps = runOptions.frames / seconds;
+    std::vector<CSCI444::GPUProfiler::StageStats> stages = profiler->stats();
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "[ERROR]: Could not open \"%s\" for writing\n", filename);
+        return;
+    }
+
+    const char *extension = strrchr(filename, '.');
+    if (extension != NULL && strcmp(extension, ".csv") == 0) {
+        fprintf(file, "metric,value\n");
+        fprintf(file, "renderer,\"%s\"\n", (const char *) glGetString(GL_RENDERER));
+        fprintf(file, "particles,%u\n", numParticles);
+        fprintf(file, "frames,%u\n", runOptions.frames);
+        fprintf(file, "substeps,%u\n", SUBSTEPS);
+        fprintf(file, "dt,%f\n", MAX_DELTA_T);
+        fprintf(file, "solver,%s\n", CSCI444::constraintSolverName(runOptions.solver));
+        fprintf(file, "solver_iters,%u\n", solverIters);
+        fprintf(file, "seed,%u\n", runOptions.seed);
+        fprintf(file, "seconds,%f\n", seconds);
+        fprintf(file, "fps,%f\n", fps);
+        fprintf(file, "frame_p99_ms,%f\n", frameP99 * 1000.0);
+        fprintf(file, "neighbors_total,%u\n", neighborStats.totalNeighbors);
+        fprintf(file, "neighbors_avg,%f\n", (double) neighborStats.totalNeighbors / numParticles);
+        fprintf(file, "neighbors_max,%u\n", neighborStats.maxNeighbors);
+        fprintf(file, "neighbors_capacity,%u\n", neighborCapacity);
+        fprintf(file, "neighbor_builds,%u\n", neighborStats.builds);
+        fprintf(file, "neighbor_steps,%u\n", neighborStats.steps);
+        for (const auto &stage : stages) {
+            fprintf(file, "stage.%s.samples,%u\n", stage.name.c_str(), stage.samples);
+            fprintf(file, "stage.%s.min_ms,%f\n", stage.name.c_str(), stage.minMs);
+            fprintf(file, "stage.%s.avg_ms,%f\n", stage.name.c_str(), stage.avgMs);
+            fprintf(file, "stage.%s.p99_ms,%f\n", stage.name.c_str(), stage.p99Ms);
+        }
+    } else {
+        fprintf(file, "{\n");
+        fprintf(file, "  \"renderer\": \"%s\",\n", jsonEscape((const char *) glGetString(GL_RENDERER)).c_str());
+        fprintf(file, "  \"particles\": %u,\n", numParticles);
+        fprintf(file, "  \"frames\": %u,\n", runOptions.frames);
+        fprintf(file, "  \"substeps\": %u,\n", SUBSTEPS);
+        fprintf(file, "  \"dt\": %f,\n", MAX_DELTA_T);
+        fprintf(file, "  \"solver\": \"%s\",\n", CSCI444::constraintSolverName(runOptions.solver));
+        fprintf(file, "  \"solver_iters\": %u,\n", solverIters);
+        fprintf(file, "  \"seed\": %u,\n", runOptions.seed);
+        fprintf(file, "  \"seconds\": %f,\n", seconds);
+        fprintf(file, "  \"fps\": %f,\n", fps);
+        fprintf(file, "  \"frame_p99_ms\": %f,\n", frameP99 * 1000.0);
+        fprintf(file, "  \"neighbors\": {\"total\": %u, \"avg\": %f, \"max\": %u, \"capacity\": %u, "
+                      "\"builds\": %u, \"steps\": %u},\n", neighborStats.totalNeighbors,
+                (double) neighborStats.totalNeighbors / numParticles, neighborStats.maxNeighbors, neighborCapacity,
+                neighborStats.builds, neighborStats.steps);
+        fprintf(file, "  \"stages\": [\n");
+        for (GLuint i = 0; i < stages.size(); i++) {
+            fprintf(file, "    {\"name\": \"%s\", \"samples\": %u, \"min_ms\": %f, \"avg_ms\": %f, \"p99_ms\": %f}%s\n",
+                    jsonEscape(stages[i].name.c_str()).c_str(), stages[i].samples, stages[i].minMs, stages[i].avgMs,
+                    stages[i].p99Ms, i + 1 < stages.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n");
+        fprintf(file, "}\n");
+    }
+    fclose(file);
+
+    printf("[INFO]: Benchmark: %u particles, %u frames in %.3f sec, %.3f frames/sec, wrote %s\n", numParticles,
+           runOptions.frames, seconds, fps, filename);
+}
+
+// Runs the seeded scene for runOptions.frames frames with a fixed dt and writes the results
+int runBenchmark(GLFWwindow *window) {
+    profiler->setEnabled(true);
+    std::vector<double> frameTimes;
+    frameTimes.reserve(runOptions.frames);
+
+    glFinish();
+    double start = glfwGetTime();
+    double frameStart = start;
+    for (GLuint frame = 0; frame < runOptions.frames && !glfwWindowShouldClose(window); frame++) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+        profiler->collect();
+        renderScene(window);
+        glfwSwapBuffers(window);
+        throttleFrames();
+        glfwPollEvents();
+
+        double frameEnd = glfwGetTime();
+        frameTimes.push_back(frameEnd - frameStart);
+        frameStart = frameEnd;
+    }
+    glFinish();
+    double seconds = glfwGetTime() - start;
+
+    // Everything has finished, so the latest stats and timings can be read directly
+    profiler->collect();
+    scheduler.pass("statsReadback").reads(neighborSSBOs.neighborStats, GL_BUFFER_UPDATE_BARRIER_BIT).submit();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, neighborSSBOs.neighborStats);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(NeighborStats), &neighborStats);
+    runOptions.frames = frameTimes.size();
+    writeBenchmarkResults(runOptions.benchmarkOut, seconds, frameTimes);
+    return EXIT_SUCCESS;
+}
+
 // program entry point
 int main(int argc, char *argv[]) {
+    parseArguments(argc, argv);
+    setupSizes();
+    if (runOptions.hashBenchmark) {
+        return runHashBenchmark();
+    }
+    if (runOptions.validateSIMDSubsteps > 0) {
+        return runSIMDValidation();
+    }
+    if (runOptions.validateSolverSubsteps > 0) {
+        return runSolverValidation();
+    }
+    if (runOptions.validateSDF) {
+        return runSDFValidation();
+    }
+    if (runOptions.headless) {
+        return runHeadless();
+    }
+
     GLFWwindow *window = setupGLFW();    // setup GLFW and get our window
     setupOpenGL();                        // setup OpenGL & GLEW
     setupShaders();                        // load our shader programs, uniforms, and attribtues
@@ -1700,9 +3127,39 @@ int main(int argc, char *argv[]) {
     setupParticleData();
     setupBuffers();                        // load our models into GPU memory
     setupFonts();                        // load our fonts into memory
+    profiler = new CSCI444::GPUProfiler();
+#if DEBUG
+    scheduler.setTrace(true);
+#endif
 
     convertSphericalToCartesian();        // position our camera in a pretty place
 
+    if (runOptions.autotuneOut != NULL) {
+        autotuneWorkGroups(runOptions.autotuneOut);
+    }
+    if (runOptions.validateSubsteps > 0 && !validateAgainstCPU(runOptions.validateSubsteps)) {
+        delete profiler;
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+    if (runOptions.validateFrames > 0) {
+        bool passed = validateFramesInFlight(window, runOptions.validateFrames);
+        delete profiler;
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    profiler->setEnabled(runOptions.profile);
+
+    if (runOptions.benchmark) {
+        int status = runBenchmark(window);
+        delete profiler;
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return status;
+    }
+
     lastTime = glfwGetTime();
 
     GLfloat ClockLastTime = glfwGetTime();
@@ -1721,6 +3178,7 @@ int main(int argc, char *argv[]) {
         glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
 
         // render our scene
+        profiler->collect();
         renderScene(window);
 
         updateParams();
@@ -1767,6 +3225,16 @@ int main(int argc, char *argv[]) {
         sprintf(timeStr, "Simulation Time: %.3f", simTime);
         render_text(timeStr, face, -1 + 8 * sx, 1 - 50 * sy, sx, sy);
 
+        if (profiler->isEnabled()) {
+            std::vector<CSCI444::GPUProfiler::StageStats> stages = profiler->stats();
+            for (GLuint i = 0; i < stages.size(); i++) {
+                char stageStr[100];
+                sprintf(stageStr, "%-16s min %.3f avg %.3f p99 %.3f ms", stages[i].name.c_str(), stages[i].minMs,
+                        stages[i].avgMs, stages[i].p99Ms);
+                render_text(stageStr, face, -1 + 8 * sx, 1 - (80 + 20 * i) * sy, sx, sy);
+            }
+        }
+
         /*
         char restStr[100];
         int den = restDensity;
@@ -1798,6 +3266,7 @@ int main(int argc, char *argv[]) {
 
         // swap the front and back buffers
         glfwSwapBuffers(window);
+        throttleFrames();
         // check for any events
         glfwPollEvents();
 
@@ -1815,6 +3284,15 @@ int main(int argc, char *argv[]) {
 
     }
 
+    if (runOptions.profileCSV != NULL) {
+        profiler->collect();
+        if (profiler->writeCSV(runOptions.profileCSV)) {
+            printf("[INFO]: Wrote GPU stage timings to %s (%u samples dropped)\n", runOptions.profileCSV,
+                   profiler->droppedSamples());
+        }
+    }
+    delete profiler;
+
     // destroy our window
     glfwDestroyWindow(window);
     // end GLFW
@@ -1823,7 +3301,9 @@ int main(int argc, char *argv[]) {
     // delete our shader programs
     delete phongProgram;
     delete textShaderProgram;
-    delete spacialHashProgram;
+    delete gridCountProgram;
+    delete prefixSumProgram;
+    delete gridScatterProgram;
     delete particleProgram;
 
     // SUCCESS!!
@@ -0,0 +1,96 @@
+#version 430 core
+
+#define M_PI 3.1415926535897932384626433832795
+
+// ***** COMPUTE SHADER INPUT *****
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+// ***** COMPUTE SHADER OUTPUT *****
+
+// ***** COMPUTE SHADER UNIFORMS *****
+// Epoch of this step, stored above the count bits of every cell count it touches
+uniform uint gridEpoch;
+#define CELL_COUNT_BITS 24 // CELL_COUNT_BITS in main.cpp
+#define CELL_COUNT_MASK ((1u << CELL_COUNT_BITS) - 1u)
+
+layout(shared, binding = 4) uniform FluidDynamics {
+    uint maxParticles;
+    uint neighborCapacity;
+    uint mapSize;
+    float supportRadius;
+    float dt;
+    uint solverIters;
+    float restDensity;
+    float epsilon;
+    float collisionEpsilon;
+    float kpoly;
+    float kspiky;
+    float scorr;
+    float dcorr;
+    int pcorr;
+    float kxsph;
+    float vortEpsilon;
+    float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
+} fluid;
+
+// ***** COMPUTE SHADER STRUCTS *****
+// ***** COMPUTE SHADER BUFFERS *****
+/*
+    positionStar = 2;
+    cellCounts = 8;
+    particleCells = 14;
+*/
+layout(std430, binding=2) buffer UpdatedPosBuf {
+    float newPositions[];
+};
+
+layout(std430, binding=8) buffer CellCountBuf {
+    uint cellCounts[];
+};
+
+// x: grid cell of the particle, y: slot of the particle within its cell
+layout(std430, binding=14) buffer ParticleCellBuf {
+    uvec2 particleCells[];
+};
+
+// ***** COMPUTE SHADER SUBROUTINES *****
+// ***** COMPUTE SHADER HELPER FUNCTIONS *****
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getNewPosition(uint i){
+    return vec3(newPositions[i], newPositions[fluid.particleStride + i], newPositions[2 * fluid.particleStride + i]);
+}
+
+// Returns the grid cell containing pos, positions outside of the grid are clamped to the border cells
+ivec3 gridCell(vec3 pos){
+    ivec3 cell = ivec3(floor((pos - fluid.gridMin) / fluid.cellSize));
+    return clamp(cell, ivec3(0), ivec3(fluid.gridDims) - 1);
+}
+
+uint cellIndex(ivec3 cell){
+    return uint(cell.x) + fluid.gridDims.x * (uint(cell.y) + fluid.gridDims.y * uint(cell.z));
+}
+
+void main() {
+    uint vIndex = gl_GlobalInvocationID.x;
+    // The last work group runs past the end of the particles
+    if (vIndex >= fluid.maxParticles){
+        return;
+    }
+
+    // Count the particle in its grid cell (at its predicted position), remembering its slot for the scatter pass
+    // A count tagged with an older epoch is stale: raising it to this epoch's zero count before adding replaces the
+    // clear, every invocation of the step raises it before it adds so none of the adds are lost
+    uint cell = cellIndex(gridCell(getNewPosition(vIndex)));
+    atomicMax(cellCounts[cell], gridEpoch << CELL_COUNT_BITS);
+    particleCells[vIndex] = uvec2(cell, atomicAdd(cellCounts[cell], 1) & CELL_COUNT_MASK);
+}
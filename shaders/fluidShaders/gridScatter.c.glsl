@@ -0,0 +1,102 @@
+#version 430 core
+
+#define M_PI 3.1415926535897932384626433832795
+
+// ***** COMPUTE SHADER INPUT *****
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+// ***** COMPUTE SHADER OUTPUT *****
+
+// ***** COMPUTE SHADER UNIFORMS *****
+layout(shared, binding = 4) uniform FluidDynamics {
+    uint maxParticles;
+    uint neighborCapacity;
+    uint mapSize;
+    float supportRadius;
+    float dt;
+    uint solverIters;
+    float restDensity;
+    float epsilon;
+    float collisionEpsilon;
+    float kpoly;
+    float kspiky;
+    float scorr;
+    float dcorr;
+    int pcorr;
+    float kxsph;
+    float vortEpsilon;
+    float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
+} fluid;
+
+// ***** COMPUTE SHADER STRUCTS *****
+
+// ***** COMPUTE SHADER BUFFERS *****
+/*
+    positionStar = 2;
+    cellStart = 9;
+    sortedIndices = 13;
+    particleCells = 14;
+    sortedPositions = 15;
+    particleRanks = 24;
+*/
+layout(std430, binding=2) buffer UpdatedPosBuf {
+    float newPositions[];
+};
+
+layout(std430, binding=9) buffer CellStartBuf {
+    uint cellStart[];
+};
+
+layout(std430, binding=13) buffer SortedIndexBuf {
+    uint sortedIndices[];
+};
+
+layout(std430, binding=14) buffer ParticleCellBuf {
+    uvec2 particleCells[];
+};
+
+layout(std430, binding=15) buffer SortedPosBuf {
+    float sortedPositions[];
+};
+
+layout(std430, binding=24) buffer ParticleRankBuf {
+    uint particleRanks[];
+};
+
+// ***** COMPUTE SHADER SUBROUTINES *****
+// ***** COMPUTE SHADER HELPER FUNCTIONS *****
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getNewPosition(uint i){
+    return vec3(newPositions[i], newPositions[fluid.particleStride + i], newPositions[2 * fluid.particleStride + i]);
+}
+
+void setSortedPosition(uint i, vec3 value){
+    sortedPositions[i] = value.x;
+    sortedPositions[fluid.particleStride + i] = value.y;
+    sortedPositions[2 * fluid.particleStride + i] = value.z;
+}
+
+void main() {
+    uint vIndex = gl_GlobalInvocationID.x;
+    // The last work group runs past the end of the particles
+    if (vIndex >= fluid.maxParticles){
+        return;
+    }
+
+    // Move the particle to its slot in the cell sorted order
+    uvec2 particleCell = particleCells[vIndex];
+    uint sortedIndex = cellStart[particleCell.x] + particleCell.y;
+    sortedIndices[sortedIndex] = vIndex;
+    particleRanks[vIndex] = sortedIndex;
+    setSortedPosition(sortedIndex, getNewPosition(vIndex));
+}
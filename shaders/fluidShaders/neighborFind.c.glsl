@@ -3,14 +3,21 @@
 #define M_PI 3.1415926535897932384626433832795
 
 // ***** COMPUTE SHADER INPUT *****
-layout(local_size_x = 1000, local_size_y = 1, local_size_z = 1) in;
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
 
 // ***** COMPUTE SHADER OUTPUT *****
 
 // ***** COMPUTE SHADER UNIFORMS *****
+// 0: count the neighbors of each particle, 1: write them into the packed list at neighborOffsets
+uniform uint neighborPass;
+
 layout(shared, binding = 4) uniform FluidDynamics {
     uint maxParticles;
-    uint maxNeighbors;
+    uint neighborCapacity;
     uint mapSize;
     float supportRadius;
     float dt;
@@ -26,26 +33,18 @@ layout(shared, binding = 4) uniform FluidDynamics {
     float kxsph;
     float vortEpsilon;
     float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
 } fluid;
 
 // ***** COMPUTE SHADER STRUCTS *****
-struct HashType {
-    uint headNodeIndex;
-};
-
-struct NodeType {
-    uint nextNodeIndex;
-    uint particleIndex;
-};
-
-struct NeighborType {
-    uint count;
-    uint neighboring[500];
-};
 
 // ***** COMPUTE SHADER BUFFERS *****
 /*
-    index = 0;
     position = 1;
     positionStar = 2;
     velocity = 3;
@@ -53,43 +52,71 @@ struct NeighborType {
     lambda = 5;
     deltaP = 6;
     color = 7;
-    hashMap = 8;
-    linkedList = 9;
-    neighbors = 10;
-    counter = 0;
+    cellCounts = 8;
+    cellStart = 9;
+    neighborList = 10;
+    sortedIndices = 13;
+    particleCells = 14;
+    sortedPositions = 15;
+    neighborOffsets = 19;
+    neighborCounts = 20;
+    neighborStats = 21;
+    buildPositions = 22;
 */
+layout(std430, binding=9) buffer CellStartBuf {
+    uint cellStart[];
+};
+
+// Packed neighbor indices, particle i owns [neighborOffsets[i], neighborOffsets[i + 1])
+layout(std430, binding=10) buffer NeighborListBuf {
+    uint neighborList[];
+};
 
-layout(std430, binding=2) buffer UpdatedPosBuf {
-    vec4 newPositions[];
+layout(std430, binding=13) buffer SortedIndexBuf {
+    uint sortedIndices[];
 };
 
-layout(std430, binding=7) buffer ColorBuf {
-    vec4 colors[];
+layout(std430, binding=15) buffer SortedPosBuf {
+    float sortedPositions[];
 };
 
-layout(std430, binding=8) buffer HashBuf {
-    HashType hashMap[];
+layout(std430, binding=19) buffer NeighborOffsetBuf {
+    uint neighborOffsets[];
 };
 
-layout(std430, binding=9) buffer LinkedListBuf {
-    NodeType nodes[];
+layout(std430, binding=20) buffer NeighborCountBuf {
+    uint neighborCounts[];
 };
 
-layout(std430, binding=10) buffer NeighborDataBuf {
-    NeighborType neighbors[];
+layout(std430, binding=21) buffer NeighborStatsBuf {
+    uint totalNeighbors;
+    uint overflow;
+    uint maxNeighbors;
+    uint maxDisplacement2;
+    uint builds;
+    uint steps;
+} stats;
+
+// Predicted positions the neighbor lists were last built from
+layout(std430, binding=22) buffer BuildPosBuf {
+    float buildPositions[];
 };
 
 // ***** COMPUTE SHADER SUBROUTINES *****
 // ***** COMPUTE SHADER HELPER FUNCTIONS *****
-const int P1 = 73856093;
-const int P2 = 19349663;
-const int P3 = 83492791;
-// SOURCE: Optimized Spatial Hashing for Collision Detection of Deformable Objects
-// Matthias Teschner
-int spacialHash(float x, float y, float z){
-    return int((int(floor(x/fluid.supportRadius) * P1) ^
-    int(floor(y/fluid.supportRadius) * P2) ^
-    int(floor(z/fluid.supportRadius) * P3)) % fluid.mapSize);
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getSortedPosition(uint i){
+    return vec3(sortedPositions[i], sortedPositions[fluid.particleStride + i], sortedPositions[2 * fluid.particleStride + i]);
+}
+
+void setBuildPosition(uint i, vec3 value){
+    buildPositions[i] = value.x;
+    buildPositions[fluid.particleStride + i] = value.y;
+    buildPositions[2 * fluid.particleStride + i] = value.z;
+}
+
+uint cellIndex(ivec3 cell){
+    return uint(cell.x) + fluid.gridDims.x * (uint(cell.y) + fluid.gridDims.y * uint(cell.z));
 }
 
 // Calculates the magnitude of the vector squared
@@ -97,105 +124,66 @@ float squareMagnitude(vec3 vec){
     return vec.x*vec.x + vec.y*vec.y + vec.z*vec.z;
 }
 
-// Calculate the neighbors in this cell
-// vIndex: the index of the particle
-// neighborCount: The number of current neighbors
-uint neighborFindCell(uint vIndex, uint neighborCount, int hashIdx){
-    // Get position
-    vec3 pos = vec3(newPositions[vIndex]);
-
-    // get head
-    HashType start = hashMap[hashIdx];
-
-    // Skip parts of hashmap with old data
-    if (start.headNodeIndex == 0xffffffff){
-        return neighborCount;
-    }
-
-    // Count neighbors in that hash cell
-    // Iterate over linked list
-    NodeType n = nodes[start.headNodeIndex];
-    while (neighborCount < fluid.maxNeighbors){
-        // Skip ourselves
-        if (n.particleIndex != vIndex){
-            // If distance is < support radius increment neighbor count
-            if (squareMagnitude(pos - vec3(newPositions[n.particleIndex])) <= fluid.supportRadius * fluid.supportRadius){
-                neighbors[vIndex].neighboring[neighborCount] = n.particleIndex;
-                neighborCount ++;
+// Find all of the neighbors of the particle in sorted slot sortedIndex
+// Each cell is a contiguous range [cellStart[c], cellStart[c + 1]) of the sorted particles
+// When write is false the neighbors are only counted, otherwise they are stored from first on
+uint findNeighbors(uint sortedIndex, bool write, uint first){
+    vec3 pos = getSortedPosition(sortedIndex);
+    // Include the skin so the list can be reused until particles have moved half of it
+    float radius = fluid.supportRadius + fluid.neighborSkin;
+    float radius2 = radius * radius;
+
+    // Search every cell within the radius, clamped to the grid (like gridCount) so each cell is visited once
+    int range = int(ceil(radius / fluid.cellSize));
+    ivec3 cell = ivec3(floor((pos - fluid.gridMin) / fluid.cellSize));
+    ivec3 minCell = clamp(cell - range, ivec3(0), ivec3(fluid.gridDims) - 1);
+    ivec3 maxCell = clamp(cell + range, ivec3(0), ivec3(fluid.gridDims) - 1);
+
+    uint neighborCount = 0;
+    for (int z = minCell.z; z <= maxCell.z; z++){
+        for (int y = minCell.y; y <= maxCell.y; y++){
+            // Cells along x are adjacent in memory, so the whole row is one range
+            uint rowStart = cellStart[cellIndex(ivec3(minCell.x, y, z))];
+            uint rowEnd = cellStart[cellIndex(ivec3(maxCell.x, y, z)) + 1];
+            for (uint j = rowStart; j < rowEnd; j++){
+                // Skip ourselves, if distance is < support radius add the neighbor
+                if (j != sortedIndex && squareMagnitude(pos - getSortedPosition(j)) <= radius2){
+                    // Anything past the end of the list was counted and is reported as overflow
+                    if (write && first + neighborCount < fluid.neighborCapacity){
+                        neighborList[first + neighborCount] = sortedIndices[j];
+                    }
+                    neighborCount ++;
+                }
             }
         }
-        // Exit on null
-        if (n.nextNodeIndex == 0xffffffff){
-            return neighborCount;
-        } else {
-            // Or go to next node
-            n = nodes[n.nextNodeIndex];
-        }
     }
     return neighborCount;
 }
 
-// Get hashes of neighboring cell based on position and x,y,z offsets
-int getNeighborCellHash(vec3 pos, int xOffset, int yOffset, int zOffset){
-    return int((int((floor(pos.x/fluid.supportRadius) + xOffset) * P1) ^
-    int((floor(pos.y/fluid.supportRadius) + yOffset) * P2) ^
-    int((floor(pos.z/fluid.supportRadius) + zOffset) * P3)) % fluid.mapSize);
-}
-
-// Returns a list of the neighboring hash cells
-int[27] getNeighborCellHashes(uint vIndex){
-    // Get position
-    vec3 pos = vec3(newPositions[vIndex]);
-
-    int neighborHash[27];
-    // initialize to -1
-    for (int i = 0; i < 27; i++){
-        neighborHash[i] = -1;
+void main() {
+    // Walk the particles in cell order so neighboring invocations read the same cells
+    uint sortedIndex = gl_GlobalInvocationID.x;
+    // The last work group runs past the end of the particles
+    if (sortedIndex >= fluid.maxParticles){
+        return;
     }
-
-    // Hash to neighbors, check if unique
-    int index = 0;
-    for (int i = -1; i < 2; i++){
-        for (int j = -1; j < 2; j++){
-            for (int k = -1; k < 2; k++){
-                // Hash
-                int hash = getNeighborCellHash(pos, i, j, k);
-                // Uniqueness check
-                bool new = true;
-                for (int l = 0; l < 27 && neighborHash[l] != -1; l++){
-                    new = new && (hash != neighborHash[l]);
-                }
-                if (new){
-                    neighborHash[index] = hash;
-                    index ++;
-                }
-            }
+    uint vIndex = sortedIndices[sortedIndex];
+
+    if (neighborPass == 0) {
+        // Count Neighbors
+        uint count = findNeighbors(sortedIndex, false, 0);
+        neighborCounts[vIndex] = count;
+        atomicMax(stats.maxNeighbors, count);
+    } else {
+        // Find Neighbors
+        findNeighbors(sortedIndex, true, neighborOffsets[vIndex]);
+        setBuildPosition(vIndex, getSortedPosition(sortedIndex));
+        if (sortedIndex == 0) {
+            stats.totalNeighbors = neighborOffsets[fluid.maxParticles];
+            stats.overflow = stats.totalNeighbors > fluid.neighborCapacity ? stats.totalNeighbors - fluid.neighborCapacity : 0u;
         }
     }
 
-    return neighborHash;
-}
-
-// Find all of the neighbors
-uint findNeighbors(uint vIndex){
-    // Calculate # of neighbors
-    uint numNeighbors = 0;
-
-    // Get neighbor hashes
-    int hashes[27] = getNeighborCellHashes(vIndex);
-
-    for (int i = 0; i < 27 && hashes[i] > -1; i++){
-        numNeighbors = neighborFindCell(vIndex, numNeighbors, hashes[i]);
-    }
-    return numNeighbors;
-}
-
-void main() {
-    uint vIndex = gl_GlobalInvocationID.x;
-
-    // Find Neighbors
-    neighbors[vIndex].count = findNeighbors(vIndex);
-
     // Color based on # of Neighbors
-    // colors[vIndex] = vec4(vec3(neighbors[vIndex].count/50.0), 1.0);
+    // setColor(vIndex, vec3(neighborCounts[vIndex]/50.0));
 }
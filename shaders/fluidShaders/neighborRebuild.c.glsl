@@ -0,0 +1,77 @@
+#version 430 core
+
+// ***** COMPUTE SHADER INPUT *****
+// Decides once per step whether the neighbor lists have to be rebuilt
+layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+#define NUM_DISPATCHES 6 // NUM_NEIGHBOR_DISPATCHES in main.cpp
+
+// ***** COMPUTE SHADER OUTPUT *****
+
+// ***** COMPUTE SHADER UNIFORMS *****
+layout(shared, binding = 4) uniform FluidDynamics {
+    uint maxParticles;
+    uint neighborCapacity;
+    uint mapSize;
+    float supportRadius;
+    float dt;
+    uint solverIters;
+    float restDensity;
+    float epsilon;
+    float collisionEpsilon;
+    float kpoly;
+    float kspiky;
+    float scorr;
+    float dcorr;
+    int pcorr;
+    float kxsph;
+    float vortEpsilon;
+    float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
+} fluid;
+
+// ***** COMPUTE SHADER STRUCTS *****
+// ***** COMPUTE SHADER BUFFERS *****
+/*
+    neighborStats = 21;
+    neighborDispatch = 23;
+*/
+layout(std430, binding=21) buffer NeighborStatsBuf {
+    uint totalNeighbors;
+    uint overflow;
+    uint maxNeighbors;
+    uint maxDisplacement2;
+    uint builds;
+    uint steps;
+} stats;
+
+// Indirect dispatch sizes of the neighbor search stages, the first NUM_DISPATCHES are dispatched and the
+// next NUM_DISPATCHES hold their full sizes (x, y, z, padding)
+layout(std430, binding=23) buffer NeighborDispatchBuf {
+    uvec4 dispatches[];
+};
+
+// ***** COMPUTE SHADER SUBROUTINES *****
+// ***** COMPUTE SHADER HELPER FUNCTIONS *****
+void main() {
+    // The lists hold every particle within supportRadius + neighborSkin of the build positions, so they stay
+    // complete until some particle has moved half of the skin (and one of its neighbors the other half)
+    float halfSkin = 0.5 * fluid.neighborSkin;
+    bool rebuild = uintBitsToFloat(stats.maxDisplacement2) > halfSkin * halfSkin;
+
+    for (uint i = 0; i < NUM_DISPATCHES; i++){
+        dispatches[i] = rebuild ? dispatches[NUM_DISPATCHES + i] : uvec4(0, 1, 1, 0);
+    }
+    if (rebuild){
+        stats.totalNeighbors = 0;
+        stats.overflow = 0;
+        stats.maxNeighbors = 0;
+        stats.builds++;
+    }
+    stats.steps++;
+    stats.maxDisplacement2 = 0;
+}
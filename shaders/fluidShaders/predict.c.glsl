@@ -0,0 +1,261 @@
+#version 430 core
+
+#define M_PI 3.1415926535897932384626433832795
+// Mirrors SDFBricks.hpp
+#define SDF_BRICK_SIZE 8u
+#define SDF_BRICK_OUTSIDE 0xffffffffu
+#define SDF_BRICK_INSIDE 0xfffffffeu
+#define SDF_CONTACT_DISTANCE 0.05
+
+// ***** COMPUTE SHADER INPUT *****
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+// SDF_COLLISION is injected by the host as well, 1 when the obstacle's SDF buffer is bound
+#ifndef SDF_COLLISION
+#define SDF_COLLISION 0
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+// ***** COMPUTE SHADER OUTPUT *****
+
+// ***** COMPUTE SHADER UNIFORMS *****
+layout(shared, binding = 4) uniform FluidDynamics {
+    uint maxParticles;
+    uint neighborCapacity;
+    uint mapSize;
+    float supportRadius;
+    float dt;
+    uint solverIters;
+    float restDensity;
+    float epsilon;
+    float collisionEpsilon;
+    float kpoly;
+    float kspiky;
+    float scorr;
+    float dcorr;
+    int pcorr;
+    float kxsph;
+    float vortEpsilon;
+    float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
+} fluid;
+
+// ***** COMPUTE SHADER STRUCTS *****
+struct BoundingBox {
+    vec4 frontLeftBottom;
+    vec4 backRightTop;
+};
+// ***** COMPUTE SHADER BUFFERS *****
+/*
+    position = 1;
+    positionStar = 2;
+    velocity = 3;
+    neighborStats = 21;
+    buildPositions = 22;
+*/
+layout(std430, binding=1) buffer PosBuf {
+    float positions[];
+};
+
+layout(std430, binding=2) buffer UpdatedPosBuf {
+    float newPositions[];
+};
+
+layout(std430, binding=3) buffer VelBuf {
+    float velocities[];
+};
+
+// Bricked as BrickedSDF in SDFBricks.hpp: a slot per brick of SDF_BRICK_SIZE^3 cells, a packed normal per slot,
+// then the (distance bits, packed normal) pairs of the bricks near the surface
+layout(std430, binding=11) buffer SignedDistanceField {
+    mat4 transformMtx;
+    uint xDim, yDim, zDim;
+    uint numBricks;
+    uvec3 brickDims;
+    float farDistance;
+    uint sdfData[];
+};
+
+// maxDisplacement2 holds the bits of a non negative float, so atomicMax orders it like the float
+layout(std430, binding=21) buffer NeighborStatsBuf {
+    uint totalNeighbors;
+    uint overflow;
+    uint maxNeighbors;
+    uint maxDisplacement2;
+    uint builds;
+    uint steps;
+} stats;
+
+// Predicted positions the neighbor lists were last built from
+layout(std430, binding=22) buffer BuildPosBuf {
+    float buildPositions[];
+};
+
+shared float maxDisplacements[gl_WorkGroupSize.x];
+
+// ***** COMPUTE SHADER SUBROUTINES *****
+// ***** COMPUTE SHADER HELPER FUNCTIONS *****
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getPosition(uint i){
+    return vec3(positions[i], positions[fluid.particleStride + i], positions[2 * fluid.particleStride + i]);
+}
+
+void setNewPosition(uint i, vec3 value){
+    newPositions[i] = value.x;
+    newPositions[fluid.particleStride + i] = value.y;
+    newPositions[2 * fluid.particleStride + i] = value.z;
+}
+
+vec3 getVelocity(uint i){
+    return vec3(velocities[i], velocities[fluid.particleStride + i], velocities[2 * fluid.particleStride + i]);
+}
+
+void setVelocity(uint i, vec3 value){
+    velocities[i] = value.x;
+    velocities[fluid.particleStride + i] = value.y;
+    velocities[2 * fluid.particleStride + i] = value.z;
+}
+
+vec3 getBuildPosition(uint i){
+    return vec3(buildPositions[i], buildPositions[fluid.particleStride + i], buildPositions[2 * fluid.particleStride + i]);
+}
+
+// Calculates the magnitude of the vector squared
+float squareMagnitude(vec3 vec){
+    return vec.x*vec.x + vec.y*vec.y + vec.z*vec.z;
+}
+
+// Distance of the SDF cell, negative inside the mesh, and its surface normal.  Cells of bricks away from the surface
+// are farDistance away, inside ones point along the normal of their brick's cell nearest the surface
+float sdfCell(uvec3 cell, out vec3 normal){
+    uvec3 brick = cell / SDF_BRICK_SIZE;
+    uint numSlots = brickDims.x * brickDims.y * brickDims.z;
+    uint slotIndex = brick.x + brickDims.x * (brick.y + brickDims.y * brick.z);
+    uint slot = sdfData[slotIndex];
+    if (slot == SDF_BRICK_OUTSIDE){
+        normal = vec3(0.0);
+        return farDistance;
+    }
+    if (slot == SDF_BRICK_INSIDE){
+        normal = unpackSnorm4x8(sdfData[numSlots + slotIndex]).xyz;
+        return -farDistance;
+    }
+    uvec3 local = cell % SDF_BRICK_SIZE;
+    uint index = 2u * (numSlots + slot * SDF_BRICK_SIZE * SDF_BRICK_SIZE * SDF_BRICK_SIZE +
+                       local.x + SDF_BRICK_SIZE * (local.y + SDF_BRICK_SIZE * local.z));
+    normal = unpackSnorm4x8(sdfData[index + 1]).xyz;
+    return uintBitsToFloat(sdfData[index]);
+}
+
+// SDFBricks::collide() is the CPU solver's copy of this, keep the two in step
+vec3 collideSDF(vec3 pos, vec3 deltaPos){
+    vec3 newPos = pos + deltaPos;
+
+    // Transform the position
+    vec3 tranPos = vec3(transformMtx*vec4(newPos, 1.0));
+    // Turn transformed position into indices
+    tranPos = vec3(round(tranPos.x), round(tranPos.y), round(tranPos.z));
+    // Check if in the bounding box
+    if (tranPos.x < 0 || tranPos.x >= xDim){
+        return deltaPos;
+    }
+    if (tranPos.y < 0 || tranPos.y >= yDim){
+        return deltaPos;
+    }
+    if (tranPos.z < 0 || tranPos.z >= zDim){
+        return deltaPos;
+    }
+
+    // Get distance from sdf cells
+    vec3 normal;
+    float distance = sdfCell(uvec3(tranPos), normal);
+    if (distance <= SDF_CONTACT_DISTANCE){
+        float delta = (SDF_CONTACT_DISTANCE - distance) + fluid.collisionEpsilon;
+        return deltaPos + delta * normal;
+    }
+    return deltaPos;
+}
+
+
+float strangeFunction(float x){
+    float denom = 1 + pow(10, -5.0*sin(1.5*x));
+    return 2.0*(1/denom - 0.5);
+}
+
+vec3 confineToBox(vec3 pos, vec3 deltaPos){
+    vec3 newPos = pos + deltaPos;
+
+    // Check floor
+    float wallY = -1.0;
+    if (fluid.time > 5.0){
+        wallY = -5.0;
+    }
+    if (newPos.y < wallY){
+        deltaPos.y = wallY - newPos.y + fluid.collisionEpsilon;
+    } else if (newPos.y > 20.0){
+        deltaPos.y = 20.0 - newPos.y - fluid.collisionEpsilon;
+    }
+    // Check left wall
+    float wallW = 2.5;
+    if (fluid.time > 5.2){
+        wallW = 4.0;
+    }
+    if (newPos.x < -wallW){
+        deltaPos.x = -wallW - newPos.x + fluid.collisionEpsilon;
+    } else if (newPos.x > wallW){
+        // Check right wall
+        deltaPos.x = wallW - newPos.x - fluid.collisionEpsilon;
+    }
+    // Check front wall
+    if (newPos.z < -wallW){
+        deltaPos.z = -wallW - newPos.z + fluid.collisionEpsilon;
+    } else if (newPos.z > wallW){
+        deltaPos.z = wallW - newPos.z - fluid.collisionEpsilon;
+    }
+
+    return deltaPos;
+}
+
+void main() {
+    uint vIndex = gl_GlobalInvocationID.x;
+    uint localIndex = gl_LocalInvocationID.x;
+
+    // Invocations past the end of the particles still take part in the reduction, every invocation has to
+    // reach the barriers
+    maxDisplacements[localIndex] = 0.0;
+    if (vIndex < fluid.maxParticles){
+        // Apply Forces, Predict Positions
+        vec3 oldPos = getPosition(vIndex);
+        vec3 _vel = getVelocity(vIndex) + fluid.dt *  vec3(0.0, -9.8, 0.0);
+        vec3 _pos = oldPos + fluid.dt * _vel;// Set additional variable for memory access optimization
+        _pos += confineToBox(_pos, vec3(0.0));
+#if SDF_COLLISION
+        _pos += collideSDF(_pos, vec3(0.0));
+#endif
+        setNewPosition(vIndex, _pos);
+        setVelocity(vIndex, (_pos-oldPos) / fluid.dt);
+
+        // Squared distance moved since the last neighbor build
+        maxDisplacements[localIndex] = squareMagnitude(_pos - getBuildPosition(vIndex));
+    }
+
+    // Reduce over the work group
+    barrier();
+    uint firstOffset = gl_WorkGroupSize.x > 1u ? 1u << findMSB(gl_WorkGroupSize.x - 1u) : 0u;
+    for (uint offset = firstOffset; offset > 0u; offset >>= 1){
+        if (localIndex < offset && localIndex + offset < gl_WorkGroupSize.x){
+            maxDisplacements[localIndex] = max(maxDisplacements[localIndex], maxDisplacements[localIndex + offset]);
+        }
+        barrier();
+    }
+    if (localIndex == 0){
+        atomicMax(stats.maxDisplacement2, floatBitsToUint(maxDisplacements[0]));
+    }
+}
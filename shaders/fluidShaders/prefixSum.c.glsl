@@ -0,0 +1,138 @@
+#version 430 core
+
+// ***** COMPUTE SHADER INPUT *****
+// Each work group scans SCAN_BLOCK_SIZE elements, two per invocation
+layout(local_size_x = 512, local_size_y = 1, local_size_z = 1) in;
+#define SCAN_BLOCK_SIZE 1024
+
+// ***** COMPUTE SHADER OUTPUT *****
+
+// ***** COMPUTE SHADER UNIFORMS *****
+// Number of elements in scanInput, scanOutput holds scanCount + 1 elements with the total in the last one
+uniform uint scanCount;
+// 0: scan each block, 1: scan the block sums (one work group), 2: add the block sums to each block
+uniform uint scanPass;
+// Nonzero when scanInput holds epoch tagged cell counts (see gridCount.c.glsl), counts of other epochs are zero
+uniform uint scanEpoch;
+#define CELL_COUNT_BITS 24 // CELL_COUNT_BITS in main.cpp
+#define CELL_COUNT_MASK ((1u << CELL_COUNT_BITS) - 1u)
+
+// ***** COMPUTE SHADER BUFFERS *****
+/*
+    scanInput = 16;
+    scanOutput = 17;
+    scanBlockSums = 18;
+*/
+layout(std430, binding=16) buffer ScanInputBuf {
+    uint scanInput[];
+};
+
+layout(std430, binding=17) buffer ScanOutputBuf {
+    uint scanOutput[];
+};
+
+layout(std430, binding=18) buffer ScanBlockSumBuf {
+    uint blockSums[];
+};
+
+shared uint temp[SCAN_BLOCK_SIZE];
+
+uint readInput(uint i){
+    uint value = scanInput[i];
+    if (scanEpoch == 0) {
+        return value;
+    }
+    return value >> CELL_COUNT_BITS == scanEpoch ? value & CELL_COUNT_MASK : 0;
+}
+
+// Work efficient (Blelloch) exclusive scan
+// SOURCE: Parallel Prefix Sum (Scan) with CUDA, GPU Gems 3 Chapter 39
+void main() {
+    uint t = gl_LocalInvocationID.x;
+    // One extra (zero) element so the exclusive scan also produces the total
+    uint count = scanCount + 1;
+    uint numBlocks = (count + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+
+    if (scanPass == 2) {
+        // Offset every block by the scanned sums of the blocks before it
+        uint blockOffset = blockSums[gl_WorkGroupID.x];
+        for (uint e = 0; e < 2; e++) {
+            uint i = gl_WorkGroupID.x * SCAN_BLOCK_SIZE + 2 * t + e;
+            if (i < count) {
+                scanOutput[i] += blockOffset;
+            }
+        }
+        return;
+    }
+
+    // Pass 0 scans this work group's block of the input, pass 1 walks every block of block sums in turn
+    uint firstBlock = scanPass == 0 ? gl_WorkGroupID.x : 0;
+    uint lastBlock = scanPass == 0 ? gl_WorkGroupID.x + 1 : (numBlocks + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+    uint numElements = scanPass == 0 ? count : numBlocks;
+    uint runningTotal = 0;
+
+    for (uint block = firstBlock; block < lastBlock; block++) {
+        uint a = block * SCAN_BLOCK_SIZE + 2 * t;
+        uint b = a + 1;
+
+        // Load, elements past the end are zero
+        if (scanPass == 0) {
+            temp[2 * t] = a < scanCount ? readInput(a) : 0;
+            temp[2 * t + 1] = b < scanCount ? readInput(b) : 0;
+        } else {
+            temp[2 * t] = a < numElements ? blockSums[a] : 0;
+            temp[2 * t + 1] = b < numElements ? blockSums[b] : 0;
+        }
+
+        // Up sweep (reduce)
+        uint offset = 1;
+        for (uint d = SCAN_BLOCK_SIZE >> 1; d > 0; d >>= 1) {
+            memoryBarrierShared();
+            barrier();
+            if (t < d) {
+                uint ai = offset * (2 * t + 1) - 1;
+                uint bi = offset * (2 * t + 2) - 1;
+                temp[bi] += temp[ai];
+            }
+            offset <<= 1;
+        }
+        memoryBarrierShared();
+        barrier();
+
+        uint blockTotal = temp[SCAN_BLOCK_SIZE - 1];
+        memoryBarrierShared();
+        barrier();
+        if (t == 0) {
+            temp[SCAN_BLOCK_SIZE - 1] = 0;
+        }
+
+        // Down sweep
+        for (uint d = 1; d < SCAN_BLOCK_SIZE; d <<= 1) {
+            offset >>= 1;
+            memoryBarrierShared();
+            barrier();
+            if (t < d) {
+                uint ai = offset * (2 * t + 1) - 1;
+                uint bi = offset * (2 * t + 2) - 1;
+                uint value = temp[ai];
+                temp[ai] = temp[bi];
+                temp[bi] += value;
+            }
+        }
+        memoryBarrierShared();
+        barrier();
+
+        // Store
+        if (scanPass == 0) {
+            if (a < numElements) scanOutput[a] = temp[2 * t];
+            if (b < numElements) scanOutput[b] = temp[2 * t + 1];
+            if (t == 0) blockSums[block] = blockTotal;
+        } else {
+            if (a < numElements) blockSums[a] = temp[2 * t] + runningTotal;
+            if (b < numElements) blockSums[b] = temp[2 * t + 1] + runningTotal;
+        }
+        runningTotal += blockTotal;
+        memoryBarrierShared();
+        barrier();
+    }
+}
@@ -0,0 +1,159 @@
+#version 430 core
+
+#define M_PI 3.1415926535897932384626433832795
+
+// ***** COMPUTE SHADER INPUT *****
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+// ***** COMPUTE SHADER OUTPUT *****
+
+// ***** COMPUTE SHADER UNIFORMS *****
+// 0: count the particles in each cell of the Morton order, 1: scatter them into that order
+uniform uint reorderPass;
+// Epoch the cell counts of the reorder are tagged with (see gridCount.c.glsl)
+uniform uint reorderEpoch;
+#define CELL_COUNT_BITS 24 // CELL_COUNT_BITS in main.cpp
+#define CELL_COUNT_MASK ((1u << CELL_COUNT_BITS) - 1u)
+
+layout(shared, binding = 4) uniform FluidDynamics {
+    uint maxParticles;
+    uint neighborCapacity;
+    uint mapSize;
+    float supportRadius;
+    float dt;
+    uint solverIters;
+    float restDensity;
+    float epsilon;
+    float collisionEpsilon;
+    float kpoly;
+    float kspiky;
+    float scorr;
+    float dcorr;
+    int pcorr;
+    float kxsph;
+    float vortEpsilon;
+    float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
+} fluid;
+
+// ***** COMPUTE SHADER STRUCTS *****
+// ***** COMPUTE SHADER BUFFERS *****
+/*
+    position = 1;
+    velocity = 3;
+    newVelocity = 4;
+    solvedPosition = 6;
+    cellCounts = 8;
+    cellStart = 9;
+    particleCells = 14;
+    particleIds = 25;
+    newParticleIds = 26;
+    cellRanks = 27;
+*/
+layout(std430, binding=1) buffer PosBuf {
+    float positions[];
+};
+
+layout(std430, binding=3) buffer VelBuf {
+    float velocities[];
+};
+
+layout(std430, binding=4) buffer NewVelBuf {
+    float newVelocities[];
+};
+
+// Spare position buffer at the start of a step, receives the reordered positions
+layout(std430, binding=6) buffer SolvedPosBuf {
+    float solvedPositions[];
+};
+
+layout(std430, binding=8) buffer CellCountBuf {
+    uint cellCounts[];
+};
+
+layout(std430, binding=9) buffer CellStartBuf {
+    uint cellStart[];
+};
+
+// x: Morton rank of the particle's cell, y: slot of the particle within its cell
+layout(std430, binding=14) buffer ParticleCellBuf {
+    uvec2 particleCells[];
+};
+
+// Stable id of the particle in each slot
+layout(std430, binding=25) buffer ParticleIdBuf {
+    uint particleIds[];
+};
+
+layout(std430, binding=26) buffer NewParticleIdBuf {
+    uint newParticleIds[];
+};
+
+// Position of every grid cell along the Morton (Z-order) curve
+layout(std430, binding=27) buffer CellRankBuf {
+    uint cellRanks[];
+};
+
+// ***** COMPUTE SHADER SUBROUTINES *****
+// ***** COMPUTE SHADER HELPER FUNCTIONS *****
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getPosition(uint i){
+    return vec3(positions[i], positions[fluid.particleStride + i], positions[2 * fluid.particleStride + i]);
+}
+
+vec3 getVelocity(uint i){
+    return vec3(velocities[i], velocities[fluid.particleStride + i], velocities[2 * fluid.particleStride + i]);
+}
+
+void setReorderedPosition(uint i, vec3 value){
+    solvedPositions[i] = value.x;
+    solvedPositions[fluid.particleStride + i] = value.y;
+    solvedPositions[2 * fluid.particleStride + i] = value.z;
+}
+
+void setReorderedVelocity(uint i, vec3 value){
+    newVelocities[i] = value.x;
+    newVelocities[fluid.particleStride + i] = value.y;
+    newVelocities[2 * fluid.particleStride + i] = value.z;
+}
+
+// Returns the grid cell containing pos, positions outside of the grid are clamped to the border cells
+ivec3 gridCell(vec3 pos){
+    ivec3 cell = ivec3(floor((pos - fluid.gridMin) / fluid.cellSize));
+    return clamp(cell, ivec3(0), ivec3(fluid.gridDims) - 1);
+}
+
+uint cellIndex(ivec3 cell){
+    return uint(cell.x) + fluid.gridDims.x * (uint(cell.y) + fluid.gridDims.y * uint(cell.z));
+}
+
+void main() {
+    uint vIndex = gl_GlobalInvocationID.x;
+    // The last work group runs past the end of the particles
+    if (vIndex >= fluid.maxParticles){
+        return;
+    }
+
+    if (reorderPass == 0) {
+        // Counting sort by the Morton rank of the particle's cell, same epoch tagged counts as gridCount
+        uint rank = cellRanks[cellIndex(gridCell(getPosition(vIndex)))];
+        atomicMax(cellCounts[rank], reorderEpoch << CELL_COUNT_BITS);
+        particleCells[vIndex] = uvec2(rank, atomicAdd(cellCounts[rank], 1) & CELL_COUNT_MASK);
+    } else {
+        // Move everything that survives the step into the spare buffers at the particle's new slot
+        uvec2 particleCell = particleCells[vIndex];
+        uint slot = cellStart[particleCell.x] + particleCell.y;
+        setReorderedPosition(slot, getPosition(vIndex));
+        setReorderedVelocity(slot, getVelocity(vIndex));
+        newParticleIds[slot] = particleIds[vIndex];
+    }
+}
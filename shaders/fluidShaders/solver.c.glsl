@@ -0,0 +1,296 @@
+#version 430 core
+
+#define M_PI 3.1415926535897932384626433832795
+
+// ***** COMPUTE SHADER INPUT *****
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+// ***** COMPUTE SHADER OUTPUT *****
+
+// ***** COMPUTE SHADER UNIFORMS *****
+// 0: compute lambda, 1: compute deltaP and write the corrected positions to solvedPositions,
+// 2: as 1 for the last solver iteration, also updating the velocities and colors
+uniform uint solverPass;
+
+layout(shared, binding = 4) uniform FluidDynamics {
+    uint maxParticles;
+    uint neighborCapacity;
+    uint mapSize;
+    float supportRadius;
+    float dt;
+    uint solverIters;
+    float restDensity;
+    float epsilon;
+    float collisionEpsilon;
+    float kpoly;
+    float kspiky;
+    float scorr;
+    float dcorr;
+    int pcorr;
+    float kxsph;
+    float vortEpsilon;
+    float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
+} fluid;
+
+// ***** COMPUTE SHADER STRUCTS *****
+
+// Range of a particle's neighbors in neighborList
+struct NeighborRange {
+    uint first;
+    uint last;
+};
+
+// ***** COMPUTE SHADER BUFFERS *****
+/*
+    position = 1;
+    positionStar = 2;
+    velocity = 3;
+    lambda = 5;
+    solvedPosition = 6;
+    color = 7;
+    neighborList = 10;
+    sortedIndices = 13;
+    neighborOffsets = 19;
+    particleRanks = 24;
+*/
+layout(std430, binding=1) buffer PosBuf {
+    float positions[];
+};
+
+layout(std430, binding=2) buffer UpdatedPosBuf {
+    float newPositions[];
+};
+
+layout(std430, binding=3) buffer velBuf {
+    float velocities[];
+};
+
+layout(std430, binding=5) buffer LambdaBuf {
+    float lambdas[];
+};
+
+// Positions after this iteration's correction, swapped with newPositions by the host after every iteration so
+// no invocation reads a position another one already moved
+layout(std430, binding=6) buffer SolvedPosBuf {
+    float solvedPositions[];
+};
+
+layout(std430, binding=7) buffer ColorBuf {
+    float colors[];
+};
+
+// Packed neighbor indices, particle i owns [neighborOffsets[i], neighborOffsets[i + 1])
+layout(std430, binding=10) buffer NeighborListBuf {
+    uint neighborList[];
+};
+
+layout(std430, binding=13) buffer SortedIndexBuf {
+    uint sortedIndices[];
+};
+
+layout(std430, binding=19) buffer NeighborOffsetBuf {
+    uint neighborOffsets[];
+};
+
+// Position of every particle in the cell sorted order, the inverse of sortedIndices
+layout(std430, binding=24) buffer ParticleRankBuf {
+    uint particleRanks[];
+};
+
+// ***** COMPUTE SHADER SHARED MEMORY *****
+// The work group's own particles, consecutive in cell sorted order and so mostly each other's neighbors
+// xyz: predicted position, w: lambda (pass 1 and 2 only)
+shared vec4 groupParticles[gl_WorkGroupSize.x];
+
+// ***** COMPUTE SHADER SUBROUTINES *****
+// ***** COMPUTE SHADER HELPER FUNCTIONS *****
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getPosition(uint i){
+    return vec3(positions[i], positions[fluid.particleStride + i], positions[2 * fluid.particleStride + i]);
+}
+
+vec3 getNewPosition(uint i){
+    return vec3(newPositions[i], newPositions[fluid.particleStride + i], newPositions[2 * fluid.particleStride + i]);
+}
+
+void setSolvedPosition(uint i, vec3 value){
+    solvedPositions[i] = value.x;
+    solvedPositions[fluid.particleStride + i] = value.y;
+    solvedPositions[2 * fluid.particleStride + i] = value.z;
+}
+
+void setVelocity(uint i, vec3 value){
+    velocities[i] = value.x;
+    velocities[fluid.particleStride + i] = value.y;
+    velocities[2 * fluid.particleStride + i] = value.z;
+}
+
+void setColor(uint i, vec3 value){
+    colors[i] = value.x;
+    colors[fluid.particleStride + i] = value.y;
+    colors[2 * fluid.particleStride + i] = value.z;
+}
+
+// Returns particle i's neighbors, clamped to the list capacity if the neighbor list overflowed
+NeighborRange getNeighbors(uint i){
+    return NeighborRange(min(neighborOffsets[i], fluid.neighborCapacity), min(neighborOffsets[i + 1], fluid.neighborCapacity));
+}
+
+// Returns particle j's position and, after pass 0, its lambda, from shared memory when it belongs to this work group
+vec4 getNeighbor(uint j){
+    uint local = particleRanks[j] - gl_WorkGroupID.x * gl_WorkGroupSize.x;
+    if (local < gl_WorkGroupSize.x){
+        return groupParticles[local];
+    }
+    return vec4(getNewPosition(j), solverPass == 0 ? 0.0 : lambdas[j]);
+}
+
+// Calculates the magnitude of the vector squared
+float squareMagnitude(vec3 vec){
+    return vec.x*vec.x + vec.y*vec.y + vec.z*vec.z;
+}
+
+// Poly Smoothing Kernel
+// SOURCE: Mathias Muller et al (2003)
+float WPoly(vec3 dist){
+    float rLen2 = squareMagnitude(dist);
+    if (rLen2 > fluid.supportRadius * fluid.supportRadius || rLen2 <= 0.0000001) {
+        return 0;
+    }
+
+    float h2minusr2 = fluid.supportRadius * fluid.supportRadius - rLen2;
+    return fluid.kpoly * h2minusr2 * h2minusr2 * h2minusr2;
+}
+
+// Gradient Spiky Smoothing Kernel
+// SOURCE: Mathias Muller et al (2003)
+vec3 gradWSpiky(vec3 dist){
+    float rLen = length(dist);
+
+    if (rLen > fluid.supportRadius || rLen <= 0.0000001){
+        return vec3(0.0);
+    }
+
+    float hminusr = fluid.supportRadius - rLen;
+    return fluid.kspiky * (hminusr * hminusr) * normalize(dist);
+}
+
+float sCorr(vec3 pi, vec3 pj){
+    return -fluid.scorr * pow(WPoly(pi-pj)/fluid.dcorr, fluid.pcorr);
+}
+
+// SPH density constraint and the sum of its squared gradients in one walk over the neighbors
+// SOURCE: Position Based Fluids Macklin
+float lambda(uint vIndex, vec3 pos){
+    NeighborRange neighborData = getNeighbors(vIndex);
+
+    float density = 0.0;
+    vec3 gradientI = vec3(0.0);
+    float sumGradients = 0.0;
+    for (uint i = neighborData.first; i < neighborData.last; i++){
+        vec3 dist = pos - getNeighbor(neighborList[i]).xyz;
+        density += WPoly(dist);
+
+        //Calculate gradient with respect to j
+        vec3 gradientJ = gradWSpiky(dist) / fluid.restDensity;
+        sumGradients += squareMagnitude(gradientJ);
+        gradientI += gradientJ;
+    }
+    //Add the particle i gradient magnitude squared to sum
+    sumGradients += squareMagnitude(gradientI);
+
+    float densityConstraint = (density / fluid.restDensity) - 1.0;
+    return -densityConstraint/(sumGradients + fluid.epsilon);
+}
+
+vec3 deltaP(uint vIndex, vec3 pos, float lambdaI){
+    vec3 deltaPos = vec3(0.0);
+
+    NeighborRange neighborData = getNeighbors(vIndex);
+    for (uint i = neighborData.first; i < neighborData.last; i++){
+        vec4 neighbor = getNeighbor(neighborList[i]);
+        float s = sCorr(pos, neighbor.xyz);
+        deltaPos += (lambdaI + neighbor.w + s) * gradWSpiky(pos - neighbor.xyz);
+    }
+
+    return deltaPos / fluid.restDensity;
+}
+
+vec3 confineToBox(vec3 pos, vec3 deltaPos){
+    vec3 newPos = pos + deltaPos;
+
+    // Check floor
+    float wallY = -1.0;
+    if (fluid.time > 5.0){
+        wallY = -5.0;
+    }
+    if (newPos.y < wallY){
+        deltaPos.y = wallY - newPos.y + fluid.collisionEpsilon;
+    } else if (newPos.y > 20.0){
+        deltaPos.y = 20.0 - newPos.y - fluid.collisionEpsilon;
+    }
+    // Check left wall
+    float wallW = 2.5;
+    if (fluid.time > 5.2){
+        wallW = 4.0;
+    }
+    if (newPos.x < -wallW){
+        deltaPos.x = -wallW - newPos.x + fluid.collisionEpsilon;
+    } else if (newPos.x > wallW){
+        // Check right wall
+        deltaPos.x = wallW - newPos.x - fluid.collisionEpsilon;
+    }
+    // Check front wall
+    if (newPos.z < -wallW){
+        deltaPos.z = -wallW - newPos.z + fluid.collisionEpsilon;
+    } else if (newPos.z > wallW){
+        deltaPos.z = wallW - newPos.z - fluid.collisionEpsilon;
+    }
+
+    return deltaPos;
+}
+
+void main() {
+    // Walk the particles in cell sorted order so a work group holds neighboring particles
+    uint sortedIndex = gl_GlobalInvocationID.x;
+    uint localIndex = gl_LocalInvocationID.x;
+    bool active = sortedIndex < fluid.maxParticles;
+    uint vIndex = active ? sortedIndices[sortedIndex] : 0u;
+
+    // Stage the work group's particles, every invocation has to reach the barrier
+    if (active){
+        groupParticles[localIndex] = vec4(getNewPosition(vIndex), solverPass == 0 ? 0.0 : lambdas[vIndex]);
+    }
+    barrier();
+    if (!active){
+        return;
+    }
+
+    vec4 particle = groupParticles[localIndex];
+    if (solverPass == 0){
+        // Calculate lambda
+        lambdas[vIndex] = lambda(vIndex, particle.xyz);
+    } else {
+        // Calculate Delta P, then collision detection and response
+        vec3 dp = deltaP(vIndex, particle.xyz, particle.w);
+        dp = confineToBox(particle.xyz, dp);
+
+        // Apply it to a copy so the neighbors of this particle still read its uncorrected position
+        vec3 newPos = particle.xyz + dp;
+        setSolvedPosition(vIndex, newPos);
+        if (solverPass == 2){
+            setVelocity(vIndex, (newPos - getPosition(vIndex))/fluid.dt);
+            setColor(vIndex, 0.5*(normalize(dp) + vec3(1.0)));
+        }
+    }
+}
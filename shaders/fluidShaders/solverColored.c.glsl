@@ -0,0 +1,276 @@
+#version 430 core
+
+#define M_PI 3.1415926535897932384626433832795
+
+// ***** COMPUTE SHADER INPUT *****
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+// ***** COMPUTE SHADER OUTPUT *****
+
+// ***** COMPUTE SHADER UNIFORMS *****
+// Gauss-Seidel alternative to solver.c.glsl
+// 0: one invocation per grid cell of the color at colorOffset, projecting the density constraints of the cell's
+// particles in place, 1: confine every particle to the box, 2: as 1 for the last iteration, also updating the velocities
+uniform uint coloredPass;
+// Cells of a color are colorStride apart along every axis, far enough that no two of them share a neighbor
+uniform uvec3 colorOffset;
+uniform uint colorStride;
+// Relaxation of the constraints in place of fluid.epsilon, every projection sees the ones before it, so it does not
+// need Jacobi's large epsilon against overshooting
+uniform float coloredEpsilon;
+
+layout(shared, binding = 4) uniform FluidDynamics {
+    uint maxParticles;
+    uint neighborCapacity;
+    uint mapSize;
+    float supportRadius;
+    float dt;
+    uint solverIters;
+    float restDensity;
+    float epsilon;
+    float collisionEpsilon;
+    float kpoly;
+    float kspiky;
+    float scorr;
+    float dcorr;
+    int pcorr;
+    float kxsph;
+    float vortEpsilon;
+    float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
+} fluid;
+
+// ***** COMPUTE SHADER STRUCTS *****
+
+// ***** COMPUTE SHADER BUFFERS *****
+/*
+    position = 1;
+    positionStar = 2;
+    velocity = 3;
+    lambda = 5;
+    color = 7;
+    cellStart = 9;
+    neighborList = 10;
+    sortedIndices = 13;
+    neighborOffsets = 19;
+*/
+layout(std430, binding=1) buffer PosBuf {
+    float positions[];
+};
+
+// Corrected in place, the colors keep the invocations of one dispatch from touching the same particle
+layout(std430, binding=2) buffer UpdatedPosBuf {
+    float newPositions[];
+};
+
+layout(std430, binding=3) buffer velBuf {
+    float velocities[];
+};
+
+layout(std430, binding=5) buffer LambdaBuf {
+    float lambdas[];
+};
+
+layout(std430, binding=7) buffer ColorBuf {
+    float colors[];
+};
+
+layout(std430, binding=9) buffer CellStartBuf {
+    uint cellStart[];
+};
+
+// Packed neighbor indices, particle i owns [neighborOffsets[i], neighborOffsets[i + 1])
+layout(std430, binding=10) buffer NeighborListBuf {
+    uint neighborList[];
+};
+
+layout(std430, binding=13) buffer SortedIndexBuf {
+    uint sortedIndices[];
+};
+
+layout(std430, binding=19) buffer NeighborOffsetBuf {
+    uint neighborOffsets[];
+};
+
+// ***** COMPUTE SHADER SUBROUTINES *****
+// ***** COMPUTE SHADER HELPER FUNCTIONS *****
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getPosition(uint i){
+    return vec3(positions[i], positions[fluid.particleStride + i], positions[2 * fluid.particleStride + i]);
+}
+
+vec3 getNewPosition(uint i){
+    return vec3(newPositions[i], newPositions[fluid.particleStride + i], newPositions[2 * fluid.particleStride + i]);
+}
+
+void setNewPosition(uint i, vec3 value){
+    newPositions[i] = value.x;
+    newPositions[fluid.particleStride + i] = value.y;
+    newPositions[2 * fluid.particleStride + i] = value.z;
+}
+
+void setVelocity(uint i, vec3 value){
+    velocities[i] = value.x;
+    velocities[fluid.particleStride + i] = value.y;
+    velocities[2 * fluid.particleStride + i] = value.z;
+}
+
+void setColor(uint i, vec3 value){
+    colors[i] = value.x;
+    colors[fluid.particleStride + i] = value.y;
+    colors[2 * fluid.particleStride + i] = value.z;
+}
+
+uint cellIndex(uvec3 cell){
+    return cell.x + fluid.gridDims.x * (cell.y + fluid.gridDims.y * cell.z);
+}
+
+// Calculates the magnitude of the vector squared
+float squareMagnitude(vec3 vec){
+    return vec.x*vec.x + vec.y*vec.y + vec.z*vec.z;
+}
+
+// Poly Smoothing Kernel
+// SOURCE: Mathias Muller et al (2003)
+float WPoly(vec3 dist){
+    float rLen2 = squareMagnitude(dist);
+    if (rLen2 > fluid.supportRadius * fluid.supportRadius || rLen2 <= 0.0000001) {
+        return 0;
+    }
+
+    float h2minusr2 = fluid.supportRadius * fluid.supportRadius - rLen2;
+    return fluid.kpoly * h2minusr2 * h2minusr2 * h2minusr2;
+}
+
+// Gradient Spiky Smoothing Kernel
+// SOURCE: Mathias Muller et al (2003)
+vec3 gradWSpiky(vec3 dist){
+    float rLen = length(dist);
+
+    if (rLen > fluid.supportRadius || rLen <= 0.0000001){
+        return vec3(0.0);
+    }
+
+    float hminusr = fluid.supportRadius - rLen;
+    return fluid.kspiky * (hminusr * hminusr) * normalize(dist);
+}
+
+float sCorr(vec3 pi, vec3 pj){
+    return -fluid.scorr * pow(WPoly(pi-pj)/fluid.dcorr, fluid.pcorr);
+}
+
+// Solves particle i's density constraint alone and moves it and its neighbors along the constraint gradient
+// The constraint only resists compression, pulling the sparse surface particles in at this strength packs the fluid
+// Each pair's sCorr is split between the constraints of its two particles, as solver.c.glsl applies it once
+// SOURCE: Position Based Fluids Macklin, Position Based Dynamics Muller et al (Gauss-Seidel projection)
+void projectDensityConstraint(uint vIndex){
+    vec3 pos = getNewPosition(vIndex);
+    uint first = min(neighborOffsets[vIndex], fluid.neighborCapacity);
+    uint last = min(neighborOffsets[vIndex + 1], fluid.neighborCapacity);
+
+    float density = 0.0;
+    vec3 gradientI = vec3(0.0);
+    float sumGradients = 0.0;
+    for (uint n = first; n < last; n++){
+        vec3 dist = pos - getNewPosition(neighborList[n]);
+        density += WPoly(dist);
+
+        vec3 gradientJ = gradWSpiky(dist) / fluid.restDensity;
+        sumGradients += squareMagnitude(gradientJ);
+        gradientI += gradientJ;
+    }
+    sumGradients += squareMagnitude(gradientI);
+    float lambda = -max((density / fluid.restDensity) - 1.0, 0.0) / (sumGradients + coloredEpsilon);
+    lambdas[vIndex] = lambda;
+
+    vec3 deltaPos = vec3(0.0);
+    for (uint n = first; n < last; n++){
+        uint j = neighborList[n];
+        vec3 neighbor = getNewPosition(j);
+        vec3 correction = (lambda + 0.5 * sCorr(pos, neighbor)) / fluid.restDensity * gradWSpiky(pos - neighbor);
+        deltaPos += correction;
+        setNewPosition(j, neighbor - correction);
+    }
+    setNewPosition(vIndex, pos + deltaPos);
+    if (squareMagnitude(deltaPos) > 0.0){
+        setColor(vIndex, 0.5*(normalize(deltaPos) + vec3(1.0)));
+    }
+}
+
+vec3 confineToBox(vec3 pos, vec3 deltaPos){
+    vec3 newPos = pos + deltaPos;
+
+    // Check floor
+    float wallY = -1.0;
+    if (fluid.time > 5.0){
+        wallY = -5.0;
+    }
+    if (newPos.y < wallY){
+        deltaPos.y = wallY - newPos.y + fluid.collisionEpsilon;
+    } else if (newPos.y > 20.0){
+        deltaPos.y = 20.0 - newPos.y - fluid.collisionEpsilon;
+    }
+    // Check left wall
+    float wallW = 2.5;
+    if (fluid.time > 5.2){
+        wallW = 4.0;
+    }
+    if (newPos.x < -wallW){
+        deltaPos.x = -wallW - newPos.x + fluid.collisionEpsilon;
+    } else if (newPos.x > wallW){
+        // Check right wall
+        deltaPos.x = wallW - newPos.x - fluid.collisionEpsilon;
+    }
+    // Check front wall
+    if (newPos.z < -wallW){
+        deltaPos.z = -wallW - newPos.z + fluid.collisionEpsilon;
+    } else if (newPos.z > wallW){
+        deltaPos.z = wallW - newPos.z - fluid.collisionEpsilon;
+    }
+
+    return deltaPos;
+}
+
+void main() {
+    if (coloredPass == 0){
+        // Invocation k is the k-th cell of the color, cells past the edge of the grid have nothing to do
+        uvec3 colorDims = (fluid.gridDims + colorStride - 1u) / colorStride;
+        uint k = gl_GlobalInvocationID.x;
+        if (k >= colorDims.x * colorDims.y * colorDims.z){
+            return;
+        }
+        uvec3 cell = colorOffset + colorStride * uvec3(k % colorDims.x, (k / colorDims.x) % colorDims.y,
+                                                       k / (colorDims.x * colorDims.y));
+        if (any(greaterThanEqual(cell, fluid.gridDims))){
+            return;
+        }
+
+        // The constraints of one cell share particles, so they are projected one after the other
+        uint c = cellIndex(cell);
+        for (uint s = cellStart[c]; s < cellStart[c + 1]; s++){
+            projectDensityConstraint(sortedIndices[s]);
+        }
+    } else {
+        uint vIndex = gl_GlobalInvocationID.x;
+        if (vIndex >= fluid.maxParticles){
+            return;
+        }
+
+        // Collision detection and response
+        vec3 pos = getNewPosition(vIndex);
+        pos += confineToBox(pos, vec3(0.0));
+        setNewPosition(vIndex, pos);
+        if (coloredPass == 2){
+            setVelocity(vIndex, (pos - getPosition(vIndex))/fluid.dt);
+        }
+    }
+}
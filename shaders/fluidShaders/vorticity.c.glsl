@@ -3,7 +3,11 @@
 #define M_PI 3.1415926535897932384626433832795
 
 // ***** COMPUTE SHADER INPUT *****
-layout(local_size_x = 1000, local_size_y = 1, local_size_z = 1) in;
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
 
 // ***** COMPUTE SHADER OUTPUT *****
 
@@ -20,7 +24,7 @@ layout(shared, binding = 0) uniform Matricies{
 
 layout(shared, binding = 4) uniform FluidDynamics {
     uint maxParticles;
-    uint maxNeighbors;
+    uint neighborCapacity;
     uint mapSize;
     float supportRadius;
     float dt;
@@ -36,6 +40,12 @@ layout(shared, binding = 4) uniform FluidDynamics {
     float kxsph;
     float vortEpsilon;
     float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
 } fluid;
 
 // ***** COMPUTE SHADER STRUCTS *****
@@ -48,9 +58,10 @@ struct NodeType {
     uint particleIndex;
 };
 
-struct NeighborType {
-    uint count;
-    uint neighboring[500];
+// Range of a particle's neighbors in neighborList
+struct NeighborRange {
+    uint first;
+    uint last;
 };
 
 // ***** COMPUTE SHADER BUFFERS *****
@@ -65,32 +76,58 @@ struct NeighborType {
     color = 7;
     hashMap = 8;
     linkedList = 9;
-    neighbors = 10;
+    neighborList = 10;
     counter = 0;
+    neighborOffsets = 19;
 */
 
 layout(std430, binding=2) buffer UpdatedPosBuf {
-    vec4 newPositions[];
+    float newPositions[];
 };
 
 layout(std430, binding=3) buffer VelBuf {
-    vec4 velocities[];
+    float velocities[];
 };
 
 layout(std430, binding=4) buffer NewVelBuf {
-    vec4 newVelocities[];
+    float newVelocities[];
 };
 
 layout(std430, binding=7) buffer ColorBuf {
-    vec4 colors[];
+    float colors[];
 };
 
-layout(std430, binding=10) buffer NeighborDataBuf {
-    NeighborType neighbors[];
+// Packed neighbor indices, particle i owns [neighborOffsets[i], neighborOffsets[i + 1])
+layout(std430, binding=10) buffer NeighborListBuf {
+    uint neighborList[];
+};
+
+layout(std430, binding=19) buffer NeighborOffsetBuf {
+    uint neighborOffsets[];
 };
 
 // ***** COMPUTE SHADER SUBROUTINES *****
 // ***** COMPUTE SHADER HELPER FUNCTIONS *****
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getNewPosition(uint i){
+    return vec3(newPositions[i], newPositions[fluid.particleStride + i], newPositions[2 * fluid.particleStride + i]);
+}
+
+vec3 getVelocity(uint i){
+    return vec3(velocities[i], velocities[fluid.particleStride + i], velocities[2 * fluid.particleStride + i]);
+}
+
+void setNewVelocity(uint i, vec3 value){
+    newVelocities[i] = value.x;
+    newVelocities[fluid.particleStride + i] = value.y;
+    newVelocities[2 * fluid.particleStride + i] = value.z;
+}
+
+// Returns particle i's neighbors, clamped to the list capacity if the neighbor list overflowed
+NeighborRange getNeighbors(uint i){
+    return NeighborRange(min(neighborOffsets[i], fluid.neighborCapacity), min(neighborOffsets[i + 1], fluid.neighborCapacity));
+}
+
 // Calculates the magnitude of the vector squared
 float squareMagnitude(vec3 vec){
     return vec.x*vec.x + vec.y*vec.y + vec.z*vec.z;
@@ -121,31 +158,31 @@ vec3 gradWSpiky(vec3 dist){
     return fluid.kspiky * (hminusr * hminusr) * normalize(dist);
 }
 
-vec3 vorticityLocation(uint vIndex, NeighborType neighborData, vec3 pos, vec3 vel, float magnitude){
+vec3 vorticityLocation(uint vIndex, NeighborRange neighborData, vec3 pos, vec3 vel, float magnitude){
     vec3 location = vec3(0.0);
 
-    for (uint i = 0; i < neighborData.count; i++){
-        location += gradWSpiky(pos-vec3(newPositions[neighborData.neighboring[i]])) * magnitude;
+    for (uint i = neighborData.first; i < neighborData.last; i++){
+        location += gradWSpiky(pos-getNewPosition(neighborList[i])) * magnitude;
     }
 
     return location;
 }
 
 // Calculates the vorticity at particle location
-vec3 vorticity(uint vIndex, NeighborType neighborData, vec3 pos, vec3 vel){
+vec3 vorticity(uint vIndex, NeighborRange neighborData, vec3 pos, vec3 vel){
     vec3 vort = vec3(0.0);
 
-    for (uint i = 0; i < neighborData.count; i++){
-        vort += cross((vec3(velocities[neighborData.neighboring[i]]) - vel), gradWSpiky(pos-vec3(newPositions[neighborData.neighboring[i]])));
+    for (uint i = neighborData.first; i < neighborData.last; i++){
+        vort += cross((getVelocity(neighborList[i]) - vel), gradWSpiky(pos-getNewPosition(neighborList[i])));
     }
 
     return vort;
 }
 
 vec3 vorticityConfinement(uint vIndex){
-    NeighborType neighborData = neighbors[vIndex];
-    vec3 pos = vec3(newPositions[vIndex]);
-    vec3 vel = vec3(velocities[vIndex]);
+    NeighborRange neighborData = getNeighbors(vIndex);
+    vec3 pos = getNewPosition(vIndex);
+    vec3 vel = getVelocity(vIndex);
 
     vec3 vort = vorticity(vIndex, neighborData, pos, vel);
     if (length(vort) <= 0.00001){
@@ -163,8 +200,12 @@ vec3 vorticityConfinement(uint vIndex){
 
 void main() {
     uint vIndex = gl_GlobalInvocationID.x;
+    // The last work group runs past the end of the particles
+    if (vIndex >= fluid.maxParticles){
+        return;
+    }
 
     // Apply Vorticity Confinement and XSPH Viscosity
-    vec3 vel = vec3(velocities[vIndex]) + vorticityConfinement(vIndex) * fluid.dt;
-    newVelocities[vIndex].xyz = vel;
+    vec3 vel = getVelocity(vIndex) + vorticityConfinement(vIndex) * fluid.dt;
+    setNewVelocity(vIndex, vel);
 }
@@ -3,7 +3,11 @@
 #define M_PI 3.1415926535897932384626433832795
 
 // ***** COMPUTE SHADER INPUT *****
-layout(local_size_x = 1000, local_size_y = 1, local_size_z = 1) in;
+// WORK_GROUP_SIZE is injected by the host, the fallback only lets the file compile on its own
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 256
+#endif
+layout(local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
 
 // ***** COMPUTE SHADER OUTPUT *****
 
@@ -20,7 +24,7 @@ layout(shared, binding = 0) uniform Matricies{
 
 layout(shared, binding = 4) uniform FluidDynamics {
     uint maxParticles;
-    uint maxNeighbors;
+    uint neighborCapacity;
     uint mapSize;
     float supportRadius;
     float dt;
@@ -36,6 +40,12 @@ layout(shared, binding = 4) uniform FluidDynamics {
     float kxsph;
     float vortEpsilon;
     float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
 } fluid;
 
 // ***** COMPUTE SHADER STRUCTS *****
@@ -48,9 +58,10 @@ struct NodeType {
     uint particleIndex;
 };
 
-struct NeighborType {
-    uint count;
-    uint neighboring[500];
+// Range of a particle's neighbors in neighborList
+struct NeighborRange {
+    uint first;
+    uint last;
 };
 
 // ***** COMPUTE SHADER BUFFERS *****
@@ -65,30 +76,62 @@ struct NeighborType {
     color = 7;
     hashMap = 8;
     linkedList = 9;
-    neighbors = 10;
+    neighborList = 10;
     counter = 0;
+    neighborOffsets = 19;
 */
 layout(std430, binding=2) buffer UpdatedPosBuf {
-    vec4 newPositions[];
+    float newPositions[];
 };
 
 layout(std430, binding=3) buffer VelBuf {
-    vec4 velocities[];
+    float velocities[];
 };
 
 layout(std430, binding=4) buffer NewVelBuf {
-    vec4 newVelocities[];
+    float newVelocities[];
 };
 
 layout(std430, binding=7) buffer ColorBuf {
-    vec4 colors[];
+    float colors[];
 };
 
-layout(std430, binding=10) buffer NeighborDataBuf {
-    NeighborType neighbors[];
+// Packed neighbor indices, particle i owns [neighborOffsets[i], neighborOffsets[i + 1])
+layout(std430, binding=10) buffer NeighborListBuf {
+    uint neighborList[];
+};
+
+layout(std430, binding=19) buffer NeighborOffsetBuf {
+    uint neighborOffsets[];
 };
 
 // ***** COMPUTE SHADER SUBROUTINES *****
+// Particle buffers hold the x, y and z streams back to back, fluid.particleStride floats apart
+vec3 getNewPosition(uint i){
+    return vec3(newPositions[i], newPositions[fluid.particleStride + i], newPositions[2 * fluid.particleStride + i]);
+}
+
+vec3 getVelocity(uint i){
+    return vec3(velocities[i], velocities[fluid.particleStride + i], velocities[2 * fluid.particleStride + i]);
+}
+
+void setNewVelocity(uint i, vec3 value){
+    newVelocities[i] = value.x;
+    newVelocities[fluid.particleStride + i] = value.y;
+    newVelocities[2 * fluid.particleStride + i] = value.z;
+}
+
+void setColor(uint i, vec3 value){
+    colors[i] = value.x;
+    colors[fluid.particleStride + i] = value.y;
+    colors[2 * fluid.particleStride + i] = value.z;
+}
+
+// Returns particle i's neighbors, clamped to the list capacity if the neighbor list overflowed
+NeighborRange getNeighbors(uint i){
+    return NeighborRange(min(neighborOffsets[i], fluid.neighborCapacity), min(neighborOffsets[i + 1], fluid.neighborCapacity));
+}
+
 // Calculates the magnitude of the vector squared
 float squareMagnitude(vec3 vec){
     return vec.x*vec.x + vec.y*vec.y + vec.z*vec.z;
@@ -120,14 +163,14 @@ vec3 gradWSpiky(vec3 dist){
 }
 
 vec3 xsph(uint vIndex){
-    vec3 pos = vec3(newPositions[vIndex]);
-    vec3 vel = vec3(velocities[vIndex]);
-    NeighborType neighborData = neighbors[vIndex];
+    vec3 pos = getNewPosition(vIndex);
+    vec3 vel = getVelocity(vIndex);
+    NeighborRange neighborData = getNeighbors(vIndex);
 
     vec3 velNeighbor = vec3(0.0);
 
-    for (uint i = 0; i < neighborData.count; i++){
-        velNeighbor += (vec3(velocities[neighborData.neighboring[i]]) - vel) * WPoly(pos-vec3(newPositions[neighborData.neighboring[i]]));
+    for (uint i = neighborData.first; i < neighborData.last; i++){
+        velNeighbor += (getVelocity(neighborList[i]) - vel) * WPoly(pos-getNewPosition(neighborList[i]));
     }
 
     return vel + fluid.kxsph * velNeighbor;
@@ -135,11 +178,15 @@ vec3 xsph(uint vIndex){
 
 void main() {
     uint vIndex = gl_GlobalInvocationID.x;
+    // The last work group runs past the end of the particles
+    if (vIndex >= fluid.maxParticles){
+        return;
+    }
 
     // Apply XSPH Viscosity
     vec3 newVel = xsph(vIndex);
-    newVelocities[vIndex].xyz = newVel;
+    setNewVelocity(vIndex, newVel);
 
     // Set color to vel
-    colors[vIndex].rgb = 0.5*(normalize(newVel) + vec3(1.0));//vec3(0.0, 0.32, 0.62);// + 0.1*(normalize(newVel) + vec3(1.0));
+    setColor(vIndex, 0.5*(normalize(newVel) + vec3(1.0)));//vec3(0.0, 0.32, 0.62);// + 0.1*(normalize(newVel) + vec3(1.0));
 }
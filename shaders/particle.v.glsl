@@ -3,8 +3,13 @@
 // ***** VERTEX SHADER INPUT *****
 layout(location=0) in vec3 vPos;
 layout(location=1) in vec3 vNormal;
-layout(location=2) in vec4 vColor;
-layout(location=3) in vec4 vOffset;
+// color and offset come from the x, y and z streams of the particle buffers
+layout(location=2) in float vColorR;
+layout(location=3) in float vColorG;
+layout(location=4) in float vColorB;
+layout(location=5) in float vOffsetX;
+layout(location=6) in float vOffsetY;
+layout(location=7) in float vOffsetZ;
 
 
 // ***** VERTEX SHADER OUTPUT *****
@@ -38,7 +43,7 @@ layout(shared, binding = 2) uniform Light{
 
 void main() {
     // Calculate position in eye space
-    vec4 posEye = mtx.modelView * vec4(vPos + vOffset.xyz, 1.0);
+    vec4 posEye = mtx.modelView * vec4(vPos + vec3(vOffsetX, vOffsetY, vOffsetZ), 1.0);
     // Calculate position
     gl_Position = mtx.projection * posEye;
     // Calculate vertex normal
@@ -49,5 +54,5 @@ void main() {
     cameraVec = normalize(-(posEye).xyz);
 
     // pass color down
-    fColor = vColor.xyz;
+    fColor = vec3(vColorR, vColorG, vColorB);
 }
@@ -1,7 +1,8 @@
 #version 430
 
 // ***** COMPUTE SHADER INPUT *****
-layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+// One invocation per grid cell, calculateSignedDistanceField() rounds the dispatch up so the edges are bounds checked
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
 
 // ***** COMPUTE SHADER STRUCTS *****
 struct Triangle{
@@ -19,6 +20,15 @@ struct BoundingBox {
     vec4 backRightTop;
 };
 
+// Mirrors TriangleBVH::Node, an interior node's left child is the next node and first its right child, a leaf
+// holds triangles [first, first + count)
+struct BVHNode {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uint first;
+    uint count;
+};
+
 // ***** COMPUTE SHADER BUFFERS *****
 layout(std430, binding=11) buffer SignedDistanceField {
     mat4 transformMtx;
@@ -28,11 +38,21 @@ layout(std430, binding=11) buffer SignedDistanceField {
     SDFCell cells [];
 };
 
+// In BVH leaf order
 layout(std430, binding=12) buffer TriangleBuf {
     Triangle triangles[];
 };
 
+layout(std430, binding=28) buffer BVHBuf {
+    BVHNode nodes[];
+};
+
 // ***** COMPUTE SHADER UNIFORMS *****
+uniform uint numTriangles;
+
+// Deep enough for a median split tree of any triangle count
+#define BVH_STACK_SIZE 64
+#define FLT_MAX 3.402823466e+38
 // ***** COMPUTE SHADER SUBROUTINES *****
 // ***** COMPUTE SHADER HELPER FUNCTIONS *****
 float distTriangle(Triangle triangle, vec3 point){
@@ -172,16 +192,28 @@ float distTriangle(Triangle triangle, vec3 point){
     return sign * dist;
 }
 
+// Squared distance from point to the node's box, 0 inside
+float boxDistance2(BVHNode node, vec3 point){
+    vec3 outside = max(vec3(node.boundsMin) - point, vec3(0.0)) + max(point - vec3(node.boundsMax), vec3(0.0));
+    return dot(outside, outside);
+}
+
 void main() {
     // Get particle index
     uint xIndex = gl_GlobalInvocationID.x;
     uint yIndex = gl_GlobalInvocationID.y;
     uint zIndex = gl_GlobalInvocationID.z;
-    uint cellIndex = xIndex + yDim * (yIndex + zDim * zIndex);
+    if (xIndex >= xDim || yIndex >= yDim || zIndex >= zDim) {
+        return;
+    }
+    uint cellIndex = xIndex + xDim * (yIndex + yDim * zIndex);
 
     // Initialize to 0
     cells[cellIndex].distance = 0.0;
     cells[cellIndex].normal = vec4(0.0);
+    if (numTriangles == 0) {
+        return;
+    }
 
     // Calculate inverse of the transformation mtx
     mat4 inverseTransformMtx = inverse(transformMtx);
@@ -189,19 +221,45 @@ void main() {
     // Calculate world position
     vec3 pos = vec3(inverseTransformMtx * vec4(xIndex, yIndex, zIndex, 1.0));
 
-    // Find nearest triangle
-    Triangle minTri;
-    minTri.normal = vec4(0.0);
-    float minDist = 99999.9f;
-    float minSDist = 99999.0f;
-    for (int i = 0; i < 4096; i++) {
-        for (int j = 0; j < 4096 && 4096*i + j < 15876; j++){
-            float dist = distTriangle(triangles[4096*i + j], pos);
-            if (abs(dist) < minDist) {
-                minTri = triangles[4096*i + j];
-                minDist = abs(dist);
-                minSDist = dist;
+    // Find nearest triangle, nearer child first, skipping boxes further than the best triangle so far
+    uint minTri = 0;
+    float minDist = FLT_MAX;
+    float minSDist = FLT_MAX;
+    uint stack[BVH_STACK_SIZE];
+    uint size = 0;
+    stack[size++] = 0;
+    while (size > 0) {
+        uint index = stack[--size];
+        BVHNode node = nodes[index];
+        if (boxDistance2(node, pos) >= minDist) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (uint i = node.first; i < min(node.first + node.count, numTriangles); i++) {
+                float dist = distTriangle(triangles[i], pos);
+                if (abs(dist) < minDist) {
+                    minTri = i;
+                    minDist = abs(dist);
+                    minSDist = dist;
+                }
             }
+            continue;
+        }
+
+        uint near = index + 1;
+        uint far = node.first;
+        float nearDist = boxDistance2(nodes[near], pos);
+        float farDist = boxDistance2(nodes[far], pos);
+        if (farDist < nearDist) {
+            uint tmp = near; near = far; far = tmp;
+            float tmpDist = nearDist; nearDist = farDist; farDist = tmpDist;
+        }
+        if (farDist < minDist && size < BVH_STACK_SIZE) {
+            stack[size++] = far;
+        }
+        if (nearDist < minDist && size < BVH_STACK_SIZE) {
+            stack[size++] = near;
         }
     }
 
@@ -211,5 +269,5 @@ void main() {
     } else {
         cells[cellIndex].distance = sqrt(minDist);
     }
-    cells[cellIndex].normal = minTri.normal;
+    cells[cellIndex].normal = triangles[minTri].normal;
 }
@@ -1,5 +1,10 @@
 #version 430 core
 
+// Mirrors SDFBricks.hpp
+#define SDF_BRICK_SIZE 8u
+#define SDF_BRICK_OUTSIDE 0xffffffffu
+#define SDF_BRICK_INSIDE 0xfffffffeu
+
 // ***** FRAGMENT SHADER INPUT *****
 layout(location=0) in vec2 texCoord;
 layout(location=1) in vec3 pos;
@@ -7,11 +12,6 @@ layout(location=1) in vec3 pos;
 // ***** FRAGMENT SHADER UNIFORMS *****
 
 // ***** VERTEX SHADER STRUCTS *****
-struct SDFCell {
-    float distance;
-    vec4 normal;
-};
-
 struct BoundingBox {
     vec4 frontLeftBottom;
     vec4 backRightTop;
@@ -20,7 +20,7 @@ struct BoundingBox {
 // ***** VERTEX SHADER BUFFERS *****
 layout(shared, binding = 4) uniform FluidDynamics {
     uint maxParticles;
-    uint maxNeighbors;
+    uint neighborCapacity;
     uint mapSize;
     float supportRadius;
     float dt;
@@ -36,12 +36,23 @@ layout(shared, binding = 4) uniform FluidDynamics {
     float kxsph;
     float vortEpsilon;
     float time;
+    uint particleStride;
+    vec3 gridMin;
+    float cellSize;
+    uvec3 gridDims;
+    uint numCells;
+    float neighborSkin;
 } fluid;
 
+// Bricked as BrickedSDF in SDFBricks.hpp: a slot per brick of SDF_BRICK_SIZE^3 cells, a packed normal per slot,
+// then the (distance bits, packed normal) pairs of the bricks near the surface
 layout(std430, binding=11) buffer SignedDistanceField {
     mat4 transformMtx;
     uint xDim, yDim, zDim;
-    SDFCell cells [];
+    uint numBricks;
+    uvec3 brickDims;
+    float farDistance;
+    uint sdfData[];
 };
 
 // ***** FRAGMENT SHADER OUTPUT *****
@@ -49,6 +60,28 @@ layout(location=0) out vec4 fragColorOut;
 
 
 // ***** FRAGMENT SHADER HELPER FUNCTIONS *****
+// Distance of the SDF cell, negative inside the mesh, and its surface normal.  Cells of bricks away from the surface
+// are farDistance away, inside ones point along the normal of their brick's cell nearest the surface
+float sdfCell(uvec3 cell, out vec3 normal){
+    uvec3 brick = cell / SDF_BRICK_SIZE;
+    uint numSlots = brickDims.x * brickDims.y * brickDims.z;
+    uint slotIndex = brick.x + brickDims.x * (brick.y + brickDims.y * brick.z);
+    uint slot = sdfData[slotIndex];
+    if (slot == SDF_BRICK_OUTSIDE){
+        normal = vec3(0.0);
+        return farDistance;
+    }
+    if (slot == SDF_BRICK_INSIDE){
+        normal = unpackSnorm4x8(sdfData[numSlots + slotIndex]).xyz;
+        return -farDistance;
+    }
+    uvec3 local = cell % SDF_BRICK_SIZE;
+    uint index = 2u * (numSlots + slot * SDF_BRICK_SIZE * SDF_BRICK_SIZE * SDF_BRICK_SIZE +
+                       local.x + SDF_BRICK_SIZE * (local.y + SDF_BRICK_SIZE * local.z));
+    normal = unpackSnorm4x8(sdfData[index + 1]).xyz;
+    return uintBitsToFloat(sdfData[index]);
+}
+
 // Lookup function
 // position: The location in the world to check the sdf for
 // def: The default distance (returned when the point is outside of the sdf bounding box)
@@ -68,13 +101,9 @@ float distanceLookup(vec3 position, float def){
         return def;
     }
 
-    // Get index from dimension indices
-    int index = int(tranPos.x + yDim * (tranPos.y + zDim * tranPos.z));
-    if (index < 0 || index > xDim * yDim * zDim){
-        return def;
-    }
     // Get distance from sdf cells
-    return cells[index].distance;
+    vec3 normal;
+    return sdfCell(uvec3(tranPos), normal);
 }
 
 void main() {